@@ -1,6 +1,12 @@
 ﻿#pragma once
 
 #include <string>
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <chrono>
 #include <nlohmann/json.hpp>
 
 #ifdef __cplusplus
@@ -15,17 +21,136 @@ enum LicenseStatus {
     Tampered = 3,
     KeyError = 4,
     DecryptionFailed = 5,
-    ParseError = 6
+    ParseError = 6,
+    SchemaError = 7
+};
+
+// Detailed cause behind a LicenseStatus, as kept in VerifyRecord; the
+// comment names what reasonArg holds
+enum VerifyReason {
+    ReasonNone = 0,
+    ReasonNullArgument = 1,
+    ReasonKeyInvalid = 2,        // Master key is not Base64 of 32 bytes
+    ReasonKeyNotLoaded = 3,      // No keyring key matches the license
+    ReasonFileUnreadable = 4,    // License or bundle file missing, or not text
+    ReasonNotInBundle = 5,       // No bundle entry for the account
+    ReasonKeyIdMismatch = 6,     // Issued under another key
+    ReasonBase64Length = 7,      // Base64 characters, not a multiple of 4
+    ReasonBase64Character = 8,   // Offset of the first non-Base64 character
+    ReasonBase64Padding = 9,     // Offset of the misplaced '='
+    ReasonEnvelopeTooShort = 10, // Decoded bytes
+    ReasonFleetProof = 11,       // Malformed fleet proof
+    ReasonNotInFleet = 12,       // Account outside the fleet's Merkle root
+    ReasonTagMismatch = 13,      // HMAC differs (wrong account or altered license)
+    ReasonCipherPadding = 14,    // Tag matched but CBC padding did not; GetLastError()
+    ReasonCryptoFailure = 15,    // CryptoAPI call failed; GetLastError()
+    ReasonJsonSyntax = 16,       // Plaintext byte offset, -1 if unknown
+    ReasonExpired = 17,          // Expiry, Unix time
+    ReasonSchema = 18
+};
+
+// Where a verify outcome came from
+enum VerifySource {
+    SourceInProcess = 0,
+    SourceCoalesced = 1, // Shared an identical concurrent verify
+    SourceDaemon = 2,
+    SourceTicket = 3
+};
+
+// One verify as kept by the diagnostic rings
+struct VerifyRecord {
+    long long time;       // Completion, Unix time in milliseconds
+    long long durationUs;
+    long long licenseLen; // License text bytes
+    long long payloadLen; // Plaintext bytes, 0 unless decrypted here
+    long long reasonArg;  // See VerifyReason
+    int status;           // LicenseStatus
+    int reason;           // VerifyReason
+    int source;           // VerifySource
+    int threadId;
 };
 
 // Forward declaration for C interface
 class CSankeyLicenseDecoder;
+class CSankeyKeyContext;
+class CSankeyKeyring;
+class CSankeySchema;
 
 // C Interface functions
 __declspec(dllexport) CSankeyLicenseDecoder* Create();
 __declspec(dllexport) void Destroy(CSankeyLicenseDecoder* decoder);
 __declspec(dllexport) int Verify(CSankeyLicenseDecoder* decoder, const char* masterKeyB64, const char* licenseB64, const char* accountId);
 
+// Nothing is initialized at load; the first verify pays for the CryptoAPI
+// provider load, the process-wide tables and first-touch page faults in the
+// parser instead. Warmup does that work up front by verifying a built-in
+// license under a throwaway key (nothing is published or logged), so call it
+// early in OnInit. With background it runs on its own thread and returns at
+// once. Only the first call does the work, and only the first background
+// call starts a thread; later ones (every other EA's wrapper) return true at
+// once. false if the self-verify failed, or for background if the thread
+// could not be started.
+__declspec(dllexport) bool Warmup(bool background);
+
+// Key context functions (decode the master key once, reuse across verifies)
+__declspec(dllexport) CSankeyKeyContext* CreateKeyContext(const char* masterKeyB64);
+__declspec(dllexport) void DestroyKeyContext(CSankeyKeyContext* keyCtx);
+
+// Keyring for key rotation. v2 and fleet licenses ("v2:" + Base64(keyId || iv ||
+// hmac || cipher), "f1:" ...) name their key, so VerifyWithKeyring picks it directly and a
+// mismatch or forgery costs at most one HMAC. v1 licenses are tried against
+// each key in the order added. KeyError when no loaded key matches.
+__declspec(dllexport) CSankeyKeyring* CreateKeyring();
+__declspec(dllexport) void DestroyKeyring(CSankeyKeyring* keyring);
+__declspec(dllexport) bool AddKey(CSankeyKeyring* keyring, const char* masterKeyB64);
+__declspec(dllexport) int VerifyWithKeyring(CSankeyLicenseDecoder* decoder, CSankeyKeyring* keyring, const char* licenseB64, const char* accountId);
+
+// Support lookup: index of the candidate account the license was issued for,
+// or -1 if none matches (or the license is malformed / for another key).
+// The HMAC over the license body is computed once and only the accountId
+// suffix is hashed per candidate.
+__declspec(dllexport) int IdentifyAccount(CSankeyKeyContext* keyCtx, const char* licenseB64, const char** candidates, int count);
+
+// Verify keeping only the listed top-level keys (plus "expiry", which the
+// verify itself needs). Other keys are skipped while the plaintext is parsed,
+// so only the projected values stay resident; getters for anything else
+// return their default.
+__declspec(dllexport) int VerifyProjected(CSankeyLicenseDecoder* decoder, CSankeyKeyContext* keyCtx, const char* licenseB64, const char* accountId,
+                                          const char** keys, int count);
+
+// Payload schema (JSON Schema subset: required, and per property type,
+// minimum, maximum, minLength, maxLength) checked once when a license
+// verifies; a payload that does not conform gives SchemaError and is not
+// published. The properties a schema names are resolved into typed slots
+// when a payload is published, so getters for them skip the lookup and type
+// checks. CompileSchema returns nullptr for malformed or unsupported
+// schemas. A decoder keeps its own reference to the schema it was given, so
+// DestroySchema may be called while the schema is still set; nullptr clears it.
+__declspec(dllexport) CSankeySchema* CompileSchema(const char* schemaJson);
+__declspec(dllexport) void DestroySchema(CSankeySchema* schema);
+__declspec(dllexport) void SetSchema(CSankeyLicenseDecoder* decoder, CSankeySchema* schema);
+
+// Verify a license file by absolute path (e.g. <data folder>\MQL5\Files\license.txt)
+__declspec(dllexport) int VerifyFile(CSankeyLicenseDecoder* decoder, CSankeyKeyContext* keyCtx, const char* licensePath, const char* accountId);
+
+// Verify accountId's entry in a license bundle (many licenses in one file,
+// built with sankey-bundle). Invalid if the file is not a bundle or has no
+// entry for the account; only the index and that entry are read.
+__declspec(dllexport) int VerifyFromBundle(CSankeyLicenseDecoder* decoder, CSankeyKeyContext* keyCtx, const char* bundlePath, const char* accountId);
+
+// Verification ticket. When set, a successful VerifyFile writes a MAC'd
+// binary ticket to ticketPath, and later VerifyFile calls for the same
+// license text and account load the payload from it instead of decrypting.
+// Pass nullptr or "" to disable.
+__declspec(dllexport) void SetTicketPath(CSankeyLicenseDecoder* decoder, const char* ticketPath);
+
+// License file hot-reload. When the file content changes and the new license
+// verifies, its payload replaces the current one and the generation counter
+// is incremented. keyCtx must outlive the watch (StopWatch or Destroy).
+__declspec(dllexport) bool StartWatch(CSankeyLicenseDecoder* decoder, CSankeyKeyContext* keyCtx, const char* licensePath, const char* accountId);
+__declspec(dllexport) void StopWatch(CSankeyLicenseDecoder* decoder);
+__declspec(dllexport) int GetGeneration(CSankeyLicenseDecoder* decoder);
+
 // Getter functions
 __declspec(dllexport) const char* GetValue(CSankeyLicenseDecoder* decoder, const char* key, const char* defaultValue);
 __declspec(dllexport) int GetValueAsInt(CSankeyLicenseDecoder* decoder, const char* key, int defaultValue);
@@ -34,31 +159,191 @@ __declspec(dllexport) double GetValueAsDouble(CSankeyLicenseDecoder* decoder, co
 __declspec(dllexport) long GetValueAsDateTime(CSankeyLicenseDecoder* decoder, const char* key, long defaultValue);
 __declspec(dllexport) bool HasKey(CSankeyLicenseDecoder* decoder, const char* key);
 
+// Client mode for a local sankey-verifyd daemon, given its pipe name
+// (default \\.\pipe\sankey-verifyd). Verifies are sent to the daemon and fall
+// back to in-process verification whenever it cannot answer. nullptr or ""
+// turns client mode off; the SANKEY_VERIFYD_PIPE environment variable sets
+// the initial value.
+__declspec(dllexport) void SetVerifyDaemon(const char* pipeName);
+
+// Identical concurrent verifies in this process (same key, license and
+// accountId) are computed once and shared. executed counts verifies that
+// ran the full pipeline, coalesced counts calls that waited for one instead.
+__declspec(dllexport) void GetCoalesceStats(long long* executed, long long* coalesced);
+
+// Payloads are parsed against the key order and value types of the last
+// payload seen in this process (JSON.stringify output of one product is
+// stable); hits parsed on that fast path, misses went through the general
+// parser and re-learned the shape.
+__declspec(dllexport) void GetShapeCacheStats(long long* hits, long long* misses);
+
+// Span tracing of verify stages (key decode, license decode, HMAC, decrypt,
+// parse, expiry) and getters, off by default. Each thread keeps its most
+// recent 4096 spans; DumpTrace writes all of them as Chrome trace-event JSON
+// for chrome://tracing or Perfetto. Disabling keeps the recorded spans.
+__declspec(dllexport) void SetTracing(bool enabled);
+__declspec(dllexport) bool DumpTrace(const char* path);
+
+// Diagnostic rings of recent verifies, always on: each decoder keeps its last
+// 64 records and the process its last 1024 (decoder nullptr), whichever
+// decoder ran them. Recording takes no lock and reading does not pause
+// verifies. Copies up to capacity of the most recent records, oldest first,
+// and returns how many were copied.
+__declspec(dllexport) int ReadDiagnostics(CSankeyLicenseDecoder* decoder, VerifyRecord* records, int capacity);
+
+// SIMD kernel dispatch, resolved once from CPUID on first use. GetKernelInfo
+// writes a NUL-terminated JSON report (CPU features, detected and active
+// tier, kernel per primitive; "cryptoapi" where the CryptoAPI provider picks
+// its own AES-NI / SHA-NI code) and returns the buffer size it needs; the
+// buffer is written only when it is that large. SetKernelTier forces a tier
+// ("scalar", "sse2", "sse4", "avx2", "avx512") process-wide for benchmarks
+// and differential tests, nullptr or "" restores the detected one; false
+// for unknown tiers or ones this CPU lacks. SANKEY_KERNEL_TIER sets the
+// initial tier.
+__declspec(dllexport) int GetKernelInfo(char* buffer, int length);
+__declspec(dllexport) bool SetKernelTier(const char* tier);
+
+// Verify(masterKeyB64, ...) keeps decoded key contexts in a process-wide
+// LRU cache keyed by key digest. capacity <= 0 restores the default (1024).
+// Contexts in use are never evicted; evicted ones are zeroized once released.
+__declspec(dllexport) void SetKeyCacheCapacity(int capacity);
+__declspec(dllexport) void GetKeyCacheStats(long long* hits, long long* misses, long long* evictions);
+
 #ifdef __cplusplus
 }
 
+class CLicenseFileWatcher;
+class CVerifyLog;
+class CPayloadShapeCache;
+struct VerifyOutcome;
+
 // C++ Class definition
 class CSankeyLicenseDecoder {
 private:
-    nlohmann::json payload_;
-    bool isVerified_;
-    std::string lastStringResult_; // For returning const char* safely
+    // Value of one schema property, resolved from the payload when it is
+    // published so getters read it without a lookup, type checks or throws
+    struct PayloadSlot {
+        enum Kind : uint8_t { Absent, String, Integer, Number, Boolean, Other };
+        Kind kind;
+        bool boolean;
+        int64_t integer;
+        double number;             // Integer and Number
+        const std::string* string; // Into payload
+    };
+
+    // Published payload; slots are indexed by the schema's property ordinals,
+    // and empty when no schema was set at publish time
+    struct PayloadSnapshot {
+        std::shared_ptr<const nlohmann::json> payload;
+        std::shared_ptr<const CSankeySchema> schema;
+        std::vector<PayloadSlot> slots;
+
+        const PayloadSlot* slot(const char* key) const; // nullptr for keys outside the schema
+    };
+
+    std::shared_ptr<const PayloadSnapshot> payload_; // Verified payload; swapped atomically, null when not verified
+    std::atomic<int> generation_;
+    std::shared_ptr<const CSankeySchema> schema_; // Swapped atomically like payload_, null when unset
+    std::shared_ptr<const PayloadSnapshot> stringSnapshot_; // Keeps the last GetValue result alive
+    std::string ticketPath_;
+    std::unique_ptr<CLicenseFileWatcher> watcher_;
+    std::unique_ptr<CVerifyLog> log_;
+
+    // Decoded license; pointers are views into bin
+    struct LicenseEnvelope {
+        std::vector<unsigned char> bin;
+        const unsigned char* header; // MAC'd bytes ahead of the iv: v2 keyId, fleet keyId || root || leafCount
+        size_t headerLen;            // 0 for v1
+        const unsigned char* fleetRoot; // Fleet only, nullptr otherwise
+        uint32_t leafCount;
+        std::vector<unsigned char> proof; // Fleet only: index u32 || sibling hashes
+        const unsigned char* iv;
+        const unsigned char* hmac;
+        unsigned char* cipher;
+        size_t cipherLen;
+        VerifyReason reason; // Set with a failing status
+        long long reasonArg;
+    };
 
     // Utility functions
-    bool base64_decode(const std::string& in, std::vector<unsigned char>& out);
-    bool hmac_sha256(const std::vector<unsigned char>& key, const std::vector<unsigned char>& data, std::vector<unsigned char>& mac);
-    bool aes_cbc_decrypt(const std::vector<unsigned char>& key, const std::vector<unsigned char>& iv,
-                        const std::vector<unsigned char>& cipher, std::vector<unsigned char>& plain);
+    static bool base64_decode(const char* in, size_t len, std::vector<unsigned char>& out);
+    static VerifyReason base64Fault(const char* in, size_t len, long long& arg);
+    static bool hmac_sha256(const CSankeyKeyContext& keyCtx, const LicenseEnvelope& envelope, const char* accountId,
+                            unsigned char mac[32]);
+    static bool fleetContains(const CSankeyKeyContext& keyCtx, const LicenseEnvelope& envelope, const char* accountId);
+    static LicenseStatus parseEnvelope(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen,
+                                       LicenseEnvelope& envelope);
+    static bool envelopeTag(const char* licenseB64, size_t licenseLen, unsigned char tag[32]);
+    static LicenseStatus authDecrypt(const CSankeyKeyContext& keyCtx, LicenseEnvelope& envelope, const char* macAccountId,
+                                     size_t& plainLen);
+    static LicenseStatus authDecryptParallel(const CSankeyKeyContext& keyCtx, LicenseEnvelope& envelope,
+                                             const char* macAccountId, size_t bulk, unsigned threads, size_t& plainLen);
     long parseISODateTime(const std::string& isoString);
 
+    LicenseStatus decodeLicense(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen, const char* accountId,
+                                VerifyOutcome& outcome, const std::vector<std::string>* projection, CPayloadShapeCache& shapes);
+    static void project(nlohmann::json& payload, const std::vector<std::string>& projection);
+    LicenseStatus decodeFile(const CSankeyKeyContext& keyCtx, const char* licensePath, const char* accountId,
+                             std::shared_ptr<const nlohmann::json>& payload);
+    LicenseStatus decodeFileWithTicket(const CSankeyKeyContext& keyCtx, const char* licensePath, const char* accountId,
+                                       std::shared_ptr<const nlohmann::json>& payload);
+    bool fileDigest(const CSankeyKeyContext& keyCtx, const std::string& path, std::array<unsigned char, 32>& digest);
+    LicenseStatus applySchema(LicenseStatus status, std::shared_ptr<const nlohmann::json>& payload) const;
+    void publish(std::shared_ptr<const nlohmann::json> payload);
+    void logVerify(const VerifyOutcome& outcome, size_t licenseLen, std::chrono::steady_clock::time_point started);
+    void logRejected(LicenseStatus status, VerifyReason reason); // Turned away before decode()
+    std::shared_ptr<const PayloadSnapshot> currentPayload() const;
+
 public:
     CSankeyLicenseDecoder();
     ~CSankeyLicenseDecoder();
 
     LicenseStatus verify(const char* masterKeyB64, const char* licenseB64, const char* accountId);
+    LicenseStatus verify(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen, const char* accountId);
+    LicenseStatus verify(const CSankeyKeyring& keyring, const char* licenseB64, size_t licenseLen, const char* accountId);
+    LicenseStatus verifyProjected(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen, const char* accountId,
+                                  const std::vector<std::string>& projection);
+    LicenseStatus verifyFile(const CSankeyKeyContext& keyCtx, const char* licensePath, const char* accountId);
+    LicenseStatus verifyBundle(const CSankeyKeyContext& keyCtx, const char* bundlePath, const char* accountId);
+
+    void setTicketPath(const char* ticketPath);
+    void setSchema(std::shared_ptr<const CSankeySchema> schema);
+
+    // Verify without publishing to this decoder (shared with sankey-verifyd).
+    // projection, when given, limits the payload to those top-level keys
+    LicenseStatus decode(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen, const char* accountId,
+                         std::shared_ptr<const nlohmann::json>& payload, const std::vector<std::string>* projection = nullptr);
+    // Verify on the calling thread alone, for batch callers that spread the
+    // work themselves (sankey-audit): no single flight, daemon, schema or
+    // verify logs, and payloads are parsed with shapes rather than the
+    // process shape cache. An Expired outcome carries the expiry in reasonArg
+    void decodeLocal(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen, const char* accountId,
+                     CPayloadShapeCache& shapes, VerifyOutcome& outcome);
+    long payloadExpiry(const nlohmann::json& payload);
+
+    // Key id named by a v2 or fleet envelope; false for v1, which names none
+    static bool envelopeKeyId(const char* licenseB64, size_t licenseLen, unsigned char keyId[8]);
+    static int identifyAccount(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen,
+                               const char* const* candidates, int count);
+
+    // See Warmup(); runs once per process
+    static bool warmup();
+
+    // Threads a license past authDecrypt's parallel threshold is decrypted
+    // on, this one included; 0 (the default) uses every hardware thread and
+    // 1 keeps the single-threaded path
+    static void setDecryptThreads(unsigned threads);
+
+    // Hot-reload
+    bool startWatch(const CSankeyKeyContext& keyCtx, const char* licensePath, const char* accountId);
+    void stopWatch();
+    int generation() const;
+
+    int readDiagnostics(VerifyRecord* records, int capacity) const;
     
     // Getter methods
     std::string getValue(const char* key, const char* defaultValue = "");
+    const char* getString(const char* key, const char* defaultValue = ""); // Valid until the next call
     int getValueAsInt(const char* key, int defaultValue = 0);
     bool getValueAsBool(const char* key, bool defaultValue = false);
     double getValueAsDouble(const char* key, double defaultValue = 0.0);
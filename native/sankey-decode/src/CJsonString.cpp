@@ -0,0 +1,224 @@
+﻿#include "CJsonString.h"
+#include "CKernelDispatch.h"
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define SANKEY_JSON_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SANKEY_JSON_AVX2 1
+#include <immintrin.h>
+#endif
+#ifdef __GNUC__
+#define SANKEY_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SANKEY_TARGET_AVX2 // MSVC emits AVX2 intrinsics without /arch
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+unsigned trailingZeros(unsigned v) {
+#ifdef _MSC_VER
+    unsigned long bit = 0;
+    _BitScanForward(&bit, v);
+    return bit;
+#else
+    return (unsigned)__builtin_ctz(v);
+#endif
+}
+
+bool isSpecial(unsigned char c) {
+    return c == '"' || c == '\\' || c < 0x20 || c >= 0x80;
+}
+
+int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool readHex4(const char*& p, const char* end, unsigned& value) {
+    if (end - p < 4) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; ++i) {
+        int d = hexDigit(*p++);
+        if (d < 0) return false;
+        value = value << 4 | (unsigned)d;
+    }
+    return true;
+}
+
+void appendUtf8(std::string& out, unsigned cp) {
+    if (cp < 0x80) {
+        out.push_back((char)cp);
+    } else if (cp < 0x800) {
+        out.push_back((char)(0xC0 | cp >> 6));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back((char)(0xE0 | cp >> 12));
+        out.push_back((char)(0x80 | (cp >> 6 & 0x3F)));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back((char)(0xF0 | cp >> 18));
+        out.push_back((char)(0x80 | (cp >> 12 & 0x3F)));
+        out.push_back((char)(0x80 | (cp >> 6 & 0x3F)));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    }
+}
+
+// p is just past the backslash
+bool unescape(const char*& p, const char* end, std::string& out) {
+    if (p == end) {
+        return false;
+    }
+    switch (*p++) {
+    case '"': out.push_back('"'); return true;
+    case '\\': out.push_back('\\'); return true;
+    case '/': out.push_back('/'); return true;
+    case 'b': out.push_back('\b'); return true;
+    case 'f': out.push_back('\f'); return true;
+    case 'n': out.push_back('\n'); return true;
+    case 'r': out.push_back('\r'); return true;
+    case 't': out.push_back('\t'); return true;
+    case 'u': break;
+    default: return false;
+    }
+
+    unsigned cp = 0;
+    if (!readHex4(p, end, cp)) {
+        return false;
+    }
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+        // A high surrogate must be followed by an escaped low surrogate
+        unsigned low = 0;
+        if (end - p < 2 || p[0] != '\\' || p[1] != 'u') {
+            return false;
+        }
+        p += 2;
+        if (!readHex4(p, end, low) || low < 0xDC00 || low > 0xDFFF) {
+            return false;
+        }
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+    } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+        return false;
+    }
+    appendUtf8(out, cp);
+    return true;
+}
+
+} // namespace
+
+const char* CJsonString::findSpecial(const char* p, const char* end) {
+    return CKernelDispatch::instance().findSpecial()(p, end);
+}
+
+const char* CJsonString::findSpecialScalar(const char* p, const char* end) {
+    while (p != end && !isSpecial((unsigned char)*p)) {
+        ++p;
+    }
+    return p;
+}
+
+const char* CJsonString::findSpecialSse2(const char* p, const char* end) {
+#ifdef SANKEY_JSON_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        // Unsigned v <= 0x1F; bytes >= 0x80 come from the sign bits
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                    _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+        unsigned mask = (unsigned)(_mm_movemask_epi8(hits) | _mm_movemask_epi8(v));
+        if (mask) {
+            return p + trailingZeros(mask);
+        }
+        p += 16;
+    }
+#endif
+    return findSpecialScalar(p, end);
+}
+
+SANKEY_TARGET_AVX2 const char* CJsonString::findSpecialAvx2(const char* p, const char* end) {
+#ifdef SANKEY_JSON_AVX2
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                                       _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+        unsigned mask = (unsigned)(_mm256_movemask_epi8(hits) | _mm256_movemask_epi8(v));
+        if (mask) {
+            return p + trailingZeros(mask);
+        }
+        p += 32;
+    }
+#endif
+    return findSpecialSse2(p, end);
+}
+
+size_t CJsonString::utf8Sequence(const unsigned char* p, const unsigned char* end) {
+    unsigned char c = *p;
+    size_t len;
+    unsigned char lo = 0x80, hi = 0xBF; // Range of the second byte
+    if (c >= 0xC2 && c <= 0xDF) {
+        len = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        len = 3;
+        if (c == 0xE0) lo = 0xA0;      // Overlong
+        else if (c == 0xED) hi = 0x9F; // Surrogates
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        len = 4;
+        if (c == 0xF0) lo = 0x90;      // Overlong
+        else if (c == 0xF4) hi = 0x8F; // Above U+10FFFF
+    } else {
+        return 0;
+    }
+
+    if ((size_t)(end - p) < len || p[1] < lo || p[1] > hi) {
+        return 0;
+    }
+    for (size_t i = 2; i < len; ++i) {
+        if ((p[i] & 0xC0) != 0x80) return 0;
+    }
+    return len;
+}
+
+bool CJsonString::scan(const char*& p, const char* end, std::string& out) {
+    if (p == end || *p != '"') {
+        return false;
+    }
+    const char* s = p + 1;
+    out.clear();
+
+    for (;;) {
+        const char* q = findSpecial(s, end);
+        out.append(s, q);
+        if (q == end) {
+            return false;
+        }
+
+        unsigned char c = (unsigned char)*q;
+        if (c == '"') {
+            p = q + 1;
+            return true;
+        }
+        if (c == '\\') {
+            s = q + 1;
+            if (!unescape(s, end, out)) return false;
+        } else if (c >= 0x80) {
+            size_t len = utf8Sequence(reinterpret_cast<const unsigned char*>(q), reinterpret_cast<const unsigned char*>(end));
+            if (len == 0) return false;
+            out.append(q, len);
+            s = q + len;
+        } else {
+            return false; // Unescaped control character
+        }
+    }
+}
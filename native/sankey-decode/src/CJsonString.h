@@ -0,0 +1,28 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <string>
+
+// JSON string stage for the payload fast path. Runs of plain ASCII are
+// skipped 16 or 32 bytes per step (SSE2 or AVX2 kernel, as picked by
+// CKernelDispatch), stopping only at a quote, backslash, control byte or
+// non-ASCII byte; escapes and multi-byte UTF-8 sequences are then handled
+// in place. Accepts and rejects exactly what nlohmann's lexer does.
+class CJsonString {
+public:
+    // p points at the opening quote. On success out holds the unescaped
+    // value and p is just past the closing quote.
+    static bool scan(const char*& p, const char* end, std::string& out);
+
+    // First byte in [p, end) that is '"', '\\', below 0x20 or above 0x7F,
+    // through the dispatched kernel
+    static const char* findSpecial(const char* p, const char* end);
+
+    // findSpecial kernels; the SIMD ones must only run where CPUID reports them
+    static const char* findSpecialScalar(const char* p, const char* end);
+    static const char* findSpecialSse2(const char* p, const char* end);
+    static const char* findSpecialAvx2(const char* p, const char* end);
+
+    // Length of the well-formed UTF-8 sequence at p (2-4), 0 if invalid
+    static size_t utf8Sequence(const unsigned char* p, const unsigned char* end);
+};
@@ -0,0 +1,157 @@
+﻿#include "CKernelDispatch.h"
+#include "CJsonString.h"
+#include <nlohmann/json.hpp>
+#include <cstdlib>
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace {
+
+const char* const kTierNames[CKernelDispatch::TierCount] = {"scalar", "sse2", "sse4", "avx2", "avx512"};
+
+void cpuid(int leaf, int subleaf, unsigned regs[4]) {
+    regs[0] = regs[1] = regs[2] = regs[3] = 0;
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    for (int i = 0; i < 4; ++i) regs[i] = (unsigned)r[i];
+#elif defined(__x86_64__) || defined(__i386__)
+    __get_cpuid_count((unsigned)leaf, (unsigned)subleaf, &regs[0], &regs[1], &regs[2], &regs[3]);
+#else
+    (void)leaf;
+    (void)subleaf;
+#endif
+}
+
+// XCR0: which register states the OS saves on context switch
+unsigned long long xcr0() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#elif defined(__x86_64__) || defined(__i386__)
+    unsigned lo = 0, hi = 0;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (unsigned long long)hi << 32 | lo;
+#else
+    return 0;
+#endif
+}
+
+} // namespace
+
+CKernelDispatch::CKernelDispatch() : features_(cpuFeatures()), detected_(Scalar), active_(Scalar), forced_(false) {
+    if (features_ & FeatureSse2) detected_ = Sse2;
+    if ((features_ & FeatureSse41) && (features_ & FeatureSse42)) detected_ = Sse4;
+    if (detected_ == Sse4 && (features_ & FeatureAvx2)) detected_ = Avx2;
+    if (detected_ == Avx2 && (features_ & FeatureAvx512F) && (features_ & FeatureAvx512Bw)) detected_ = Avx512;
+
+    select(detected_);
+    const char* forced = getenv("SANKEY_KERNEL_TIER");
+    if (forced) {
+        force(forced); // An unusable value keeps the detected tier
+    }
+}
+
+CKernelDispatch& CKernelDispatch::instance() {
+    static CKernelDispatch dispatch;
+    return dispatch;
+}
+
+unsigned CKernelDispatch::cpuFeatures() {
+    unsigned regs[4];
+    cpuid(0, 0, regs);
+    unsigned maxLeaf = regs[0];
+    if (maxLeaf < 1) {
+        return 0;
+    }
+
+    unsigned features = 0;
+    cpuid(1, 0, regs);
+    unsigned ecx = regs[2], edx = regs[3];
+    if (edx & (1u << 26)) features |= FeatureSse2;
+    if (ecx & (1u << 19)) features |= FeatureSse41;
+    if (ecx & (1u << 20)) features |= FeatureSse42;
+    if (ecx & (1u << 25)) features |= FeatureAesNi;
+
+    // AVX state must be enabled by the OS (OSXSAVE, XCR0 bits), not just present
+    bool osYmm = (ecx & (1u << 27)) && (ecx & (1u << 28)) && (xcr0() & 0x6) == 0x6;
+    bool osZmm = osYmm && (xcr0() & 0xE6) == 0xE6;
+    if (osYmm) features |= FeatureAvx;
+
+    if (maxLeaf >= 7) {
+        cpuid(7, 0, regs);
+        unsigned ebx = regs[1];
+        if (osYmm && (ebx & (1u << 5))) features |= FeatureAvx2;
+        if (osZmm && (ebx & (1u << 16))) features |= FeatureAvx512F;
+        if (osZmm && (ebx & (1u << 30))) features |= FeatureAvx512Bw;
+        if (ebx & (1u << 29)) features |= FeatureShaNi;
+    }
+    return features;
+}
+
+void CKernelDispatch::select(Tier tier) {
+    // The JSON string scanner has scalar, SSE2 and AVX2 kernels
+    FindSpecialFn findSpecial = CJsonString::findSpecialScalar;
+    Tier findSpecialTier = Scalar;
+    if (tier >= Avx2) {
+        findSpecial = CJsonString::findSpecialAvx2;
+        findSpecialTier = Avx2;
+    } else if (tier >= Sse2) {
+        findSpecial = CJsonString::findSpecialSse2;
+        findSpecialTier = Sse2;
+    }
+    findSpecial_.store(findSpecial);
+    findSpecialTier_.store(findSpecialTier);
+    active_.store(tier);
+}
+
+bool CKernelDispatch::force(const char* tierName) {
+    if (!tierName || !*tierName) {
+        select(detected_);
+        forced_.store(false);
+        return true;
+    }
+    for (int tier = Scalar; tier < TierCount; ++tier) {
+        if (strcmp(tierName, kTierNames[tier]) == 0) {
+            if (tier > detected_) {
+                return false;
+            }
+            select((Tier)tier);
+            forced_.store(true);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string CKernelDispatch::info() const {
+    static const struct {
+        Feature feature;
+        const char* name;
+    } kFeatureNames[] = {{FeatureSse2, "sse2"},       {FeatureSse41, "sse4.1"},       {FeatureSse42, "sse4.2"},
+                         {FeatureAvx, "avx"},         {FeatureAvx2, "avx2"},          {FeatureAvx512F, "avx512f"},
+                         {FeatureAvx512Bw, "avx512bw"}, {FeatureAesNi, "aes-ni"},     {FeatureShaNi, "sha-ni"}};
+
+    nlohmann::json cpu = nlohmann::json::array();
+    for (const auto& entry : kFeatureNames) {
+        if (features_ & entry.feature) cpu.push_back(entry.name);
+    }
+    nlohmann::json report = {{"cpu", cpu},
+                             {"detected", tierName(detected_)},
+                             {"active", tierName(active_.load())},
+                             {"forced", forced_.load()},
+                             {"kernels",
+                              {{"json-string", tierName(findSpecialTier_.load())},
+                               {"base64", "cryptoapi"},
+                               {"sha256", "cryptoapi"},
+                               {"hmac-sha256", "cryptoapi"},
+                               {"aes-cbc", "cryptoapi"}}}};
+    return report.dump();
+}
+
+const char* CKernelDispatch::tierName(Tier tier) {
+    return tier >= Scalar && tier < TierCount ? kTierNames[tier] : "unknown";
+}
@@ -0,0 +1,59 @@
+﻿#pragma once
+
+#include <atomic>
+#include <string>
+
+// Process-wide registry of the SIMD kernels this DLL carries, resolved once
+// from CPUID on first use (or Warmup). Each primitive runs the best kernel it
+// has at or below the active tier, which is the CPU's best unless forced
+// (SetKernelTier, or SANKEY_KERNEL_TIER when resolved) to A/B kernels or run
+// differential tests.
+// Base64, SHA-256, HMAC and AES go through CryptoAPI, whose provider picks
+// its own AES-NI / SHA-NI code; they are reported but not forcible.
+class CKernelDispatch {
+public:
+    enum Tier { Scalar, Sse2, Sse4, Avx2, Avx512, TierCount };
+
+    typedef const char* (*FindSpecialFn)(const char* p, const char* end);
+
+    static CKernelDispatch& instance();
+
+    FindSpecialFn findSpecial() const { return findSpecial_.load(std::memory_order_relaxed); }
+
+    Tier detected() const { return detected_; }
+    Tier active() const { return active_.load(); }
+
+    // Tier by name ("scalar", "sse2", "sse4", "avx2", "avx512"); nullptr or ""
+    // restores the detected tier. false for unknown names and tiers this CPU
+    // lacks, leaving the selection unchanged.
+    bool force(const char* tierName);
+
+    // JSON: CPU features, detected and active tier, kernel per primitive
+    std::string info() const;
+
+    static const char* tierName(Tier tier);
+
+private:
+    enum Feature {
+        FeatureSse2 = 1 << 0,
+        FeatureSse41 = 1 << 1,
+        FeatureSse42 = 1 << 2,
+        FeatureAvx = 1 << 3,
+        FeatureAvx2 = 1 << 4,
+        FeatureAvx512F = 1 << 5,
+        FeatureAvx512Bw = 1 << 6,
+        FeatureAesNi = 1 << 7,
+        FeatureShaNi = 1 << 8
+    };
+
+    unsigned features_;
+    Tier detected_;
+    std::atomic<Tier> active_;
+    std::atomic<bool> forced_;
+    std::atomic<FindSpecialFn> findSpecial_;
+    std::atomic<Tier> findSpecialTier_;
+
+    CKernelDispatch();
+    static unsigned cpuFeatures();
+    void select(Tier tier);
+};
@@ -0,0 +1,103 @@
+﻿#include "CKeyContextCache.h"
+#include <algorithm>
+
+CKeyContextCache::CKeyContextCache() : hProv_(0), capacity_(kDefaultCapacity), hits_(0), misses_(0), evictions_(0) {
+    if (!CryptAcquireContext(&hProv_, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT)) {
+        hProv_ = 0;
+    }
+}
+
+CKeyContextCache::~CKeyContextCache() {
+    if (hProv_) CryptReleaseContext(hProv_, 0);
+}
+
+CKeyContextCache& CKeyContextCache::instance() {
+    static CKeyContextCache cache;
+    return cache;
+}
+
+bool CKeyContextCache::keyDigest(const char* masterKeyB64, std::string& digest) const {
+    unsigned char key[32];
+    DWORD len = 0;
+    if (!hProv_ || !CryptStringToBinaryA(masterKeyB64, 0, CRYPT_STRING_BASE64, NULL, &len, NULL, NULL) || len != 32 ||
+        !CryptStringToBinaryA(masterKeyB64, 0, CRYPT_STRING_BASE64, key, &len, NULL, NULL)) {
+        return false;
+    }
+
+    // Same digest CSankeyKeyContext::digest() reports
+    HCRYPTHASH hHash = 0;
+    bool ok = CryptCreateHash(hProv_, CALG_SHA_256, 0, 0, &hHash) != 0;
+    if (ok) {
+        unsigned char value[32];
+        DWORD valueLen = sizeof(value);
+        ok = CryptHashData(hHash, key, sizeof(key), 0) &&
+             CryptGetHashParam(hHash, HP_HASHVAL, value, &valueLen, 0) && valueLen == 32;
+        if (ok) {
+            digest.assign(reinterpret_cast<const char*>(value), sizeof(value));
+        }
+        CryptDestroyHash(hHash);
+    }
+    SecureZeroMemory(key, sizeof(key));
+    return ok;
+}
+
+std::shared_ptr<const CSankeyKeyContext> CKeyContextCache::acquire(const char* masterKeyB64) {
+    std::string digest;
+    if (!masterKeyB64 || !keyDigest(masterKeyB64, digest)) {
+        return nullptr;
+    }
+
+    // The digest is uniformly distributed, so its first byte picks the shard
+    Shard& shard = shards_[static_cast<unsigned char>(digest[0]) % kShards];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(digest);
+        if (it != shard.index.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            hits_.fetch_add(1);
+            return it->second->keyCtx;
+        }
+    }
+
+    // Build outside the lock; two threads missing on the same key both
+    // build and the second insert simply reuses the first
+    misses_.fetch_add(1);
+    std::shared_ptr<const CSankeyKeyContext> keyCtx(CSankeyKeyContext::create(masterKeyB64));
+    if (!keyCtx) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(digest);
+    if (it != shard.index.end()) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return it->second->keyCtx;
+    }
+    shard.lru.push_front(Entry{digest, keyCtx});
+    shard.index.emplace(digest, shard.lru.begin());
+    trim(shard, std::max<size_t>(1, capacity_.load() / kShards));
+    return keyCtx;
+}
+
+void CKeyContextCache::trim(Shard& shard, size_t limit) {
+    // Walk from the cold end; entries someone still holds stay, so the
+    // shard may run over its limit while a batch has many keys pinned
+    for (auto it = shard.lru.end(); shard.lru.size() > limit && it != shard.lru.begin();) {
+        --it;
+        if (it->keyCtx.use_count() > 1) {
+            continue;
+        }
+        shard.index.erase(it->digest);
+        it = shard.lru.erase(it);
+        evictions_.fetch_add(1);
+    }
+}
+
+void CKeyContextCache::setCapacity(size_t capacity) {
+    capacity_.store(capacity);
+    size_t limit = std::max<size_t>(1, capacity / kShards);
+    for (Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        trim(shard, limit);
+    }
+}
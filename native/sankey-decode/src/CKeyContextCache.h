@@ -0,0 +1,61 @@
+﻿#pragma once
+
+#include "CSankeyKeyContext.h"
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Process-wide cache of key contexts by key digest, for servers that verify
+// licenses of many products with Verify(masterKeyB64, ...). Building a
+// context (provider, key import) costs far more than the verify itself.
+//
+// The map is split into shards, each with its own mutex and LRU list, so
+// lookups for different keys rarely contend. Callers hold a shared_ptr for
+// as long as they use a context; eviction skips entries that are pinned
+// that way, and the context zeroizes its key when the last holder lets go.
+class CKeyContextCache {
+private:
+    static const size_t kShards = 16;
+
+    struct Entry {
+        std::string digest;
+        std::shared_ptr<const CSankeyKeyContext> keyCtx;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> lru; // Most recently used first
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    };
+
+    Shard shards_[kShards];
+    HCRYPTPROV hProv_; // Only for digesting lookup keys
+    std::atomic<size_t> capacity_;
+    std::atomic<long long> hits_;
+    std::atomic<long long> misses_;
+    std::atomic<long long> evictions_;
+
+    CKeyContextCache();
+    ~CKeyContextCache();
+    bool keyDigest(const char* masterKeyB64, std::string& digest) const;
+    void trim(Shard& shard, size_t limit);
+
+public:
+    static const size_t kDefaultCapacity = 1024;
+
+    static CKeyContextCache& instance();
+
+    // nullptr if the key is malformed or its context cannot be built
+    std::shared_ptr<const CSankeyKeyContext> acquire(const char* masterKeyB64);
+
+    // Total entries across all shards (at least one per shard). Shrinking
+    // evicts unpinned entries right away.
+    void setCapacity(size_t capacity);
+
+    long long hits() const { return hits_.load(); }
+    long long misses() const { return misses_.load(); }
+    long long evictions() const { return evictions_.load(); }
+};
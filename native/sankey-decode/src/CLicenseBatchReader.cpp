@@ -0,0 +1,291 @@
+﻿#include "CLicenseBatchReader.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+const char kLicenseName[] = "license.txt";
+
+struct ReadResult {
+    size_t file;
+    size_t buffer;
+    size_t size;
+    bool ok;
+};
+
+// One overlapped read; the slot index is the completion key
+struct IoSlot {
+    OVERLAPPED overlapped;
+    HANDLE hFile;
+    size_t file;
+    size_t size;
+    bool pending; // Read queued and its completion not yet dequeued
+};
+
+} // namespace
+
+bool CLicenseBatchReader::scan(const char* dir, std::vector<File>& files) {
+    files.clear();
+    if (!dir) {
+        return false;
+    }
+
+    std::string root(dir);
+    if (!root.empty() && root.back() != '\\' && root.back() != '/') {
+        root.push_back('\\');
+    }
+    WIN32_FIND_DATAA found;
+    HANDLE hFind = FindFirstFileA((root + "*").c_str(), &found);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    do {
+        std::string name = found.cFileName;
+        if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || name == "." || name == "..") {
+            continue;
+        }
+        File file;
+        file.accountId = name;
+        file.path = root + name + "\\" + kLicenseName;
+        files.push_back(file);
+    } while (FindNextFileA(hFind, &found));
+    FindClose(hFind);
+
+    std::sort(files.begin(), files.end(), [](const File& a, const File& b) { return a.accountId < b.accountId; });
+    return true;
+}
+
+const char* CLicenseBatchReader::modeName(Mode mode) {
+    switch (mode) {
+    case Plain: return "plain";
+    case Pool: return "pool";
+    case Iocp: return "iocp";
+    }
+    return "?";
+}
+
+bool CLicenseBatchReader::parseMode(const char* name, Mode& mode) {
+    for (Mode m : {Plain, Pool, Iocp}) {
+        if (name && strcmp(name, modeName(m)) == 0) {
+            mode = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+CLicenseBatchReader::CLicenseBatchReader(Mode mode, size_t window, unsigned threads)
+    : mode_(mode), window_(std::max<size_t>(1, window)), threads_(std::max(1u, threads)) {
+    buffers_.resize(mode_ == Plain ? 1 : window_);
+    for (std::vector<unsigned char>& buffer : buffers_) {
+        buffer.resize(kBufferSize);
+    }
+}
+
+bool CLicenseBatchReader::readWhole(const std::string& path, std::vector<unsigned char>& buffer, size_t& size) {
+    size = 0;
+    HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    bool ok = GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart >= 0 && fileSize.QuadPart <= MAXDWORD;
+    if (ok && (size_t)fileSize.QuadPart > buffer.size()) {
+        buffer.resize((size_t)fileSize.QuadPart);
+    }
+    DWORD read = 0;
+    ok = ok && (fileSize.QuadPart == 0 ||
+                (ReadFile(hFile, buffer.data(), (DWORD)fileSize.QuadPart, &read, NULL) && read == fileSize.QuadPart));
+    CloseHandle(hFile);
+    size = ok ? (size_t)read : 0;
+    return ok;
+}
+
+bool CLicenseBatchReader::run(const std::vector<File>& files, const Sink& sink) {
+    switch (mode_) {
+    case Plain:
+        runPlain(files, sink);
+        return true;
+    case Pool:
+        runPool(files, sink);
+        return true;
+    case Iocp:
+        return runIocp(files, sink);
+    }
+    return false;
+}
+
+void CLicenseBatchReader::runPlain(const std::vector<File>& files, const Sink& sink) {
+    std::vector<unsigned char>& buffer = buffers_[0];
+    for (const File& file : files) {
+        size_t size = 0;
+        bool ok = readWhole(file.path, buffer, size);
+        sink(file, buffer.data(), size, ok);
+    }
+}
+
+void CLicenseBatchReader::runPool(const std::vector<File>& files, const Sink& sink) {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<size_t> freeBuffers;
+    std::deque<ReadResult> ready;
+    for (size_t b = 0; b < buffers_.size(); ++b) {
+        freeBuffers.push_back(b);
+    }
+    std::atomic<size_t> next(0);
+
+    // A worker holds a buffer from before its open until the sink is done
+    // with it, so at most window files are between open and consumed
+    auto worker = [&]() {
+        for (;;) {
+            size_t b;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return !freeBuffers.empty(); });
+                b = freeBuffers.front();
+                freeBuffers.pop_front();
+            }
+            size_t f = next.fetch_add(1);
+            if (f >= files.size()) {
+                std::lock_guard<std::mutex> lock(mutex);
+                freeBuffers.push_back(b);
+                changed.notify_all();
+                return;
+            }
+            ReadResult result;
+            result.file = f;
+            result.buffer = b;
+            result.ok = readWhole(files[f].path, buffers_[b], result.size);
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.push_back(result);
+            changed.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    unsigned count = (unsigned)std::min<size_t>(threads_, std::max<size_t>(1, files.size()));
+    for (unsigned t = 0; t < count; ++t) {
+        workers.emplace_back(worker);
+    }
+
+    for (size_t consumed = 0; consumed < files.size(); ++consumed) {
+        ReadResult result;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return !ready.empty(); });
+            result = ready.front();
+            ready.pop_front();
+        }
+        sink(files[result.file], buffers_[result.buffer].data(), result.size, result.ok);
+        std::lock_guard<std::mutex> lock(mutex);
+        freeBuffers.push_back(result.buffer);
+        changed.notify_all();
+    }
+
+    for (std::thread& t : workers) {
+        t.join();
+    }
+}
+
+bool CLicenseBatchReader::runIocp(const std::vector<File>& files, const Sink& sink) {
+    HANDLE hPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (!hPort) {
+        return false;
+    }
+
+    std::vector<IoSlot> slots(window_, IoSlot());
+    size_t next = 0;
+    size_t inFlight = 0;
+
+    // Opens files into slot s until one read is outstanding or none are left;
+    // files that fail before their read is queued go to the sink directly
+    auto submit = [&](size_t s) {
+        while (next < files.size()) {
+            IoSlot& slot = slots[s];
+            slot.file = next++;
+            const File& file = files[slot.file];
+            slot.hFile = CreateFileA(file.path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                     NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+            if (slot.hFile == INVALID_HANDLE_VALUE) {
+                sink(file, nullptr, 0, false);
+                continue;
+            }
+
+            LARGE_INTEGER fileSize;
+            if (!GetFileSizeEx(slot.hFile, &fileSize) || fileSize.QuadPart < 0 || fileSize.QuadPart > MAXDWORD ||
+                !CreateIoCompletionPort(slot.hFile, hPort, (ULONG_PTR)s, 0)) {
+                CloseHandle(slot.hFile);
+                sink(file, nullptr, 0, false);
+                continue;
+            }
+            slot.size = (size_t)fileSize.QuadPart;
+            if (slot.size == 0) {
+                CloseHandle(slot.hFile);
+                sink(file, buffers_[s].data(), 0, true);
+                continue;
+            }
+            if (slot.size > buffers_[s].size()) {
+                buffers_[s].resize(slot.size);
+            }
+
+            memset(&slot.overlapped, 0, sizeof(slot.overlapped));
+            if (!ReadFile(slot.hFile, buffers_[s].data(), (DWORD)slot.size, NULL, &slot.overlapped) &&
+                GetLastError() != ERROR_IO_PENDING) {
+                CloseHandle(slot.hFile);
+                sink(file, nullptr, 0, false);
+                continue;
+            }
+            // Synchronous success still queues a completion packet
+            slot.pending = true;
+            ++inFlight;
+            return;
+        }
+    };
+
+    for (size_t s = 0; s < slots.size() && next < files.size(); ++s) {
+        submit(s);
+    }
+    while (inFlight > 0) {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = nullptr;
+        BOOL ok = GetQueuedCompletionStatus(hPort, &bytes, &key, &overlapped, INFINITE);
+        if (!overlapped) {
+            // The port itself failed, so no more completions will be dequeued.
+            // Cancel and wait out each outstanding read on its own handle
+            // before its buffer goes away, then fail everything unread
+            for (size_t s = 0; s < slots.size(); ++s) {
+                IoSlot& slot = slots[s];
+                if (!slot.pending) {
+                    continue;
+                }
+                CancelIoEx(slot.hFile, &slot.overlapped);
+                GetOverlappedResult(slot.hFile, &slot.overlapped, &bytes, TRUE);
+                CloseHandle(slot.hFile);
+                slot.pending = false;
+                sink(files[slot.file], nullptr, 0, false);
+            }
+            for (; next < files.size(); ++next) {
+                sink(files[next], nullptr, 0, false);
+            }
+            CloseHandle(hPort);
+            return false;
+        }
+        --inFlight;
+        IoSlot& slot = slots[(size_t)key];
+        slot.pending = false;
+        CloseHandle(slot.hFile);
+        sink(files[slot.file], buffers_[(size_t)key].data(), bytes, ok && bytes == slot.size);
+        submit((size_t)key);
+    }
+
+    CloseHandle(hPort);
+    return true;
+}
@@ -0,0 +1,60 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Reads many small license files (an archive laid out one directory per
+// customer) for the bulk verifier, with a bounded number of reads in flight
+// and a fixed set of reused buffers instead of one allocation per file.
+//
+//   Iocp   overlapped reads on one I/O completion port, up to window at a
+//          time; the window is refilled as completions land. Opens stay
+//          synchronous, as Windows has no asynchronous CreateFile.
+//   Pool   worker threads open, read and close files themselves and hand
+//          the buffers back; the fallback when IOCP is unavailable, and the
+//          better choice when opens rather than reads dominate.
+//   Plain  one file at a time on the calling thread; the baseline.
+class CLicenseBatchReader {
+public:
+    enum Mode { Plain, Pool, Iocp };
+
+    struct File {
+        std::string accountId;
+        std::string path;
+    };
+
+    // Runs on the thread that called run(), one file at a time, in completion
+    // order. data is a reader buffer valid only for the call; ok is false when
+    // the file could not be opened or read.
+    typedef std::function<void(const File& file, const unsigned char* data, size_t size, bool ok)> Sink;
+
+    // dir\<accountId>\license.txt for every subdirectory of dir, by account
+    static bool scan(const char* dir, std::vector<File>& files);
+
+    static const char* modeName(Mode mode);
+    static bool parseMode(const char* name, Mode& mode);
+
+    CLicenseBatchReader(Mode mode, size_t window, unsigned threads);
+
+    // Every file reaches sink exactly once. False if the mode could not start
+    // (no completion port), in which case sink was not called, or if the
+    // completion port failed mid-run, in which case the files not yet read
+    // reached sink with ok false
+    bool run(const std::vector<File>& files, const Sink& sink);
+
+private:
+    static const size_t kBufferSize = 64 * 1024; // Grown per buffer for the odd larger license
+
+    Mode mode_;
+    size_t window_;
+    unsigned threads_;
+    std::vector<std::vector<unsigned char>> buffers_;
+
+    static bool readWhole(const std::string& path, std::vector<unsigned char>& buffer, size_t& size);
+    void runPlain(const std::vector<File>& files, const Sink& sink);
+    void runPool(const std::vector<File>& files, const Sink& sink);
+    bool runIocp(const std::vector<File>& files, const Sink& sink);
+};
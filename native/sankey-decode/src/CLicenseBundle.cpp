@@ -0,0 +1,200 @@
+﻿#include "CLicenseBundle.h"
+#include <algorithm>
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+const char kMagic[4] = {'S', 'K', 'B', '1'};
+const size_t kHeaderSize = 8;
+
+struct IndexEntry {
+    uint64_t hash;
+    uint32_t offset;
+    uint32_t length;
+};
+
+IndexEntry readEntry(const unsigned char* index, uint32_t slot) {
+    IndexEntry entry;
+    const unsigned char* p = index + (size_t)slot * CLicenseBundle::kIndexEntrySize;
+    memcpy(&entry.hash, p, 8);
+    memcpy(&entry.offset, p + 8, 4);
+    memcpy(&entry.length, p + 12, 4);
+    return entry;
+}
+
+unsigned trailingZeros(uint32_t v) {
+#ifdef _MSC_VER
+    unsigned long bit = 0;
+    _BitScanForward(&bit, v);
+    return bit;
+#else
+    return (unsigned)__builtin_ctz(v);
+#endif
+}
+
+// In-order walk of the implicit tree assigns sorted[i] to Eytzinger slots
+void fillEytzinger(const std::vector<IndexEntry>& sorted, size_t& next, uint32_t slot, std::vector<IndexEntry>& tree) {
+    if (slot >= tree.size()) {
+        return;
+    }
+    fillEytzinger(sorted, next, 2 * slot, tree);
+    tree[slot] = sorted[next++];
+    fillEytzinger(sorted, next, 2 * slot + 1, tree);
+}
+
+} // namespace
+
+uint64_t CLicenseBundle::accountHash(const char* accountId, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char)accountId[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool CLicenseBundle::find(const unsigned char* data, size_t size, const char* accountId, const char*& license, size_t& licenseLen) {
+    if (!data || size < kHeaderSize || memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+        return false;
+    }
+    uint32_t count = 0;
+    memcpy(&count, data + 4, 4);
+    if (count == 0 || count >= 0x7FFFFFFF || (size - kHeaderSize) / kIndexEntrySize < (size_t)count + 1) {
+        return false;
+    }
+
+    size_t accountLen = strlen(accountId);
+    uint64_t target = accountHash(accountId, accountLen);
+    const unsigned char* index = data + kHeaderSize;
+
+    // Descend: right on "less than", left otherwise; the comparison feeds
+    // the next index instead of a branch
+    uint32_t k = 1;
+    while (k <= count) {
+        k = 2 * k + (readEntry(index, k).hash < target);
+    }
+    // Undo the trailing right turns plus the final left turn; 0 means past the end
+    k >>= trailingZeros(~k) + 1;
+    if (k == 0) {
+        return false;
+    }
+
+    IndexEntry entry = readEntry(index, k);
+    if (entry.hash != target || (size_t)entry.offset + entry.length > size || entry.length < 2) {
+        return false;
+    }
+    const unsigned char* record = data + entry.offset;
+    uint16_t idLen = 0;
+    memcpy(&idLen, record, 2);
+    if ((size_t)idLen + 2 > entry.length || idLen != accountLen || memcmp(record + 2, accountId, idLen) != 0) {
+        return false;
+    }
+
+    license = reinterpret_cast<const char*>(record + 2 + idLen);
+    licenseLen = entry.length - 2 - idLen;
+    return true;
+}
+
+bool CLicenseBundle::entries(const unsigned char* data, size_t size, std::vector<Entry>& out) {
+    out.clear();
+    if (!data || size < kHeaderSize || memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+        return false;
+    }
+    uint32_t count = 0;
+    memcpy(&count, data + 4, 4);
+    if (count == 0 || count >= 0x7FFFFFFF || (size - kHeaderSize) / kIndexEntrySize < (size_t)count + 1) {
+        return false;
+    }
+
+    const unsigned char* index = data + kHeaderSize;
+    out.reserve(count);
+    for (uint32_t k = 1; k <= count; ++k) {
+        IndexEntry entry = readEntry(index, k);
+        if ((size_t)entry.offset + entry.length > size || entry.length < 2) {
+            return false;
+        }
+        const unsigned char* record = data + entry.offset;
+        uint16_t idLen = 0;
+        memcpy(&idLen, record, 2);
+        if ((size_t)idLen + 2 > entry.length) {
+            return false;
+        }
+        Entry e;
+        e.accountId = reinterpret_cast<const char*>(record + 2);
+        e.accountIdLen = idLen;
+        e.license = e.accountId + idLen;
+        e.licenseLen = entry.length - 2 - idLen;
+        out.push_back(e);
+    }
+    return true;
+}
+
+bool CLicenseBundle::build(const std::vector<std::pair<std::string, std::string>>& entries, std::vector<unsigned char>& out,
+                           std::string& error) {
+    if (entries.empty()) {
+        error = "no licenses";
+        return false;
+    }
+
+    std::vector<size_t> order(entries.size());
+    std::vector<IndexEntry> sorted(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const std::string& accountId = entries[i].first;
+        if (accountId.empty() || accountId.size() > 0xFFFF || entries[i].second.empty()) {
+            error = "invalid entry for account '" + accountId + "'";
+            return false;
+        }
+        order[i] = i;
+        sorted[i].hash = accountHash(accountId.data(), accountId.size());
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sorted[a].hash < sorted[b].hash; });
+
+    size_t count = entries.size();
+    size_t offset = kHeaderSize + (count + 1) * kIndexEntrySize;
+    std::vector<IndexEntry> byHash(count);
+    for (size_t i = 0; i < count; ++i) {
+        const std::pair<std::string, std::string>& entry = entries[order[i]];
+        if (i > 0 && sorted[order[i]].hash == byHash[i - 1].hash) {
+            error = entry.first == entries[order[i - 1]].first ? "duplicate account '" + entry.first + "'"
+                                                               : "account hash collision for '" + entry.first + "'";
+            return false;
+        }
+        byHash[i].hash = sorted[order[i]].hash;
+        byHash[i].offset = (uint32_t)offset;
+        byHash[i].length = (uint32_t)(2 + entry.first.size() + entry.second.size());
+        offset += byHash[i].length;
+        if (offset > 0xFFFFFFFFu) {
+            error = "bundle exceeds 4 GB";
+            return false;
+        }
+    }
+
+    std::vector<IndexEntry> tree(count + 1);
+    memset(&tree[0], 0, sizeof(IndexEntry));
+    size_t next = 0;
+    fillEytzinger(byHash, next, 1, tree);
+
+    out.clear();
+    out.reserve(offset);
+    out.insert(out.end(), kMagic, kMagic + sizeof(kMagic));
+    uint32_t count32 = (uint32_t)count;
+    out.insert(out.end(), reinterpret_cast<const unsigned char*>(&count32), reinterpret_cast<const unsigned char*>(&count32) + 4);
+    for (const IndexEntry& entry : tree) {
+        unsigned char raw[kIndexEntrySize];
+        memcpy(raw, &entry.hash, 8);
+        memcpy(raw + 8, &entry.offset, 4);
+        memcpy(raw + 12, &entry.length, 4);
+        out.insert(out.end(), raw, raw + sizeof(raw));
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const std::pair<std::string, std::string>& entry = entries[order[i]];
+        uint16_t idLen = (uint16_t)entry.first.size();
+        out.insert(out.end(), reinterpret_cast<const unsigned char*>(&idLen), reinterpret_cast<const unsigned char*>(&idLen) + 2);
+        out.insert(out.end(), entry.first.begin(), entry.first.end());
+        out.insert(out.end(), entry.second.begin(), entry.second.end());
+    }
+    return true;
+}
@@ -0,0 +1,45 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Many licenses in one file, looked up by accountId. Layout (little-endian):
+//
+//   "SKB1" | count u32 | index[count + 1] | records
+//   index entry: accountHash u64 | recordOffset u32 | recordLen u32
+//   record:      accountIdLen u16 | accountId | license text
+//
+// The index is sorted by FNV-1a 64 of the accountId and stored in Eytzinger
+// (BFS) order from slot 1, so a lookup walks it top-down with no
+// data-dependent branches and touches one cache line per level. Only the
+// index pages and the one record are read from the mapping.
+class CLicenseBundle {
+public:
+    static const size_t kIndexEntrySize = 16;
+
+    // Views into a mapped bundle
+    struct Entry {
+        const char* accountId;
+        size_t accountIdLen;
+        const char* license;
+        size_t licenseLen;
+    };
+
+    static uint64_t accountHash(const char* accountId, size_t len);
+
+    // The license text for accountId inside a mapped bundle; false if the
+    // file is not a bundle or has no entry for the account.
+    static bool find(const unsigned char* data, size_t size, const char* accountId, const char*& license, size_t& licenseLen);
+
+    // Every entry of a mapped bundle, in index order (bulk tools); false if
+    // the file is not a bundle or an entry lies outside it
+    static bool entries(const unsigned char* data, size_t size, std::vector<Entry>& out);
+
+    // Serializes (accountId, license) pairs. Fails on duplicate accounts or
+    // (vanishingly unlikely) hash collisions, with a message in error.
+    static bool build(const std::vector<std::pair<std::string, std::string>>& entries, std::vector<unsigned char>& out,
+                      std::string& error);
+};
@@ -0,0 +1,100 @@
+﻿#include "CLicenseFileView.h"
+
+namespace {
+
+bool isLicenseSpace(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\0';
+}
+
+} // namespace
+
+CLicenseFileView::CLicenseFileView() : hFile_(INVALID_HANDLE_VALUE), hMapping_(NULL), data_(nullptr), size_(0) {
+}
+
+CLicenseFileView::~CLicenseFileView() {
+    close();
+}
+
+void CLicenseFileView::close() {
+    if (data_) UnmapViewOfFile(data_);
+    if (hMapping_) CloseHandle(hMapping_);
+    if (hFile_ != INVALID_HANDLE_VALUE) CloseHandle(hFile_);
+    data_ = nullptr;
+    hMapping_ = NULL;
+    hFile_ = INVALID_HANDLE_VALUE;
+    size_ = 0;
+}
+
+bool CLicenseFileView::open(const char* path) {
+    close();
+    if (!path) {
+        return false;
+    }
+
+    // Share everything so a renewal can replace the file while it is mapped
+    hFile_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                         NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile_ == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile_, &fileSize) || fileSize.QuadPart <= 0 ||
+        (unsigned long long)fileSize.QuadPart > (size_t)-1) {
+        close();
+        return false;
+    }
+
+    hMapping_ = CreateFileMappingA(hFile_, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!hMapping_) {
+        close();
+        return false;
+    }
+
+    data_ = static_cast<const unsigned char*>(MapViewOfFile(hMapping_, FILE_MAP_READ, 0, 0, 0));
+    if (!data_) {
+        close();
+        return false;
+    }
+
+    size_ = (size_t)fileSize.QuadPart;
+    return true;
+}
+
+bool CLicenseFileView::text(const char*& out, size_t& outLen, std::vector<char>& narrowed) const {
+    return text(data_, size_, out, outLen, narrowed);
+}
+
+bool CLicenseFileView::text(const unsigned char* data, size_t size, const char*& out, size_t& outLen, std::vector<char>& narrowed) {
+    const unsigned char* begin = data;
+    const unsigned char* end = data + size;
+    if (!begin) {
+        return false;
+    }
+
+    if (size >= 2 && begin[0] == 0xFF && begin[1] == 0xFE) {
+        // UTF-16LE: any non-ASCII code unit cannot be part of a license
+        narrowed.clear();
+        narrowed.reserve((size - 2) / 2);
+        for (const unsigned char* p = begin + 2; p + 1 < end; p += 2) {
+            if (p[1] != 0 || p[0] >= 0x80) {
+                return false;
+            }
+            narrowed.push_back(static_cast<char>(p[0]));
+        }
+        begin = reinterpret_cast<const unsigned char*>(narrowed.data());
+        end = begin + narrowed.size();
+    } else if (size >= 3 && begin[0] == 0xEF && begin[1] == 0xBB && begin[2] == 0xBF) {
+        begin += 3;
+    }
+
+    while (begin < end && isLicenseSpace(*begin)) ++begin;
+    while (end > begin && isLicenseSpace(end[-1])) --end;
+    if (begin == end) {
+        return false;
+    }
+
+    out = reinterpret_cast<const char*>(begin);
+    outLen = static_cast<size_t>(end - begin);
+    return true;
+}
@@ -0,0 +1,37 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <vector>
+#include <cstddef>
+
+// Read-only memory mapping of a license file. The Base64 text is decoded
+// straight from the mapping, so there is no size limit and no copy of the
+// file contents.
+class CLicenseFileView {
+private:
+    HANDLE hFile_;
+    HANDLE hMapping_;
+    const unsigned char* data_;
+    size_t size_;
+
+    void close();
+
+public:
+    CLicenseFileView();
+    ~CLicenseFileView();
+
+    CLicenseFileView(const CLicenseFileView&) = delete;
+    CLicenseFileView& operator=(const CLicenseFileView&) = delete;
+
+    bool open(const char* path);
+
+    const unsigned char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    // License text with BOM and surrounding whitespace removed. UTF-8/ANSI
+    // files point into the mapping; UTF-16LE files (MQL FILE_UNICODE) are
+    // narrowed into 'narrowed', since Base64 is ASCII either way.
+    bool text(const char*& out, size_t& outLen, std::vector<char>& narrowed) const;
+    // Same, for license bytes read by other means (bulk readers)
+    static bool text(const unsigned char* data, size_t size, const char*& out, size_t& outLen, std::vector<char>& narrowed);
+};
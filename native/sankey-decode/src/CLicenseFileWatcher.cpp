@@ -0,0 +1,136 @@
+﻿#include "CLicenseFileWatcher.h"
+#include <vector>
+
+namespace {
+
+// Editors and copy tools often write a file in several steps; wait this long
+// after the last matching notification before reporting a change.
+const DWORD kSettleMillis = 200;
+
+} // namespace
+
+CLicenseFileWatcher::CLicenseFileWatcher() : hDir_(INVALID_HANDLE_VALUE), hStop_(NULL) {
+}
+
+CLicenseFileWatcher::~CLicenseFileWatcher() {
+    stop();
+}
+
+bool CLicenseFileWatcher::start(const std::string& path, std::function<void()> onChange) {
+    stop();
+
+    size_t sep = path.find_last_of("\\/");
+    std::string dir = sep == std::string::npos ? std::string(".") : path.substr(0, sep);
+    std::string name = sep == std::string::npos ? path : path.substr(sep + 1);
+    if (name.empty()) {
+        return false;
+    }
+
+    int wideLen = MultiByteToWideChar(CP_ACP, 0, name.c_str(), (int)name.size(), NULL, 0);
+    if (wideLen <= 0) {
+        return false;
+    }
+    fileName_.assign(wideLen, L'\0');
+    MultiByteToWideChar(CP_ACP, 0, name.c_str(), (int)name.size(), &fileName_[0], wideLen);
+
+    hDir_ = CreateFileA(dir.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    if (hDir_ == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    hStop_ = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (!hStop_) {
+        stop();
+        return false;
+    }
+
+    onChange_ = std::move(onChange);
+    thread_ = std::thread(&CLicenseFileWatcher::run, this);
+    return true;
+}
+
+void CLicenseFileWatcher::stop() {
+    if (thread_.joinable()) {
+        SetEvent(hStop_);
+        thread_.join();
+    }
+    if (hStop_) CloseHandle(hStop_);
+    if (hDir_ != INVALID_HANDLE_VALUE) CloseHandle(hDir_);
+    hStop_ = NULL;
+    hDir_ = INVALID_HANDLE_VALUE;
+    onChange_ = nullptr;
+}
+
+bool CLicenseFileWatcher::matches(const FILE_NOTIFY_INFORMATION* info) const {
+    size_t len = info->FileNameLength / sizeof(WCHAR);
+    return len == fileName_.size() && _wcsnicmp(info->FileName, fileName_.c_str(), len) == 0;
+}
+
+void CLicenseFileWatcher::run() {
+    // DWORD-aligned as ReadDirectoryChangesW requires
+    std::vector<DWORD> buffer(16 * 1024 / sizeof(DWORD));
+    OVERLAPPED overlapped;
+    ZeroMemory(&overlapped, sizeof(overlapped));
+    overlapped.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (!overlapped.hEvent) {
+        return;
+    }
+
+    const DWORD filter = FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE;
+    bool pending = false;
+    bool reading = false;
+
+    for (;;) {
+        if (!reading) {
+            ResetEvent(overlapped.hEvent);
+            if (!ReadDirectoryChangesW(hDir_, buffer.data(), (DWORD)(buffer.size() * sizeof(DWORD)), FALSE,
+                                       filter, NULL, &overlapped, NULL)) {
+                break;
+            }
+            reading = true;
+        }
+
+        HANDLE handles[2] = { hStop_, overlapped.hEvent };
+        DWORD wait = WaitForMultipleObjects(2, handles, FALSE, pending ? kSettleMillis : INFINITE);
+        if (wait == WAIT_OBJECT_0) {
+            break;
+        }
+
+        if (wait == WAIT_TIMEOUT) {
+            pending = false;
+            onChange_();
+            continue;
+        }
+
+        DWORD bytes = 0;
+        reading = false;
+        if (!GetOverlappedResult(hDir_, &overlapped, &bytes, FALSE)) {
+            break;
+        }
+        if (bytes == 0) {
+            // Notification buffer overflowed; the file may have changed
+            pending = true;
+            continue;
+        }
+
+        const unsigned char* entry = reinterpret_cast<const unsigned char*>(buffer.data());
+        for (;;) {
+            const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(entry);
+            if (matches(info)) {
+                pending = true;
+            }
+            if (info->NextEntryOffset == 0) {
+                break;
+            }
+            entry += info->NextEntryOffset;
+        }
+    }
+
+    if (reading) {
+        CancelIoEx(hDir_, &overlapped);
+        DWORD bytes = 0;
+        GetOverlappedResult(hDir_, &overlapped, &bytes, TRUE);
+    }
+    CloseHandle(overlapped.hEvent);
+}
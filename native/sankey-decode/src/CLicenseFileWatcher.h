@@ -0,0 +1,31 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Watches one file through ReadDirectoryChangesW on its parent directory
+// and invokes a callback from a background thread once writes to it have
+// settled. The callback decides whether the content actually changed.
+class CLicenseFileWatcher {
+private:
+    HANDLE hDir_;
+    HANDLE hStop_;
+    std::wstring fileName_;
+    std::function<void()> onChange_;
+    std::thread thread_;
+
+    void run();
+    bool matches(const FILE_NOTIFY_INFORMATION* info) const;
+
+public:
+    CLicenseFileWatcher();
+    ~CLicenseFileWatcher();
+
+    CLicenseFileWatcher(const CLicenseFileWatcher&) = delete;
+    CLicenseFileWatcher& operator=(const CLicenseFileWatcher&) = delete;
+
+    bool start(const std::string& path, std::function<void()> onChange);
+    void stop();
+};
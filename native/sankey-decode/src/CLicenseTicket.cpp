@@ -0,0 +1,112 @@
+﻿#include "CLicenseTicket.h"
+#include "CSankeyKeyContext.h"
+#include "CLicenseFileView.h"
+#include <string>
+#include <vector>
+#include <cstring>
+
+namespace {
+
+const char kMagic[4] = { 'S', 'K', 'T', '1' };
+const size_t kHeaderSize = 4 + 32 + 32 + 8 + 4;
+const size_t kMacSize = 32;
+
+bool ticketMac(const CSankeyKeyContext& keyCtx, const unsigned char* data, size_t len, unsigned char mac[32]) {
+    HCRYPTHASH hHash = 0;
+    if (!keyCtx.createLocalHmac(hHash)) {
+        return false;
+    }
+    DWORD macLen = 32;
+    bool ok = CryptHashData(hHash, data, (DWORD)len, 0) &&
+              CryptGetHashParam(hHash, HP_HASHVAL, mac, &macLen, 0) && macLen == 32;
+    CryptDestroyHash(hHash);
+    return ok;
+}
+
+} // namespace
+
+bool CLicenseTicket::write(const char* path, const CSankeyKeyContext& keyCtx, const unsigned char licenseDigest[32],
+                           const char* accountId, const nlohmann::json& payload, long long expiry) {
+    if (!path || !accountId) {
+        return false;
+    }
+
+    unsigned char accountDigest[32];
+    if (!keyCtx.sha256(accountId, strlen(accountId), accountDigest)) {
+        return false;
+    }
+
+    std::vector<std::uint8_t> packed = nlohmann::json::to_msgpack(payload);
+    uint32_t payloadLen = (uint32_t)packed.size();
+
+    std::vector<unsigned char> ticket(kHeaderSize + packed.size() + kMacSize);
+    unsigned char* p = ticket.data();
+    memcpy(p, kMagic, 4);               p += 4;
+    memcpy(p, licenseDigest, 32);       p += 32;
+    memcpy(p, accountDigest, 32);       p += 32;
+    memcpy(p, &expiry, 8);              p += 8;
+    memcpy(p, &payloadLen, 4);          p += 4;
+    memcpy(p, packed.data(), packed.size());
+    p += packed.size();
+    if (!ticketMac(keyCtx, ticket.data(), (size_t)(p - ticket.data()), p)) {
+        return false;
+    }
+
+    // Write beside the target and rename, so a reader never maps a half-written ticket
+    std::string tmpPath = std::string(path) + ".tmp";
+    HANDLE hFile = CreateFileA(tmpPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD written = 0;
+    bool ok = WriteFile(hFile, ticket.data(), (DWORD)ticket.size(), &written, NULL) && written == ticket.size();
+    CloseHandle(hFile);
+
+    if (!ok || !MoveFileExA(tmpPath.c_str(), path, MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileA(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool CLicenseTicket::read(const char* path, const CSankeyKeyContext& keyCtx, const unsigned char licenseDigest[32],
+                          const char* accountId, std::shared_ptr<const nlohmann::json>& payload, long long& expiry) {
+    if (!path || !accountId) {
+        return false;
+    }
+
+    CLicenseFileView view;
+    if (!view.open(path) || view.size() < kHeaderSize + kMacSize) {
+        return false;
+    }
+
+    const unsigned char* p = view.data();
+    uint32_t payloadLen = 0;
+    memcpy(&payloadLen, p + kHeaderSize - 4, 4);
+    if (memcmp(p, kMagic, 4) != 0 || view.size() != kHeaderSize + payloadLen + kMacSize) {
+        return false;
+    }
+    if (memcmp(p + 4, licenseDigest, 32) != 0) {
+        return false;
+    }
+
+    unsigned char accountDigest[32];
+    if (!keyCtx.sha256(accountId, strlen(accountId), accountDigest) || memcmp(p + 36, accountDigest, 32) != 0) {
+        return false;
+    }
+
+    unsigned char mac[32];
+    const unsigned char* storedMac = p + kHeaderSize + payloadLen;
+    if (!ticketMac(keyCtx, p, kHeaderSize + payloadLen, mac) || memcmp(mac, storedMac, 32) != 0) {
+        return false;
+    }
+
+    try {
+        const unsigned char* packed = p + kHeaderSize;
+        payload = std::make_shared<nlohmann::json>(nlohmann::json::from_msgpack(packed, packed + payloadLen));
+    } catch (const nlohmann::json::exception& e) {
+        return false;
+    }
+    memcpy(&expiry, p + 68, 8);
+    return true;
+}
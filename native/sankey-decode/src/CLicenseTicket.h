@@ -0,0 +1,27 @@
+﻿#pragma once
+
+#include <nlohmann/json.hpp>
+#include <memory>
+#include <cstdint>
+
+class CSankeyKeyContext;
+
+// Verification ticket: a small binary file written after a successful
+// verify so the next terminal start can skip Base64, AES and JSON work.
+//
+// Layout (little-endian):
+//   "SKT1" | licenseDigest[32] | accountDigest[32] | expiry i64 | payloadLen u32
+//   | payload (MessagePack) | mac[32]
+// licenseDigest is SHA-256 of the trimmed license text, accountDigest is
+// SHA-256 of the accountId, and mac is HMAC-SHA256 under the key context's
+// local MAC key over everything before it. Expiry is re-checked on every load.
+class CLicenseTicket {
+public:
+    static bool write(const char* path, const CSankeyKeyContext& keyCtx, const unsigned char licenseDigest[32],
+                      const char* accountId, const nlohmann::json& payload, long long expiry);
+
+    // False if the ticket is missing, malformed, for a different license or
+    // account, or fails the MAC; the caller then does a full verify.
+    static bool read(const char* path, const CSankeyKeyContext& keyCtx, const unsigned char licenseDigest[32],
+                     const char* accountId, std::shared_ptr<const nlohmann::json>& payload, long long& expiry);
+};
@@ -0,0 +1,114 @@
+﻿#include "CNumaBatchExecutor.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+unsigned popCount(ULONG_PTR mask) {
+    unsigned count = 0;
+    for (; mask; mask &= mask - 1) {
+        ++count;
+    }
+    return count;
+}
+
+} // namespace
+
+CNumaBatchExecutor::CNumaBatchExecutor(bool numa, unsigned threads) {
+    threads = std::max(1u, threads);
+
+    ULONG highest = 0;
+    if (numa && GetNumaHighestNodeNumber(&highest) && highest > 0) {
+        for (ULONG n = 0; n <= highest; ++n) {
+            Node node;
+            memset(&node, 0, sizeof(node));
+            node.number = (USHORT)n;
+            // Nodes without processors (memory-only) get no threads
+            if (GetNumaNodeProcessorMaskEx(node.number, &node.affinity) && node.affinity.Mask != 0) {
+                node.processors = popCount(node.affinity.Mask);
+                node.pinned = true;
+                nodes_.push_back(node);
+            }
+        }
+    }
+    if (nodes_.size() < 2) {
+        Node node;
+        memset(&node, 0, sizeof(node));
+        node.processors = std::max(1u, std::thread::hardware_concurrency());
+        nodes_.assign(1, node);
+    }
+
+    unsigned processors = 0;
+    for (const Node& node : nodes_) {
+        processors += node.processors;
+    }
+    for (const Node& node : nodes_) {
+        threads_.push_back(std::max(1u, (unsigned)((unsigned long long)threads * node.processors / processors)));
+    }
+}
+
+void* CNumaBatchExecutor::allocate(size_t node, size_t size) const {
+    return VirtualAllocExNuma(GetCurrentProcess(), NULL, std::max<size_t>(1, size), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE,
+                              nodes_[node].number);
+}
+
+void CNumaBatchExecutor::release(void* memory) {
+    if (memory) {
+        VirtualFree(memory, 0, MEM_RELEASE);
+    }
+}
+
+void CNumaBatchExecutor::pin(size_t node) const {
+    if (nodes_[node].pinned) {
+        SetThreadGroupAffinity(GetCurrentThread(), &nodes_[node].affinity, NULL);
+    }
+}
+
+void CNumaBatchExecutor::run(size_t count, const std::function<void(size_t node, size_t begin, size_t end)>& prepare,
+                             const std::function<void(size_t node, unsigned worker, size_t index)>& work) const {
+    unsigned total = 0;
+    for (unsigned t : threads_) {
+        total += t;
+    }
+
+    // One leader per node prepares its share, then works alongside the
+    // node's other threads; all of them pull indices from the node's cursor
+    std::vector<std::thread> leaders;
+    size_t begin = 0;
+    unsigned before = 0;
+    for (size_t n = 0; n < nodes_.size(); ++n) {
+        before += threads_[n];
+        size_t end = n + 1 == nodes_.size() ? count : (size_t)((unsigned long long)count * before / total);
+        if (end == begin) {
+            continue;
+        }
+        leaders.emplace_back([this, n, begin, end, &prepare, &work]() {
+            pin(n);
+            prepare(n, begin, end);
+
+            std::atomic<size_t> next(begin);
+            auto drain = [&](unsigned worker) {
+                for (size_t i = next.fetch_add(1); i < end; i = next.fetch_add(1)) {
+                    work(n, worker, i);
+                }
+            };
+            std::vector<std::thread> workers;
+            for (unsigned w = 1; w < threads_[n]; ++w) {
+                workers.emplace_back([this, n, w, &drain]() {
+                    pin(n);
+                    drain(w);
+                });
+            }
+            drain(0);
+            for (std::thread& t : workers) {
+                t.join();
+            }
+        });
+        begin = end;
+    }
+    for (std::thread& t : leaders) {
+        t.join();
+    }
+}
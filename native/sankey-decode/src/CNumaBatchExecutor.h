@@ -0,0 +1,48 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Spreads a batch of independent jobs over the NUMA nodes of a multi-socket
+// host. Each node gets a contiguous share of the batch and its own pinned
+// threads; whatever a node's threads read (key contexts, decoders, input
+// copies, result buffers) is built by prepare on a thread of that node, so
+// it is allocated and first touched there and verifies never cross the
+// interconnect. Nodes do not steal from each other: a share is sized by the
+// node's thread count and remote work would undo the locality.
+class CNumaBatchExecutor {
+public:
+    struct Node {
+        USHORT number;
+        GROUP_AFFINITY affinity;
+        unsigned processors;
+        bool pinned; // false on the single pseudo-node used without NUMA
+    };
+
+    // Threads are split over nodes by processor count, at least one each.
+    // numa false, or a host with one node, runs everything on one unpinned node.
+    CNumaBatchExecutor(bool numa, unsigned threads);
+
+    const std::vector<Node>& nodes() const { return nodes_; }
+    unsigned threadsOn(size_t node) const { return threads_[node]; }
+
+    // Committed memory preferring the node; free with release
+    void* allocate(size_t node, size_t size) const;
+    static void release(void* memory);
+
+    // For each node with a non-empty share [begin, end) of [0, count):
+    // prepare(node, begin, end) runs once on a thread pinned to the node,
+    // then that node's threads call work(node, worker, index) for every
+    // index in the share, worker being 0..threadsOn(node)-1. Returns when
+    // every node is done; merging per-node results is up to the caller.
+    void run(size_t count, const std::function<void(size_t node, size_t begin, size_t end)>& prepare,
+             const std::function<void(size_t node, unsigned worker, size_t index)>& work) const;
+
+private:
+    std::vector<Node> nodes_;
+    std::vector<unsigned> threads_;
+
+    void pin(size_t node) const;
+};
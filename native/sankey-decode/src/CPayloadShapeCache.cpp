@@ -0,0 +1,174 @@
+﻿#include "CPayloadShapeCache.h"
+#include "CJsonString.h"
+#include <cstring>
+
+CPayloadShapeCache::CPayloadShapeCache() : hits_(0), misses_(0) {
+}
+
+CPayloadShapeCache& CPayloadShapeCache::instance() {
+    static CPayloadShapeCache cache;
+    return cache;
+}
+
+nlohmann::json CPayloadShapeCache::parse(const char* text, size_t len) {
+    std::shared_ptr<const Shape> shape = std::atomic_load(&shape_);
+    if (shape) {
+        nlohmann::json payload;
+        if (match(*shape, text, len, payload)) {
+            hits_.fetch_add(1);
+            return payload;
+        }
+    }
+    misses_.fetch_add(1);
+
+    // The DOM sorts keys, so the text order is taken from the parser
+    std::vector<std::string> order;
+    nlohmann::json::parser_callback_t record = [&order](int depth, nlohmann::json::parse_event_t event, nlohmann::json& value) {
+        if (depth == 1 && event == nlohmann::json::parse_event_t::key) {
+            order.push_back(value.get<std::string>());
+        }
+        return true;
+    };
+    nlohmann::json payload = nlohmann::json::parse(text, text + len, record);
+
+    if (payload.is_object()) {
+        std::shared_ptr<Shape> learned = std::make_shared<Shape>();
+        learned->fields.reserve(order.size());
+        for (const std::string& key : order) {
+            learned->fields.push_back({key, nlohmann::json(key).dump() + ":", payload[key].type()});
+        }
+        std::atomic_store(&shape_, std::shared_ptr<const Shape>(std::move(learned)));
+    }
+    return payload;
+}
+
+bool CPayloadShapeCache::match(const Shape& shape, const char* text, size_t len, nlohmann::json& payload) {
+    const char* p = text;
+    const char* end = text + len;
+    if (p == end || *p++ != '{') {
+        return false;
+    }
+
+    payload = nlohmann::json::object();
+    for (size_t i = 0; i < shape.fields.size(); ++i) {
+        const Field& field = shape.fields[i];
+        if (i > 0 && (p == end || *p++ != ',')) {
+            return false;
+        }
+        if ((size_t)(end - p) < field.token.size() || memcmp(p, field.token.data(), field.token.size()) != 0) {
+            return false;
+        }
+        p += field.token.size();
+        if (!scanValue(field, p, end, payload[field.key])) {
+            return false;
+        }
+    }
+
+    if (p == end || *p++ != '}') {
+        return false;
+    }
+    while (p != end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        ++p;
+    }
+    return p == end;
+}
+
+// Reads one value of the expected type at p and advances past it. Strings
+// go through CJsonString and integers up to 18 digits are converted
+// directly; floats and nested values are handed to nlohmann for just their
+// span.
+bool CPayloadShapeCache::scanValue(const Field& field, const char*& p, const char* end, nlohmann::json& value) {
+    using value_t = nlohmann::json::value_t;
+    const char* start = p;
+
+    switch (field.type) {
+    case value_t::string:
+        value = std::string();
+        return CJsonString::scan(p, end, value.get_ref<std::string&>());
+    case value_t::boolean:
+        if (end - p >= 4 && memcmp(p, "true", 4) == 0) {
+            p += 4;
+            value = true;
+            return true;
+        }
+        if (end - p >= 5 && memcmp(p, "false", 5) == 0) {
+            p += 5;
+            value = false;
+            return true;
+        }
+        return false;
+    case value_t::null:
+        if (end - p >= 4 && memcmp(p, "null", 4) == 0) {
+            p += 4;
+            value = nullptr;
+            return true;
+        }
+        return false;
+    case value_t::number_unsigned:
+    case value_t::number_integer:
+    case value_t::number_float: {
+        bool negative = p != end && *p == '-';
+        if (negative) {
+            ++p;
+        }
+        const char* digits = p;
+        while (p != end && *p >= '0' && *p <= '9') {
+            ++p;
+        }
+        bool integral = p != end && *p != '.' && *p != 'e' && *p != 'E';
+        if (integral && p != digits && p - digits <= 18 && (*digits != '0' || p - digits == 1)) {
+            long long n = 0;
+            for (const char* d = digits; d != p; ++d) {
+                n = n * 10 + (*d - '0');
+            }
+            if (negative) {
+                if (field.type != value_t::number_integer) return false;
+                value = -n;
+            } else {
+                if (field.type != value_t::number_unsigned) return false;
+                value = (unsigned long long)n;
+            }
+            return true;
+        }
+        while (p != end && (*p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-' || (*p >= '0' && *p <= '9'))) {
+            ++p;
+        }
+        break;
+    }
+    case value_t::object:
+    case value_t::array: {
+        // Find the matching bracket, skipping over strings
+        int nesting = 0;
+        bool inString = false;
+        for (; p != end; ++p) {
+            if (inString) {
+                if (*p == '\\') {
+                    if (++p == end) return false;
+                } else if (*p == '"') {
+                    inString = false;
+                }
+            } else if (*p == '"') {
+                inString = true;
+            } else if (*p == '{' || *p == '[') {
+                ++nesting;
+            } else if ((*p == '}' || *p == ']') && --nesting == 0) {
+                ++p;
+                break;
+            }
+        }
+        if (nesting != 0) {
+            return false;
+        }
+        break;
+    }
+    default:
+        return false;
+    }
+
+    try {
+        value = nlohmann::json::parse(start, p);
+    } catch (const nlohmann::json::exception&) {
+        return false;
+    }
+    return value.type() == field.type;
+}
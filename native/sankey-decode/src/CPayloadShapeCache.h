@@ -0,0 +1,44 @@
+﻿#pragma once
+
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Process-wide memo of the last payload's shape. Licenses are produced by
+// JSON.stringify on the server, so payloads of one product have the same
+// keys in the same order with no whitespace. Once a shape is known, the
+// next payload is matched against it with one memcmp per key token and a
+// direct scan of each value; any mismatch falls back to the general parser,
+// which then learns the new shape. Callers that keep their threads apart
+// (sankey-audit workers) own a cache each instead of sharing instance().
+class CPayloadShapeCache {
+private:
+    struct Field {
+        std::string key;
+        std::string token; // "key": as it appeared in the payload
+        nlohmann::json::value_t type;
+    };
+
+    struct Shape {
+        std::vector<Field> fields;
+    };
+
+    std::shared_ptr<const Shape> shape_; // Swapped atomically, null until learned
+    std::atomic<long long> hits_;
+    std::atomic<long long> misses_;
+
+    static bool match(const Shape& shape, const char* text, size_t len, nlohmann::json& payload);
+    static bool scanValue(const Field& field, const char*& p, const char* end, nlohmann::json& value);
+
+public:
+    CPayloadShapeCache();
+    static CPayloadShapeCache& instance();
+
+    // Same result and exceptions as nlohmann::json::parse
+    nlohmann::json parse(const char* text, size_t len);
+
+    long long hits() const { return hits_.load(); }
+    long long misses() const { return misses_.load(); }
+};
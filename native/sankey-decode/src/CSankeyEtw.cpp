@@ -0,0 +1,45 @@
+﻿#include "CSankeyEtw.h"
+
+TRACELOGGING_DEFINE_PROVIDER(g_sankeyEtwProvider, "Sankey.LicenseDecoder",
+                             (0xff47aa28, 0xbe25, 0x5de8, 0x6d, 0xcd, 0x5f, 0x01, 0x6a, 0x55, 0x68, 0xa6));
+
+namespace {
+
+struct ProviderRegistration {
+    ProviderRegistration() { TraceLoggingRegister(g_sankeyEtwProvider); }
+    ~ProviderRegistration() { TraceLoggingUnregister(g_sankeyEtwProvider); }
+};
+
+uint64_t toNanoseconds(int64_t ticks) {
+    static const int64_t frequency = [] {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        return f.QuadPart;
+    }();
+    return (uint64_t)((double)ticks * 1e9 / (double)frequency);
+}
+
+} // namespace
+
+void CSankeyEtw::registerProvider() {
+    static ProviderRegistration registration; // Destroyed, so unregistered, at module unload
+}
+
+void CSankeyEtw::verifyStart(size_t licenseLen) {
+    TraceLoggingWrite(g_sankeyEtwProvider, "VerifyStart", TraceLoggingUInt64(licenseLen, "LicenseLength"));
+}
+
+void CSankeyEtw::stage(const char* name, int64_t start, int64_t end) {
+    TraceLoggingWrite(g_sankeyEtwProvider, "Stage", TraceLoggingString(name, "Name"),
+                      TraceLoggingUInt64(toNanoseconds(end - start), "DurationNs"));
+}
+
+void CSankeyEtw::verifyEnd(LicenseStatus status, int64_t start, int64_t end) {
+    TraceLoggingWrite(g_sankeyEtwProvider, "VerifyEnd", TraceLoggingInt32(status, "Status"),
+                      TraceLoggingUInt64(toNanoseconds(end - start), "DurationNs"));
+}
+
+void CSankeyEtw::getterMiss(const char* getter, const char* key) {
+    TraceLoggingWrite(g_sankeyEtwProvider, "GetterMiss", TraceLoggingString(getter, "Getter"),
+                      TraceLoggingString(key ? key : "", "Key"));
+}
@@ -0,0 +1,29 @@
+﻿#pragma once
+
+#include "SankeyDecoder.h"
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+#include <cstdint>
+
+TRACELOGGING_DECLARE_PROVIDER(g_sankeyEtwProvider);
+
+// ETW TraceLogging provider "Sankey.LicenseDecoder"
+// ({ff47aa28-be25-5de8-6dcd-5f016a5568a6}, the name-derived GUID, so
+// "*Sankey.LicenseDecoder" works with tracelog/wpr). Events:
+//   VerifyStart  LicenseLength
+//   Stage        Name, DurationNs  (each CTraceSpan: verify stages and getters)
+//   VerifyEnd    Status, DurationNs
+//   GetterMiss   Getter, Key       (a getter returned its default)
+// With no session listening every probe is a single enabled check. The
+// provider is registered by the first decoder, key context or warmup rather
+// than at module load, and unregistered when the module unloads.
+class CSankeyEtw {
+public:
+    static bool enabled() { return TraceLoggingProviderEnabled(g_sankeyEtwProvider, 0, 0); }
+    static void registerProvider();
+
+    static void verifyStart(size_t licenseLen);
+    static void stage(const char* name, int64_t start, int64_t end);
+    static void verifyEnd(LicenseStatus status, int64_t start, int64_t end);
+    static void getterMiss(const char* getter, const char* key);
+};
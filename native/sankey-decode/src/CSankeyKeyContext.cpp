@@ -0,0 +1,139 @@
+﻿#include "CSankeyKeyContext.h"
+#include "CTraceRecorder.h"
+#include <cstring>
+
+CSankeyKeyContext::CSankeyKeyContext() : hProv_(0), hHmacKey_(0), hAesKey_(0), hLocalKey_(0) {
+    memset(key_, 0, sizeof(key_));
+    memset(digest_, 0, sizeof(digest_));
+}
+
+CSankeyKeyContext::~CSankeyKeyContext() {
+    if (hLocalKey_) CryptDestroyKey(hLocalKey_);
+    if (hAesKey_) CryptDestroyKey(hAesKey_);
+    if (hHmacKey_) CryptDestroyKey(hHmacKey_);
+    if (hProv_) CryptReleaseContext(hProv_, 0);
+    SecureZeroMemory(key_, sizeof(key_));
+}
+
+CSankeyKeyContext* CSankeyKeyContext::create(const char* masterKeyB64) {
+    CSankeyEtw::registerProvider();
+    CTraceSpan span("key decode");
+    if (!masterKeyB64) {
+        return nullptr;
+    }
+
+    DWORD len = 0;
+    if (!CryptStringToBinaryA(masterKeyB64, 0, CRYPT_STRING_BASE64, NULL, &len, NULL, NULL) || len != 32) {
+        return nullptr;
+    }
+
+    CSankeyKeyContext* ctx = new CSankeyKeyContext();
+    if (!CryptStringToBinaryA(masterKeyB64, 0, CRYPT_STRING_BASE64, ctx->key_, &len, NULL, NULL) ||
+        len != 32 || !ctx->importKeys() || !ctx->sha256(ctx->key_, sizeof(ctx->key_), ctx->digest_)) {
+        delete ctx;
+        return nullptr;
+    }
+    return ctx;
+}
+
+bool CSankeyKeyContext::importKeys() {
+    if (!CryptAcquireContext(&hProv_, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT)) {
+        return false;
+    }
+    if (!importHmacKey(key_, hHmacKey_)) {
+        return false;
+    }
+
+    struct {
+        BLOBHEADER hdr;
+        DWORD keyLen;
+    } blobHeader = {
+        {PLAINTEXTKEYBLOB, CUR_BLOB_VERSION, 0, CALG_AES_256},
+        (DWORD)sizeof(key_)
+    };
+
+    unsigned char blob[sizeof(blobHeader) + sizeof(key_)];
+    memcpy(blob, &blobHeader, sizeof(blobHeader));
+    memcpy(blob + sizeof(blobHeader), key_, sizeof(key_));
+    bool ok = CryptImportKey(hProv_, blob, (DWORD)sizeof(blob), 0, 0, &hAesKey_) != 0;
+    SecureZeroMemory(blob, sizeof(blob));
+    return ok;
+}
+
+bool CSankeyKeyContext::importHmacKey(const unsigned char key[32], HCRYPTKEY& hKey) const {
+    // HMAC keys go in as generic RC2 plaintext blobs
+    struct {
+        BLOBHEADER hdr;
+        DWORD keyLen;
+    } blobHeader = {
+        {PLAINTEXTKEYBLOB, CUR_BLOB_VERSION, 0, CALG_RC2},
+        32
+    };
+
+    unsigned char blob[sizeof(blobHeader) + 32];
+    memcpy(blob, &blobHeader, sizeof(blobHeader));
+    memcpy(blob + sizeof(blobHeader), key, 32);
+    bool ok = CryptImportKey(hProv_, blob, (DWORD)sizeof(blob), 0, CRYPT_IPSEC_HMAC_KEY, &hKey) != 0;
+    SecureZeroMemory(blob, sizeof(blob));
+    return ok;
+}
+
+bool CSankeyKeyContext::createHmac(HCRYPTHASH& hHash) const {
+    return createHmac(hHmacKey_, hHash);
+}
+
+bool CSankeyKeyContext::createHmac(HCRYPTKEY hKey, HCRYPTHASH& hHash) const {
+    hHash = 0;
+    if (!hKey || !CryptCreateHash(hProv_, CALG_HMAC, hKey, 0, &hHash)) {
+        return false;
+    }
+
+    HMAC_INFO hmacInfo;
+    ZeroMemory(&hmacInfo, sizeof(hmacInfo));
+    hmacInfo.HashAlgid = CALG_SHA_256;
+    if (!CryptSetHashParam(hHash, HP_HMAC_INFO, (BYTE*)&hmacInfo, 0)) {
+        CryptDestroyHash(hHash);
+        hHash = 0;
+        return false;
+    }
+    return true;
+}
+
+bool CSankeyKeyContext::createLocalHmac(HCRYPTHASH& hHash) const {
+    std::call_once(localKeyOnce_, [this]() {
+        static const char label[] = "SANKEY-LOCAL-V1";
+        HCRYPTHASH hDerive = 0;
+        if (!createHmac(hDerive)) {
+            return;
+        }
+        unsigned char ticketKey[32];
+        DWORD len = sizeof(ticketKey);
+        if (CryptHashData(hDerive, (const BYTE*)label, sizeof(label) - 1, 0) &&
+            CryptGetHashParam(hDerive, HP_HASHVAL, ticketKey, &len, 0) && len == 32) {
+            importHmacKey(ticketKey, hLocalKey_);
+        }
+        CryptDestroyHash(hDerive);
+        SecureZeroMemory(ticketKey, sizeof(ticketKey));
+    });
+    return createHmac(hLocalKey_, hHash);
+}
+
+bool CSankeyKeyContext::duplicateAesKey(HCRYPTKEY& hKey) const {
+    hKey = 0;
+    return CryptDuplicateKey(hAesKey_, NULL, 0, &hKey) != 0;
+}
+
+bool CSankeyKeyContext::sha256(const void* data, size_t len, unsigned char digest[32]) const {
+    HCRYPTHASH hHash = 0;
+    if (!CryptCreateHash(hProv_, CALG_SHA_256, 0, 0, &hHash)) {
+        return false;
+    }
+
+    bool ok = CryptHashData(hHash, static_cast<const BYTE*>(data), (DWORD)len, 0) != 0;
+    if (ok) {
+        DWORD digestLen = 32;
+        ok = CryptGetHashParam(hHash, HP_HASHVAL, digest, &digestLen, 0) && digestLen == 32;
+    }
+    CryptDestroyHash(hHash);
+    return ok;
+}
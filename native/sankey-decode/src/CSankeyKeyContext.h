@@ -0,0 +1,52 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <wincrypt.h>
+#include <mutex>
+
+// Decoded master key plus the CryptoAPI objects derived from it.
+// Building these is the expensive part of a verify (provider load, key
+// import), so callers that verify repeatedly keep one context alive and
+// pass it to CSankeyLicenseDecoder::verify.
+class CSankeyKeyContext {
+private:
+    unsigned char key_[32];
+    unsigned char digest_[32]; // SHA-256 of the key; identifies it without exposing it
+    HCRYPTPROV hProv_;
+    HCRYPTKEY hHmacKey_;
+    HCRYPTKEY hAesKey_;
+    mutable std::once_flag localKeyOnce_;
+    mutable HCRYPTKEY hLocalKey_; // Derived on first use, see createLocalHmac
+
+    CSankeyKeyContext();
+    bool importKeys();
+    bool importHmacKey(const unsigned char key[32], HCRYPTKEY& hKey) const;
+    bool createHmac(HCRYPTKEY hKey, HCRYPTHASH& hHash) const;
+
+public:
+    ~CSankeyKeyContext();
+
+    CSankeyKeyContext(const CSankeyKeyContext&) = delete;
+    CSankeyKeyContext& operator=(const CSankeyKeyContext&) = delete;
+
+    // Returns nullptr if the key is not valid Base64 of exactly 32 bytes
+    // or the crypto provider cannot be loaded.
+    static CSankeyKeyContext* create(const char* masterKeyB64);
+
+    const unsigned char* digest() const { return digest_; }
+    // Key id carried by v2 envelopes: the first kKeyIdLen bytes of the digest
+    static const size_t kKeyIdLen = 8;
+    const unsigned char* keyId() const { return digest_; }
+
+    // Fresh HMAC-SHA256 hash object keyed with the master key. Caller destroys.
+    bool createHmac(HCRYPTHASH& hHash) const;
+    // Private copy of the AES-256 key so CBC state is not shared between
+    // concurrent verifies. Caller destroys.
+    bool duplicateAesKey(HCRYPTKEY& hKey) const;
+    // HMAC-SHA256 keyed with HMAC(masterKey, "SANKEY-LOCAL-V1"), for MACs
+    // over data the DLL produces itself (verification tickets, verify daemon
+    // responses); each format starts with its own magic. Caller destroys.
+    bool createLocalHmac(HCRYPTHASH& hHash) const;
+    // Plain SHA-256 on this context's provider (file digests, cache keys)
+    bool sha256(const void* data, size_t len, unsigned char digest[32]) const;
+};
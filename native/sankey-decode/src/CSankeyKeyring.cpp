@@ -0,0 +1,27 @@
+﻿#include "CSankeyKeyring.h"
+
+bool CSankeyKeyring::add(const char* masterKeyB64) {
+    std::shared_ptr<const CSankeyKeyContext> keyCtx(CSankeyKeyContext::create(masterKeyB64));
+    if (!keyCtx) {
+        return false;
+    }
+
+    std::string id(reinterpret_cast<const char*>(keyCtx->keyId()), CSankeyKeyContext::kKeyIdLen);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (byId_.emplace(id, keyCtx).second) {
+        keys_.push_back(keyCtx);
+    }
+    return true;
+}
+
+std::shared_ptr<const CSankeyKeyContext> CSankeyKeyring::find(const unsigned char keyId[CSankeyKeyContext::kKeyIdLen]) const {
+    std::string id(reinterpret_cast<const char*>(keyId), CSankeyKeyContext::kKeyIdLen);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = byId_.find(id);
+    return it != byId_.end() ? it->second : nullptr;
+}
+
+std::vector<std::shared_ptr<const CSankeyKeyContext>> CSankeyKeyring::keys() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return keys_;
+}
@@ -0,0 +1,26 @@
+﻿#pragma once
+
+#include "CSankeyKeyContext.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Master keys that are live at the same time during a rotation, indexed by
+// key id so a v2 license goes straight to its key. Keys can be added while
+// other threads verify; contexts are shared so a lookup stays valid after
+// the lock is released.
+class CSankeyKeyring {
+private:
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<const CSankeyKeyContext>> keys_; // In the order added, for v1 licenses
+    std::unordered_map<std::string, std::shared_ptr<const CSankeyKeyContext>> byId_;
+
+public:
+    // false if the key is malformed; adding a key twice is a no-op
+    bool add(const char* masterKeyB64);
+
+    std::shared_ptr<const CSankeyKeyContext> find(const unsigned char keyId[CSankeyKeyContext::kKeyIdLen]) const;
+    std::vector<std::shared_ptr<const CSankeyKeyContext>> keys() const;
+};
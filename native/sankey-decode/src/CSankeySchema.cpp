@@ -0,0 +1,228 @@
+﻿#include "CSankeySchema.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+CSankeySchema* CSankeySchema::compile(const char* schemaJson, std::string& error) {
+    if (!schemaJson) {
+        error = "no schema";
+        return nullptr;
+    }
+
+    nlohmann::json schema;
+    try {
+        schema = nlohmann::json::parse(schemaJson);
+    } catch (const nlohmann::json::exception& e) {
+        error = e.what();
+        return nullptr;
+    }
+    if (!schema.is_object()) {
+        error = "schema must be an object";
+        return nullptr;
+    }
+
+    std::vector<std::string> required;
+    nlohmann::json properties = nlohmann::json::object();
+    for (auto it = schema.begin(); it != schema.end(); ++it) {
+        if (it.key() == "type") {
+            if (*it != "object") {
+                error = "payload type must be \"object\"";
+                return nullptr;
+            }
+        } else if (it.key() == "required") {
+            if (!it->is_array()) {
+                error = "required must be an array";
+                return nullptr;
+            }
+            for (const nlohmann::json& name : *it) {
+                if (!name.is_string()) {
+                    error = "required entries must be strings";
+                    return nullptr;
+                }
+                required.push_back(name.get<std::string>());
+            }
+        } else if (it.key() == "properties") {
+            if (!it->is_object()) {
+                error = "properties must be an object";
+                return nullptr;
+            }
+            properties = *it;
+        } else if (it.key() != "$schema" && it.key() != "title" && it.key() != "description") {
+            error = "unsupported keyword " + it.key();
+            return nullptr;
+        }
+    }
+
+    std::unique_ptr<CSankeySchema> compiled(new CSankeySchema());
+    for (auto it = properties.begin(); it != properties.end(); ++it) {
+        bool isRequired = std::find(required.begin(), required.end(), it.key()) != required.end();
+        if (!compiled->compileProperty(it.key(), *it, isRequired, error)) {
+            return nullptr;
+        }
+    }
+    // Required keys without property rules only need to exist
+    for (const std::string& name : required) {
+        if (!properties.contains(name) && !compiled->compileProperty(name, nlohmann::json::object(), true, error)) {
+            return nullptr;
+        }
+    }
+
+    compiled->byName_.resize(compiled->keys_.size());
+    for (size_t i = 0; i < compiled->byName_.size(); ++i) {
+        compiled->byName_[i] = (uint16_t)i;
+    }
+    const std::vector<std::string>& keys = compiled->keys_;
+    std::stable_sort(compiled->byName_.begin(), compiled->byName_.end(),
+                     [&keys](uint16_t a, uint16_t b) { return keys[a] < keys[b]; });
+    return compiled.release();
+}
+
+bool CSankeySchema::compileProperty(const std::string& name, const nlohmann::json& rules, bool required, std::string& error) {
+    if (!rules.is_object()) {
+        error = "rules for " + name + " must be an object";
+        return false;
+    }
+    if (keys_.size() > UINT16_MAX) {
+        error = "too many properties";
+        return false;
+    }
+
+    uint16_t key = (uint16_t)keys_.size();
+    keys_.push_back(name);
+    ops_.push_back({OpSelect, 0, key, required ? 1.0 : 0.0});
+
+    for (auto it = rules.begin(); it != rules.end(); ++it) {
+        const std::string& keyword = it.key();
+        if (keyword == "type") {
+            uint8_t types = 0;
+            std::vector<nlohmann::json> names = it->is_array() ? it->get<std::vector<nlohmann::json>>()
+                                                               : std::vector<nlohmann::json>{*it};
+            for (const nlohmann::json& typeName : names) {
+                uint8_t bit = 0;
+                if (!typeName.is_string() || !typeBit(typeName.get<std::string>(), bit)) {
+                    error = "unsupported type for " + name;
+                    return false;
+                }
+                types |= bit;
+            }
+            ops_.push_back({OpType, types, key, 0.0});
+        } else if (keyword == "minimum" || keyword == "maximum" || keyword == "minLength" || keyword == "maxLength") {
+            if (!it->is_number()) {
+                error = keyword + " for " + name + " must be a number";
+                return false;
+            }
+            Opcode code = keyword == "minimum" ? OpMinimum : keyword == "maximum" ? OpMaximum
+                        : keyword == "minLength" ? OpMinLength : OpMaxLength;
+            ops_.push_back({code, 0, key, it->get<double>()});
+        } else if (keyword != "description" && keyword != "title") {
+            error = "unsupported keyword " + keyword + " for " + name;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CSankeySchema::typeBit(const std::string& name, uint8_t& bit) {
+    if (name == "string") bit = TypeString;
+    else if (name == "integer") bit = TypeInteger;
+    else if (name == "number") bit = TypeNumber;
+    else if (name == "boolean") bit = TypeBoolean;
+    else if (name == "object") bit = TypeObject;
+    else if (name == "array") bit = TypeArray;
+    else if (name == "null") bit = TypeNull;
+    else return false;
+    return true;
+}
+
+bool CSankeySchema::matchesType(const nlohmann::json& value, uint8_t types) {
+    switch (value.type()) {
+    case nlohmann::json::value_t::string: return (types & TypeString) != 0;
+    case nlohmann::json::value_t::number_integer:
+    case nlohmann::json::value_t::number_unsigned: return (types & (TypeInteger | TypeNumber)) != 0;
+    // Unlike JSON Schema, 1.0 is not an integer: GetValueAsInt would not read it
+    case nlohmann::json::value_t::number_float: return (types & TypeNumber) != 0;
+    case nlohmann::json::value_t::boolean: return (types & TypeBoolean) != 0;
+    case nlohmann::json::value_t::object: return (types & TypeObject) != 0;
+    case nlohmann::json::value_t::array: return (types & TypeArray) != 0;
+    case nlohmann::json::value_t::null: return (types & TypeNull) != 0;
+    default: return false;
+    }
+}
+
+size_t CSankeySchema::codePoints(const std::string& s) {
+    size_t n = 0;
+    for (unsigned char c : s) {
+        n += (c & 0xC0) != 0x80;
+    }
+    return n;
+}
+
+int CSankeySchema::ordinal(const char* key) const {
+    auto it = std::lower_bound(byName_.begin(), byName_.end(), key,
+                               [this](uint16_t ordinal, const char* name) { return std::strcmp(keys_[ordinal].c_str(), name) < 0; });
+    if (it == byName_.end() || keys_[*it] != key) {
+        return -1;
+    }
+    return *it;
+}
+
+bool CSankeySchema::check(const nlohmann::json& payload) const {
+    if (!payload.is_object()) {
+        return false;
+    }
+
+    const nlohmann::json* value = nullptr;
+    for (size_t i = 0; i < ops_.size(); ++i) {
+        const Op& op = ops_[i];
+        if (op.code == OpSelect) {
+            auto it = payload.find(keys_[op.key]);
+            if (it != payload.end()) {
+                value = &*it;
+                continue;
+            }
+            if (op.arg != 0.0) {
+                return false;
+            }
+            // Absent optional property: skip its rules
+            while (i + 1 < ops_.size() && ops_[i + 1].code != OpSelect) {
+                ++i;
+            }
+            continue;
+        }
+
+        switch (op.code) {
+        case OpType:
+            if (!matchesType(*value, op.types)) return false;
+            break;
+        case OpMinimum:
+            if (value->is_number() && value->get<double>() < op.arg) return false;
+            break;
+        case OpMaximum:
+            if (value->is_number() && value->get<double>() > op.arg) return false;
+            break;
+        case OpMinLength:
+            if (value->is_string() && (double)codePoints(value->get_ref<const std::string&>()) < op.arg) return false;
+            break;
+        case OpMaxLength:
+            if (value->is_string() && (double)codePoints(value->get_ref<const std::string&>()) > op.arg) return false;
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+CSankeySchema* CSankeySchema::acquireHandle(const char* schemaJson) {
+    std::string error;
+    std::shared_ptr<CSankeySchema> schema(compile(schemaJson, error));
+    if (!schema) return nullptr;
+    schema->handle_ = schema;
+    return schema.get();
+}
+
+void CSankeySchema::releaseHandle(CSankeySchema* schema) {
+    if (!schema) return;
+    // Moved out first, since dropping the last reference frees the schema
+    std::shared_ptr<const CSankeySchema> released = std::move(schema->handle_);
+}
@@ -0,0 +1,79 @@
+﻿#pragma once
+
+#include <nlohmann/json.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Payload schema checked once at verify time. A subset of JSON Schema is
+// lowered into a flat opcode table:
+//
+//   {"type": "object",
+//    "required": ["eaName", ...],
+//    "properties": {"lots": {"type": "number", "minimum": 0, "maximum": 100},
+//                   "eaName": {"type": "string", "minLength": 1, "maxLength": 64},
+//                   "mode": {"type": ["integer", "string"]}, ...}}
+//
+// Supported property keywords are type, minimum, maximum, minLength and
+// maxLength; anything else is rejected at compile time rather than
+// silently not enforced. Properties that are neither required nor present
+// pass. "integer" only matches values written without a fraction or
+// exponent, the ones the integer getters read.
+class CSankeySchema {
+private:
+    enum Opcode : uint8_t {
+        OpSelect,    // Look up keys_[key]; fails if absent and arg != 0 (required)
+        OpType,      // Selected value's type is in the types mask
+        OpMinimum,   // Numeric value >= arg
+        OpMaximum,   // Numeric value <= arg
+        OpMinLength, // String length in code points >= arg
+        OpMaxLength, // String length in code points <= arg
+    };
+
+    enum TypeBit : uint8_t {
+        TypeString = 1,
+        TypeInteger = 2,
+        TypeNumber = 4,
+        TypeBoolean = 8,
+        TypeObject = 16,
+        TypeArray = 32,
+        TypeNull = 64,
+    };
+
+    struct Op {
+        Opcode code;
+        uint8_t types;
+        uint16_t key;
+        double arg;
+    };
+
+    std::vector<std::string> keys_;
+    std::vector<uint16_t> byName_; // Ordinals sorted by key, first occurrence first
+    std::vector<Op> ops_;
+    std::shared_ptr<const CSankeySchema> handle_; // CompileSchema caller's reference, dropped by DestroySchema
+
+    static bool typeBit(const std::string& name, uint8_t& bit);
+    static bool matchesType(const nlohmann::json& value, uint8_t types);
+    static size_t codePoints(const std::string& s);
+    bool compileProperty(const std::string& name, const nlohmann::json& rules, bool required, std::string& error);
+
+public:
+    // nullptr (and error set) if the schema is malformed or uses unsupported keywords
+    static CSankeySchema* compile(const char* schemaJson, std::string& error);
+
+    bool check(const nlohmann::json& payload) const;
+
+    // Properties the schema names, by ordinal; ordinal() is -1 for keys it
+    // does not name. Repeated names resolve to their first ordinal
+    size_t propertyCount() const { return keys_.size(); }
+    const std::string& propertyName(size_t ordinal) const { return keys_[ordinal]; }
+    int ordinal(const char* key) const;
+
+    // Exported handles are ref counted: decoders take their own reference
+    // in SetSchema, so releasing the handle does not free a schema that a
+    // decoder is still checking against.
+    static CSankeySchema* acquireHandle(const char* schemaJson);
+    static void releaseHandle(CSankeySchema* schema);
+    std::shared_ptr<const CSankeySchema> share() const { return handle_; }
+};
@@ -0,0 +1,127 @@
+﻿#include "CTraceRecorder.h"
+#include <windows.h>
+#include <nlohmann/json.hpp>
+#include <fstream>
+
+std::atomic<bool> CTraceRecorder::enabled_(false);
+
+void CTraceRecorder::setEnabled(bool enabled) {
+    enabled_.store(enabled);
+}
+
+int64_t CTraceRecorder::now() {
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+CTraceRecorder::Registry& CTraceRecorder::registry() {
+    // Never destroyed: detached threads (watchers, daemon clients) can exit
+    // after static destructors have run and still retire their rings
+    static Registry* registry = new Registry();
+    return *registry;
+}
+
+CTraceRecorder::RingOwner::~RingOwner() {
+    if (!ring) {
+        return;
+    }
+    // Keep the newest exited rings for dumps; drop the oldest past the cap.
+    // A dump in progress holds its own references, so dropping is safe.
+    Registry& all = registry();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    ring->exited = true;
+    ++all.exited;
+    for (auto it = all.rings.begin(); all.exited > kRetainedRings && it != all.rings.end();) {
+        if ((*it)->exited) {
+            it = all.rings.erase(it);
+            --all.exited;
+        } else {
+            ++it;
+        }
+    }
+}
+
+CTraceRecorder::Ring& CTraceRecorder::threadRing() {
+    thread_local RingOwner owner;
+    if (!owner.ring) {
+        std::shared_ptr<Ring> ring = std::make_shared<Ring>();
+        ring->tid = GetCurrentThreadId();
+        ring->exited = false;
+        ring->head.store(0);
+        for (Slot& slot : ring->slots) {
+            slot.seq.store(0);
+        }
+        Registry& all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        all.rings.push_back(ring);
+        owner.ring = ring;
+    }
+    return *owner.ring;
+}
+
+size_t CTraceRecorder::ringCount() {
+    Registry& all = registry();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    return all.rings.size();
+}
+
+void CTraceRecorder::record(const char* name, int64_t start, int64_t end) {
+    Ring& ring = threadRing();
+    uint64_t n = ring.head.load(std::memory_order_relaxed);
+    Slot& slot = ring.slots[n % kRingSize];
+
+    slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.end.store(end, std::memory_order_relaxed);
+    slot.seq.store(2 * n + 2, std::memory_order_release);
+    ring.head.store(n + 1, std::memory_order_release);
+}
+
+bool CTraceRecorder::dump(const char* path) {
+    if (!path || !*path) {
+        return false;
+    }
+
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+        Registry& all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        rings = all.rings;
+    }
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    double usPerTick = 1e6 / (double)frequency.QuadPart;
+    DWORD pid = GetCurrentProcessId();
+
+    nlohmann::json events = nlohmann::json::array();
+    for (const std::shared_ptr<Ring>& ring : rings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > kRingSize ? head - kRingSize : 0;
+        for (uint64_t n = first; n < head; ++n) {
+            const Slot& slot = ring->slots[n % kRingSize];
+            uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            const char* name = slot.name.load(std::memory_order_relaxed);
+            int64_t start = slot.start.load(std::memory_order_relaxed);
+            int64_t end = slot.end.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq != 2 * n + 2 || slot.seq.load(std::memory_order_relaxed) != seq) {
+                continue; // Overwritten since head was read
+            }
+            events.push_back({{"name", name},
+                              {"cat", "sankey"},
+                              {"ph", "X"},
+                              {"ts", start * usPerTick},
+                              {"dur", (end - start) * usPerTick},
+                              {"pid", pid},
+                              {"tid", ring->tid}});
+        }
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << nlohmann::json{{"traceEvents", events}, {"displayTimeUnit", "ns"}}.dump();
+    return static_cast<bool>(out);
+}
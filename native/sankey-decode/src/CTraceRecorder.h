@@ -0,0 +1,94 @@
+﻿#pragma once
+
+#include "CSankeyEtw.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Optional span tracing of verify stages and getters, dumped as Chrome
+// trace-event JSON (chrome://tracing, Perfetto). Off by default; a span
+// with this and ETW both off costs a relaxed load and an enabled check.
+//
+// Each thread records into its own ring of the most recent kRingSize
+// spans, so recording takes no lock. Slots carry a sequence number that a
+// concurrent dump uses to skip spans being overwritten. A ring stays
+// registered after its thread exits so a later dump still shows it, but
+// only the kRetainedRings most recently exited threads are kept: parallel
+// decrypt workers and per-client daemon threads come and go all the time.
+class CTraceRecorder {
+public:
+    static const size_t kRingSize = 4096;
+    static const size_t kRetainedRings = 32;
+
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+    static void setEnabled(bool enabled);
+
+    static int64_t now();
+    static void record(const char* name, int64_t start, int64_t end);
+
+    // Writes every recorded span to path; false if the file cannot be written
+    static bool dump(const char* path);
+
+    // Registered rings, live and retained (tests)
+    static size_t ringCount();
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq; // Odd while being written
+        std::atomic<const char*> name;
+        std::atomic<int64_t> start;
+        std::atomic<int64_t> end;
+    };
+
+    struct Ring {
+        uint32_t tid;
+        bool exited; // Guarded by the registry mutex
+        std::atomic<uint64_t> head; // Spans ever written
+        Slot slots[kRingSize];
+    };
+
+    // Every thread's ring; built on first use, not at module load
+    struct Registry {
+        std::mutex mutex; // Guards rings membership and exited flags
+        std::vector<std::shared_ptr<Ring>> rings; // In registration order
+        size_t exited = 0;
+    };
+
+    // Thread-local handle; retires the ring when its thread exits
+    struct RingOwner {
+        std::shared_ptr<Ring> ring;
+        ~RingOwner();
+    };
+
+    static std::atomic<bool> enabled_;
+
+    static Registry& registry();
+    static Ring& threadRing();
+};
+
+// RAII span; names must be string literals. Goes to the trace rings and,
+// while an ETW session listens, out as a Stage event.
+class CTraceSpan {
+private:
+    const char* name_;
+    int64_t start_; // -1 when neither sink was on at construction
+
+public:
+    explicit CTraceSpan(const char* name)
+        : name_(name), start_(CTraceRecorder::enabled() || CSankeyEtw::enabled() ? CTraceRecorder::now() : -1) {}
+    ~CTraceSpan() { end(); }
+
+    void end() {
+        if (start_ >= 0) {
+            int64_t now = CTraceRecorder::now();
+            if (CTraceRecorder::enabled()) CTraceRecorder::record(name_, start_, now);
+            if (CSankeyEtw::enabled()) CSankeyEtw::stage(name_, start_, now);
+            start_ = -1;
+        }
+    }
+
+    CTraceSpan(const CTraceSpan&) = delete;
+    CTraceSpan& operator=(const CTraceSpan&) = delete;
+};
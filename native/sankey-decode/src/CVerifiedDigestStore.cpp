@@ -0,0 +1,291 @@
+﻿#include "CVerifiedDigestStore.h"
+#include "CSankeyKeyContext.h"
+#include <cstring>
+
+namespace {
+
+const char kMagic[4] = { 'S', 'K', 'D', '1' };
+const uint64_t kInitialCapacity = 1024;
+const size_t kKeyOffset = 8;
+const size_t kKeySize = 32 + 32 + 8;
+const size_t kMacOffset = 128;
+const size_t kMacSize = 16;
+const uint32_t kSlotUsed = 1;
+
+bool slotMac(const CSankeyKeyContext& keyCtx, const unsigned char* slot, unsigned char mac[kMacSize]) {
+    HCRYPTHASH hHash = 0;
+    if (!keyCtx.createLocalHmac(hHash)) {
+        return false;
+    }
+    unsigned char full[32];
+    DWORD macLen = 32;
+    bool ok = CryptHashData(hHash, reinterpret_cast<const BYTE*>(kMagic), 4, 0) &&
+              CryptHashData(hHash, slot + 4, (DWORD)(kMacOffset - 4), 0) &&
+              CryptGetHashParam(hHash, HP_HASHVAL, full, &macLen, 0) && macLen == 32;
+    CryptDestroyHash(hHash);
+    memcpy(mac, full, kMacSize);
+    return ok;
+}
+
+uint32_t slotState(const unsigned char* slot) {
+    uint32_t state = 0;
+    memcpy(&state, slot, 4);
+    return state;
+}
+
+// The digests are already uniform; mixing the three keeps records for one
+// license under several keys apart
+uint64_t keyHash(const unsigned char* key) {
+    uint64_t a = 0, b = 0, c = 0;
+    memcpy(&a, key, 8);
+    memcpy(&b, key + 32, 8);
+    memcpy(&c, key + 64, 8);
+    return a ^ (b * 0x9E3779B97F4A7C15ULL) ^ (c * 0xC2B2AE3D27D4EB4FULL);
+}
+
+} // namespace
+
+CVerifiedDigestStore::CVerifiedDigestStore()
+    : hFile_(INVALID_HANDLE_VALUE), hMapping_(NULL), data_(nullptr), capacity_(0), count_(0) {
+}
+
+CVerifiedDigestStore::~CVerifiedDigestStore() {
+    close();
+}
+
+void CVerifiedDigestStore::unmap() {
+    if (data_) UnmapViewOfFile(data_);
+    if (hMapping_) CloseHandle(hMapping_);
+    if (hFile_ != INVALID_HANDLE_VALUE) CloseHandle(hFile_);
+    data_ = nullptr;
+    hMapping_ = NULL;
+    hFile_ = INVALID_HANDLE_VALUE;
+    capacity_ = 0;
+}
+
+void CVerifiedDigestStore::close() {
+    if (data_) {
+        FlushViewOfFile(data_, 0);
+    }
+    unmap();
+    path_.clear();
+    seen_.clear();
+    count_ = 0;
+}
+
+bool CVerifiedDigestStore::map(const char* path, uint64_t capacity, bool create) {
+    hFile_ = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, create ? CREATE_ALWAYS : OPEN_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile_ == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile_, &fileSize)) {
+        unmap();
+        return false;
+    }
+    if (!create && fileSize.QuadPart >= (LONGLONG)kHeaderSize) {
+        // Existing store: its header decides the capacity
+        unsigned char header[kHeaderSize];
+        DWORD read = 0;
+        uint64_t stored = 0;
+        if (ReadFile(hFile_, header, (DWORD)kHeaderSize, &read, NULL) && read == kHeaderSize &&
+            memcmp(header, kMagic, 4) == 0) {
+            memcpy(&stored, header + 8, 8);
+        }
+        bool valid = stored >= kInitialCapacity && (stored & (stored - 1)) == 0 && stored < (1ULL << 32) &&
+                     (unsigned long long)fileSize.QuadPart == kHeaderSize + stored * kSlotSize;
+        if (!valid) {
+            // Not a store (or truncated): start over rather than trust it
+            unmap();
+            return map(path, capacity, true);
+        }
+        capacity = stored;
+    } else if (!create && fileSize.QuadPart != 0) {
+        unmap();
+        return map(path, capacity, true);
+    }
+
+    unsigned long long bytes = kHeaderSize + capacity * kSlotSize;
+    hMapping_ = CreateFileMappingA(hFile_, NULL, PAGE_READWRITE, (DWORD)(bytes >> 32), (DWORD)bytes, NULL);
+    if (!hMapping_) {
+        unmap();
+        return false;
+    }
+    data_ = static_cast<unsigned char*>(MapViewOfFile(hMapping_, FILE_MAP_WRITE, 0, 0, 0));
+    if (!data_) {
+        unmap();
+        return false;
+    }
+
+    if (memcmp(data_, kMagic, 4) != 0) {
+        // Fresh file: the mapping grew it with zeros, so every slot is empty
+        memcpy(data_ + 8, &capacity, 8);
+        memcpy(data_, kMagic, 4);
+    }
+    capacity_ = capacity;
+    return true;
+}
+
+bool CVerifiedDigestStore::open(const char* path) {
+    close();
+    if (!path || !map(path, kInitialCapacity, false)) {
+        return false;
+    }
+    path_ = path;
+
+    count_ = 0;
+    for (uint64_t i = 0; i < capacity_; ++i) {
+        count_ += slotState(slot(i)) == kSlotUsed;
+    }
+    seen_.assign((size_t)capacity_, false);
+    return true;
+}
+
+uint64_t CVerifiedDigestStore::probe(const Key& key) const {
+    unsigned char packed[kKeySize];
+    memcpy(packed, key.licenseDigest, 32);
+    memcpy(packed + 32, key.accountDigest, 32);
+    memcpy(packed + 64, key.keyId, 8);
+
+    // Linear probing; the table is at most half full, so an empty slot ends every chain
+    uint64_t mask = capacity_ - 1;
+    uint64_t i = keyHash(packed) & mask;
+    for (;;) {
+        const unsigned char* s = slot(i);
+        if (slotState(s) != kSlotUsed || memcmp(s + kKeyOffset, packed, kKeySize) == 0) {
+            return i;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+bool CVerifiedDigestStore::find(const CSankeyKeyContext& keyCtx, const Key& key, Record& record) {
+    if (!data_) {
+        return false;
+    }
+    uint64_t index = probe(key);
+    const unsigned char* s = slot(index);
+    if (slotState(s) != kSlotUsed) {
+        return false;
+    }
+
+    unsigned char mac[kMacSize];
+    if (!slotMac(keyCtx, s, mac) || memcmp(mac, s + kMacOffset, kMacSize) != 0) {
+        return false;
+    }
+    seen_[(size_t)index] = true;
+
+    memcpy(&record.status, s + 4, 4);
+    memcpy(&record.expiry, s + 80, 8);
+    memcpy(&record.verifiedAt, s + 88, 8);
+    memcpy(record.payloadDigest, s + 96, 32);
+    return true;
+}
+
+bool CVerifiedDigestStore::put(const CSankeyKeyContext& keyCtx, const Key& key, const Record& record) {
+    if (!data_) {
+        return false;
+    }
+    if ((count_ + 1) * 2 > capacity_ && !rebuild(capacity_ * 2, false)) {
+        return false;
+    }
+
+    uint64_t index = probe(key);
+    unsigned char* s = slot(index);
+    bool added = slotState(s) != kSlotUsed;
+
+    unsigned char staged[kSlotSize] = {};
+    memcpy(staged, &kSlotUsed, 4);
+    memcpy(staged + 4, &record.status, 4);
+    memcpy(staged + 8, key.licenseDigest, 32);
+    memcpy(staged + 40, key.accountDigest, 32);
+    memcpy(staged + 72, key.keyId, 8);
+    memcpy(staged + 80, &record.expiry, 8);
+    memcpy(staged + 88, &record.verifiedAt, 8);
+    memcpy(staged + 96, record.payloadDigest, 32);
+    if (!slotMac(keyCtx, staged, staged + kMacOffset)) {
+        return false;
+    }
+
+    // State last: a run cut short leaves an empty slot or one that fails its
+    // MAC, and both read as a miss
+    memcpy(s + 4, staged + 4, kSlotSize - 4);
+    memcpy(s, staged, 4);
+    seen_[(size_t)index] = true;
+    count_ += added;
+    return true;
+}
+
+bool CVerifiedDigestStore::rebuild(uint64_t capacity, bool seenOnly) {
+    std::string tmpPath = path_ + ".tmp";
+    CVerifiedDigestStore next;
+    if (!next.map(tmpPath.c_str(), capacity, true)) {
+        DeleteFileA(tmpPath.c_str());
+        return false;
+    }
+    next.path_ = path_;
+    next.seen_.assign((size_t)capacity, false);
+
+    // Records move as-is; the MAC does not cover the slot position
+    Key key;
+    for (uint64_t i = 0; i < capacity_; ++i) {
+        const unsigned char* s = slot(i);
+        if (slotState(s) != kSlotUsed || (seenOnly && !seen_[(size_t)i])) {
+            continue;
+        }
+        memcpy(key.licenseDigest, s + 8, 32);
+        memcpy(key.accountDigest, s + 40, 32);
+        memcpy(key.keyId, s + 72, 8);
+        uint64_t index = next.probe(key);
+        memcpy(next.slot(index), s, kSlotSize);
+        next.seen_[(size_t)index] = seen_[(size_t)i];
+        ++next.count_;
+    }
+
+    // Swap the files while neither is mapped
+    bool flushed = FlushViewOfFile(next.data_, 0) != FALSE;
+    next.unmap();
+    std::string path = path_;
+    std::vector<bool> seen;
+    seen.swap(next.seen_);
+    size_t count = next.count_;
+    unmap();
+    if (!flushed || !MoveFileExA(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        // Carry on with the old table; seen_ still describes it
+        DeleteFileA(tmpPath.c_str());
+        map(path.c_str(), kInitialCapacity, false);
+        return false;
+    }
+    if (!map(path.c_str(), kInitialCapacity, false)) {
+        return false;
+    }
+    seen_.swap(seen);
+    count_ = count;
+    return true;
+}
+
+size_t CVerifiedDigestStore::prune() {
+    if (!data_) {
+        return 0;
+    }
+    size_t before = count_;
+    // Shrink back while keeping the table at most a quarter full after pruning
+    size_t kept = 0;
+    for (uint64_t i = 0; i < capacity_; ++i) {
+        kept += slotState(slot(i)) == kSlotUsed && seen_[(size_t)i];
+    }
+    uint64_t capacity = kInitialCapacity;
+    while (capacity < (uint64_t)kept * 4) {
+        capacity *= 2;
+    }
+    if (kept == before || !rebuild(capacity, true)) {
+        return 0;
+    }
+    return before - count_;
+}
+
+bool CVerifiedDigestStore::flush() {
+    return data_ && FlushViewOfFile(data_, 0) && FlushFileBuffers(hFile_);
+}
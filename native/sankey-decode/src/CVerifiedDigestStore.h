@@ -0,0 +1,76 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class CSankeyKeyContext;
+
+// Content-addressed record of past verify outcomes for bulk audits, kept in
+// a memory-mapped open-addressing table so a nightly run only decrypts
+// licenses that changed since the last one.
+//
+// Layout (little-endian):
+//   header: "SKD1" | reserved u32 | capacity u64 | zero padding to 64 bytes
+//   slot:   state u32 | status i32 | licenseDigest[32] | accountDigest[32]
+//           | keyId[8] | expiry i64 | verifiedAt i64 | payloadDigest[32] | mac[16]
+// A slot is addressed by (licenseDigest, accountDigest, keyId). mac is
+// HMAC-SHA256, truncated, under the record key's local MAC key over the
+// magic and the slot bytes between state and mac, so an edited store
+// cannot turn a failure into Valid. A record that fails its MAC is a miss.
+class CVerifiedDigestStore {
+public:
+    static const size_t kHeaderSize = 64;
+    static const size_t kSlotSize = 144;
+
+    struct Key {
+        unsigned char licenseDigest[32];
+        unsigned char accountDigest[32];
+        unsigned char keyId[8];
+    };
+
+    struct Record {
+        int status;       // LicenseStatus of the full verify
+        long long expiry; // Unix time, 0 when the payload has none
+        long long verifiedAt;
+        unsigned char payloadDigest[32]; // SHA-256 of the payload JSON; zero unless Valid
+    };
+
+    CVerifiedDigestStore();
+    ~CVerifiedDigestStore();
+
+    CVerifiedDigestStore(const CVerifiedDigestStore&) = delete;
+    CVerifiedDigestStore& operator=(const CVerifiedDigestStore&) = delete;
+
+    // Creates the store if missing; a file that is not a store is replaced
+    bool open(const char* path);
+    void close();
+
+    // Not thread-safe; the audit consults the store from one thread
+    bool find(const CSankeyKeyContext& keyCtx, const Key& key, Record& record);
+    bool put(const CSankeyKeyContext& keyCtx, const Key& key, const Record& record);
+
+    // Drops records not found or put since open (accounts gone from the bundle);
+    // returns how many were dropped
+    size_t prune();
+    bool flush();
+
+    size_t size() const { return count_; }
+
+private:
+    std::string path_;
+    HANDLE hFile_;
+    HANDLE hMapping_;
+    unsigned char* data_;
+    uint64_t capacity_;
+    size_t count_;
+    std::vector<bool> seen_; // By slot
+
+    bool map(const char* path, uint64_t capacity, bool create);
+    void unmap();
+    bool rebuild(uint64_t capacity, bool seenOnly);
+    unsigned char* slot(uint64_t index) const { return data_ + kHeaderSize + index * kSlotSize; }
+    // Slot holding key, or the empty slot where it would go
+    uint64_t probe(const Key& key) const;
+};
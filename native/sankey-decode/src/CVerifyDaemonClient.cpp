@@ -0,0 +1,179 @@
+﻿#include "CVerifyDaemonClient.h"
+#include "CVerifyDaemonProtocol.h"
+#include "CSankeyKeyContext.h"
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+// A healthy daemon answers in well under this; past it, verifying
+// in-process is the faster way to an answer. The reply timeout bounds the
+// whole verify, a retry on a fresh connection included.
+const DWORD kConnectTimeoutMillis = 50;
+const DWORD kReplyTimeoutMillis = 2000;
+
+DWORD millisLeft(std::chrono::steady_clock::time_point deadline) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    return left > 0 ? (DWORD)left : 0;
+}
+
+bool exchange(HANDLE hPipe, const std::vector<unsigned char>& request, std::vector<unsigned char>& reply,
+              std::chrono::steady_clock::time_point deadline) {
+    if (hPipe == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD left = millisLeft(deadline);
+    if (left == 0 || !CVerifyDaemonProtocol::writeMessage(hPipe, request, left)) {
+        return false;
+    }
+    left = millisLeft(deadline);
+    return left > 0 && CVerifyDaemonProtocol::readMessage(hPipe, reply, left);
+}
+
+} // namespace
+
+CVerifyDaemonClient::CVerifyDaemonClient() : hProv_(0) {
+    char pipeName[256];
+    DWORD len = GetEnvironmentVariableA("SANKEY_VERIFYD_PIPE", pipeName, sizeof(pipeName));
+    if (len > 0 && len < sizeof(pipeName)) {
+        pipeName_ = pipeName;
+    }
+    if (!CryptAcquireContext(&hProv_, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT)) {
+        hProv_ = 0;
+    }
+}
+
+CVerifyDaemonClient::~CVerifyDaemonClient() {
+    closeIdle();
+    if (hProv_) CryptReleaseContext(hProv_, 0);
+}
+
+CVerifyDaemonClient& CVerifyDaemonClient::instance() {
+    static CVerifyDaemonClient client;
+    return client;
+}
+
+void CVerifyDaemonClient::configure(const char* pipeName) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string name = pipeName ? pipeName : "";
+    if (name != pipeName_) {
+        closeIdle();
+        pipeName_ = name;
+    }
+}
+
+bool CVerifyDaemonClient::enabled() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !pipeName_.empty();
+}
+
+// Caller holds mutex_
+void CVerifyDaemonClient::closeIdle() {
+    for (HANDLE hPipe : idle_) {
+        CloseHandle(hPipe);
+    }
+    idle_.clear();
+}
+
+HANDLE CVerifyDaemonClient::connect(const std::string& pipeName, bool& pooled) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pipeName == pipeName_ && !idle_.empty()) {
+            HANDLE hPipe = idle_.back();
+            idle_.pop_back();
+            pooled = true;
+            return hPipe;
+        }
+    }
+
+    pooled = false;
+    HANDLE hPipe = CreateFileA(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    if (hPipe == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY &&
+        WaitNamedPipeA(pipeName.c_str(), kConnectTimeoutMillis)) {
+        hPipe = CreateFileA(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+    }
+    return hPipe;
+}
+
+// Only for connections whose last exchange completed, so the next read
+// starts at a message boundary
+void CVerifyDaemonClient::release(const std::string& pipeName, HANDLE hPipe) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pipeName == pipeName_ && idle_.size() < kMaxIdleConnections) {
+            idle_.push_back(hPipe);
+            return;
+        }
+    }
+    CloseHandle(hPipe);
+}
+
+bool CVerifyDaemonClient::verify(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen, const char* accountId,
+                                 VerifyOutcome& outcome) {
+    std::string pipeName;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pipeName = pipeName_;
+    }
+    if (pipeName.empty() || licenseLen > CVerifyDaemonProtocol::kMaxMessage / 2 || strlen(accountId) > 0xFFFF) {
+        return false;
+    }
+
+    VerifyDaemonRequest request;
+    if (!hProv_ || !CryptGenRandom(hProv_, sizeof(request.nonce), request.nonce)) {
+        return false;
+    }
+    memcpy(request.keyDigest, keyCtx.digest(), 32);
+    request.accountId = accountId;
+    request.license.assign(licenseB64, licenseLen);
+
+    std::vector<unsigned char> message;
+    std::vector<unsigned char> reply;
+    CVerifyDaemonProtocol::encodeRequest(request, message);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kReplyTimeoutMillis);
+    bool pooled = false;
+    HANDLE hPipe = connect(pipeName, pooled);
+    bool ok = exchange(hPipe, message, reply, deadline);
+    if (!ok && pooled && millisLeft(deadline) > 0) {
+        // A connection the daemon closed while idle fails at once, leaving
+        // the deadline for a retry; one that timed out leaves none. The rest
+        // of the pool is older than this one, so it goes too and the retry
+        // opens a fresh one
+        CloseHandle(hPipe);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closeIdle();
+        }
+        hPipe = connect(pipeName, pooled);
+        ok = exchange(hPipe, message, reply, deadline);
+    }
+
+    VerifyDaemonResponse response;
+    if (!ok || !CVerifyDaemonProtocol::decodeResponse(reply, response)) {
+        if (hPipe != INVALID_HANDLE_VALUE) CloseHandle(hPipe);
+        return false;
+    }
+    release(pipeName, hPipe);
+
+    // The daemon does not hold this key; verify locally
+    if (response.status == KeyError) {
+        return false;
+    }
+
+    unsigned char mac[32];
+    if (!CVerifyDaemonProtocol::responseMac(keyCtx, request, response.status, response.payload, mac) ||
+        memcmp(mac, response.mac, 32) != 0) {
+        return false;
+    }
+
+    outcome.status = static_cast<LicenseStatus>(response.status);
+    outcome.payload.reset();
+    if (outcome.status == Valid) {
+        try {
+            outcome.payload = std::make_shared<nlohmann::json>(nlohmann::json::from_msgpack(response.payload));
+        } catch (const nlohmann::json::exception& e) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,44 @@
+﻿#pragma once
+
+#include "CVerifySingleFlight.h"
+#include <windows.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class CSankeyKeyContext;
+
+// Client mode: forward verifies to a local sankey-verifyd over a named pipe.
+// Any failure (daemon not running, unknown key, timeout, bad MAC) returns
+// false and the caller verifies in-process instead.
+//
+// Connections are pooled: a verify takes an idle connection (or opens one)
+// and returns it after a complete exchange, so a burst of verifies pays for
+// one pipe open rather than one each. The daemon closes connections left
+// idle, so a failure on a pooled connection is retried once on a fresh one,
+// within the same reply deadline.
+class CVerifyDaemonClient {
+private:
+    static const size_t kMaxIdleConnections = 4;
+
+    std::mutex mutex_;
+    std::string pipeName_;     // Empty when client mode is off
+    std::vector<HANDLE> idle_; // Connected to pipeName_, most recently used last
+    HCRYPTPROV hProv_;         // Only for request nonces
+
+    CVerifyDaemonClient();
+    ~CVerifyDaemonClient();
+    HANDLE connect(const std::string& pipeName, bool& pooled);
+    void release(const std::string& pipeName, HANDLE hPipe);
+    void closeIdle();
+
+public:
+    static CVerifyDaemonClient& instance();
+
+    // nullptr or "" turns client mode off
+    void configure(const char* pipeName);
+    bool enabled();
+
+    bool verify(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen, const char* accountId,
+                VerifyOutcome& outcome);
+};
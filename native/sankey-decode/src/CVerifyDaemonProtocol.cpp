@@ -0,0 +1,141 @@
+﻿#include "CVerifyDaemonProtocol.h"
+#include "CSankeyKeyContext.h"
+#include <cstring>
+
+namespace {
+
+const char kRequestMagic[4] = { 'S', 'K', 'Q', '1' };
+const char kResponseMagic[4] = { 'S', 'K', 'R', '1' };
+const size_t kRequestHeader = 4 + 16 + 32 + 2 + 4;
+const size_t kResponseHeader = 4 + 4 + 4;
+
+void append(std::vector<unsigned char>& out, const void* data, size_t len) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    out.insert(out.end(), p, p + len);
+}
+
+// One overlapped transfer, cancelled if it does not complete in time
+bool transfer(HANDLE hPipe, void* data, DWORD len, bool writing, DWORD timeoutMillis) {
+    unsigned char* p = static_cast<unsigned char*>(data);
+    while (len > 0) {
+        OVERLAPPED overlapped;
+        ZeroMemory(&overlapped, sizeof(overlapped));
+        overlapped.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+        if (!overlapped.hEvent) {
+            return false;
+        }
+
+        DWORD done = 0;
+        BOOL ok = writing ? WriteFile(hPipe, p, len, NULL, &overlapped)
+                          : ReadFile(hPipe, p, len, NULL, &overlapped);
+        if (!ok && GetLastError() != ERROR_IO_PENDING) {
+            CloseHandle(overlapped.hEvent);
+            return false;
+        }
+        if (WaitForSingleObject(overlapped.hEvent, timeoutMillis) != WAIT_OBJECT_0) {
+            CancelIoEx(hPipe, &overlapped);
+        }
+        ok = GetOverlappedResult(hPipe, &overlapped, &done, TRUE);
+        CloseHandle(overlapped.hEvent);
+        if (!ok || done == 0) {
+            return false;
+        }
+        p += done;
+        len -= done;
+    }
+    return true;
+}
+
+} // namespace
+
+void CVerifyDaemonProtocol::encodeRequest(const VerifyDaemonRequest& request, std::vector<unsigned char>& out) {
+    uint16_t accountLen = (uint16_t)request.accountId.size();
+    uint32_t licenseLen = (uint32_t)request.license.size();
+    out.clear();
+    out.reserve(kRequestHeader + accountLen + licenseLen);
+    append(out, kRequestMagic, 4);
+    append(out, request.nonce, 16);
+    append(out, request.keyDigest, 32);
+    append(out, &accountLen, 2);
+    append(out, &licenseLen, 4);
+    append(out, request.accountId.data(), accountLen);
+    append(out, request.license.data(), licenseLen);
+}
+
+bool CVerifyDaemonProtocol::decodeRequest(const std::vector<unsigned char>& in, VerifyDaemonRequest& request) {
+    if (in.size() < kRequestHeader || memcmp(in.data(), kRequestMagic, 4) != 0) {
+        return false;
+    }
+    uint16_t accountLen = 0;
+    uint32_t licenseLen = 0;
+    memcpy(request.nonce, in.data() + 4, 16);
+    memcpy(request.keyDigest, in.data() + 20, 32);
+    memcpy(&accountLen, in.data() + 52, 2);
+    memcpy(&licenseLen, in.data() + 54, 4);
+    if (in.size() != kRequestHeader + accountLen + (size_t)licenseLen) {
+        return false;
+    }
+    const char* body = reinterpret_cast<const char*>(in.data() + kRequestHeader);
+    request.accountId.assign(body, accountLen);
+    request.license.assign(body + accountLen, licenseLen);
+    return true;
+}
+
+void CVerifyDaemonProtocol::encodeResponse(const VerifyDaemonResponse& response, std::vector<unsigned char>& out) {
+    uint32_t payloadLen = (uint32_t)response.payload.size();
+    out.clear();
+    out.reserve(kResponseHeader + payloadLen + 32);
+    append(out, kResponseMagic, 4);
+    append(out, &response.status, 4);
+    append(out, &payloadLen, 4);
+    append(out, response.payload.data(), payloadLen);
+    append(out, response.mac, 32);
+}
+
+bool CVerifyDaemonProtocol::decodeResponse(const std::vector<unsigned char>& in, VerifyDaemonResponse& response) {
+    if (in.size() < kResponseHeader + 32 || memcmp(in.data(), kResponseMagic, 4) != 0) {
+        return false;
+    }
+    uint32_t payloadLen = 0;
+    memcpy(&response.status, in.data() + 4, 4);
+    memcpy(&payloadLen, in.data() + 8, 4);
+    if (in.size() != kResponseHeader + (size_t)payloadLen + 32) {
+        return false;
+    }
+    response.payload.assign(in.begin() + kResponseHeader, in.begin() + kResponseHeader + payloadLen);
+    memcpy(response.mac, in.data() + kResponseHeader + payloadLen, 32);
+    return true;
+}
+
+bool CVerifyDaemonProtocol::responseMac(const CSankeyKeyContext& keyCtx, const VerifyDaemonRequest& request, int32_t status,
+                                        const std::vector<unsigned char>& payload, unsigned char mac[32]) {
+    HCRYPTHASH hHash = 0;
+    if (!keyCtx.createLocalHmac(hHash)) {
+        return false;
+    }
+    DWORD macLen = 32;
+    bool ok = CryptHashData(hHash, (const BYTE*)kResponseMagic, 4, 0) &&
+              CryptHashData(hHash, request.nonce, 16, 0) &&
+              CryptHashData(hHash, (const BYTE*)request.accountId.data(), (DWORD)request.accountId.size(), 0) &&
+              CryptHashData(hHash, (const BYTE*)request.license.data(), (DWORD)request.license.size(), 0) &&
+              CryptHashData(hHash, (const BYTE*)&status, 4, 0) &&
+              CryptHashData(hHash, payload.data(), (DWORD)payload.size(), 0) &&
+              CryptGetHashParam(hHash, HP_HASHVAL, mac, &macLen, 0) && macLen == 32;
+    CryptDestroyHash(hHash);
+    return ok;
+}
+
+bool CVerifyDaemonProtocol::writeMessage(HANDLE hPipe, const std::vector<unsigned char>& body, DWORD timeoutMillis) {
+    uint32_t len = (uint32_t)body.size();
+    return transfer(hPipe, &len, 4, true, timeoutMillis) &&
+           (len == 0 || transfer(hPipe, const_cast<unsigned char*>(body.data()), len, true, timeoutMillis));
+}
+
+bool CVerifyDaemonProtocol::readMessage(HANDLE hPipe, std::vector<unsigned char>& body, DWORD timeoutMillis) {
+    uint32_t len = 0;
+    if (!transfer(hPipe, &len, 4, false, timeoutMillis) || len > kMaxMessage) {
+        return false;
+    }
+    body.resize(len);
+    return len == 0 || transfer(hPipe, body.data(), len, false, timeoutMillis);
+}
@@ -0,0 +1,51 @@
+﻿#pragma once
+
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class CSankeyKeyContext;
+
+// Wire format between the DLL (client mode) and sankey-verifyd. Every
+// message is a u32 little-endian length followed by the body.
+//
+// Request:  "SKQ1" | nonce[16] | keyDigest[32] | accountLen u16 | licenseLen u32 | accountId | license
+// Response: "SKR1" | status i32 | payloadLen u32 | payload (MessagePack) | mac[32]
+//
+// The master key never crosses the pipe; the daemon is started with its
+// keys and looks them up by digest. The response MAC is HMAC-SHA256 under
+// the key context's local MAC key over
+//   "SKR1" | nonce | accountId | license | status | payload
+// so a process that does not hold the master key cannot answer for it.
+struct VerifyDaemonRequest {
+    unsigned char nonce[16];
+    unsigned char keyDigest[32];
+    std::string accountId;
+    std::string license;
+};
+
+struct VerifyDaemonResponse {
+    int32_t status;
+    std::vector<unsigned char> payload;
+    unsigned char mac[32];
+};
+
+class CVerifyDaemonProtocol {
+public:
+    static const char* defaultPipeName() { return "\\\\.\\pipe\\sankey-verifyd"; }
+    static const size_t kMaxMessage = 16 * 1024 * 1024;
+
+    static void encodeRequest(const VerifyDaemonRequest& request, std::vector<unsigned char>& out);
+    static bool decodeRequest(const std::vector<unsigned char>& in, VerifyDaemonRequest& request);
+    static void encodeResponse(const VerifyDaemonResponse& response, std::vector<unsigned char>& out);
+    static bool decodeResponse(const std::vector<unsigned char>& in, VerifyDaemonResponse& response);
+
+    static bool responseMac(const CSankeyKeyContext& keyCtx, const VerifyDaemonRequest& request, int32_t status,
+                            const std::vector<unsigned char>& payload, unsigned char mac[32]);
+
+    // Length-prefixed framing over an overlapped pipe handle. timeoutMillis
+    // bounds each call; INFINITE waits as long as the peer is connected.
+    static bool writeMessage(HANDLE hPipe, const std::vector<unsigned char>& body, DWORD timeoutMillis);
+    static bool readMessage(HANDLE hPipe, std::vector<unsigned char>& body, DWORD timeoutMillis);
+};
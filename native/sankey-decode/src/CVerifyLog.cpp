@@ -0,0 +1,68 @@
+﻿#include "CVerifyLog.h"
+
+CVerifyLog::CVerifyLog(size_t size) : size_(size), head_(0), slots_(new Slot[size]) {
+    for (size_t i = 0; i < size_; ++i) {
+        slots_[i].seq.store(0);
+    }
+}
+
+CVerifyLog& CVerifyLog::process() {
+    static CVerifyLog log(kProcessSize);
+    return log;
+}
+
+void CVerifyLog::record(const VerifyRecord& record) {
+    uint64_t n = head_.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots_[n % size_];
+
+    // Two writers only meet on a slot when one laps the other mid-write;
+    // the loser's record is dropped rather than interleaved
+    uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+    if ((seq & 1) || seq > 2 * n || !slot.seq.compare_exchange_strong(seq, 2 * n + 1, std::memory_order_relaxed)) {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.time.store(record.time, std::memory_order_relaxed);
+    slot.durationUs.store(record.durationUs, std::memory_order_relaxed);
+    slot.licenseLen.store(record.licenseLen, std::memory_order_relaxed);
+    slot.payloadLen.store(record.payloadLen, std::memory_order_relaxed);
+    slot.reasonArg.store(record.reasonArg, std::memory_order_relaxed);
+    slot.status.store(record.status, std::memory_order_relaxed);
+    slot.reason.store(record.reason, std::memory_order_relaxed);
+    slot.source.store(record.source, std::memory_order_relaxed);
+    slot.threadId.store(record.threadId, std::memory_order_relaxed);
+    slot.seq.store(2 * n + 2, std::memory_order_release);
+}
+
+int CVerifyLog::read(VerifyRecord* records, int capacity) const {
+    if (!records || capacity <= 0) {
+        return 0;
+    }
+
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t first = head > size_ ? head - size_ : 0;
+    if (head - first > (uint64_t)capacity) {
+        first = head - capacity;
+    }
+
+    int count = 0;
+    for (uint64_t n = first; n < head; ++n) {
+        const Slot& slot = slots_[n % size_];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        VerifyRecord& out = records[count];
+        out.time = slot.time.load(std::memory_order_relaxed);
+        out.durationUs = slot.durationUs.load(std::memory_order_relaxed);
+        out.licenseLen = slot.licenseLen.load(std::memory_order_relaxed);
+        out.payloadLen = slot.payloadLen.load(std::memory_order_relaxed);
+        out.reasonArg = slot.reasonArg.load(std::memory_order_relaxed);
+        out.status = slot.status.load(std::memory_order_relaxed);
+        out.reason = slot.reason.load(std::memory_order_relaxed);
+        out.source = slot.source.load(std::memory_order_relaxed);
+        out.threadId = slot.threadId.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seq == 2 * n + 2 && slot.seq.load(std::memory_order_relaxed) == seq) {
+            ++count; // Otherwise still being written or overwritten since head was read
+        }
+    }
+    return count;
+}
@@ -0,0 +1,43 @@
+﻿#pragma once
+
+#include "SankeyDecoder.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Fixed-size ring of recent verify records. Any thread may record without a
+// lock and read() runs alongside verifies: slots carry a sequence number,
+// and a record still being written, or overwritten while read, is skipped.
+class CVerifyLog {
+public:
+    static const size_t kDecoderSize = 64;
+    static const size_t kProcessSize = 1024;
+
+    explicit CVerifyLog(size_t size);
+
+    // Every decoder's verifies, for support tooling that has no decoder handle
+    static CVerifyLog& process();
+
+    void record(const VerifyRecord& record);
+
+    // Copies up to capacity of the most recent records, oldest first; returns the count
+    int read(VerifyRecord* records, int capacity) const;
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq; // 2n+1 while record n is written, 2n+2 once complete
+        std::atomic<long long> time;
+        std::atomic<long long> durationUs;
+        std::atomic<long long> licenseLen;
+        std::atomic<long long> payloadLen;
+        std::atomic<long long> reasonArg;
+        std::atomic<int> status;
+        std::atomic<int> reason;
+        std::atomic<int> source;
+        std::atomic<int> threadId;
+    };
+
+    size_t size_;
+    std::atomic<uint64_t> head_; // Records ever claimed
+    std::unique_ptr<Slot[]> slots_;
+};
@@ -0,0 +1,52 @@
+﻿#include "CVerifySingleFlight.h"
+
+CVerifySingleFlight::CVerifySingleFlight() : executed_(0), coalesced_(0) {
+}
+
+CVerifySingleFlight& CVerifySingleFlight::instance() {
+    static CVerifySingleFlight group;
+    return group;
+}
+
+VerifyOutcome CVerifySingleFlight::run(const std::string& key, const std::function<VerifyOutcome()>& verify) {
+    std::promise<VerifyOutcome> promise;
+    std::shared_future<VerifyOutcome> pending;
+    bool leader = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = inFlight_.find(key);
+        if (it != inFlight_.end()) {
+            pending = it->second;
+        } else {
+            pending = promise.get_future().share();
+            inFlight_.emplace(key, pending);
+            leader = true;
+        }
+    }
+
+    if (!leader) {
+        coalesced_.fetch_add(1);
+        VerifyOutcome outcome = pending.get();
+        outcome.source = SourceCoalesced;
+        return outcome;
+    }
+
+    executed_.fetch_add(1);
+    VerifyOutcome outcome;
+    try {
+        outcome = verify();
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+        std::lock_guard<std::mutex> lock(mutex_);
+        inFlight_.erase(key);
+        throw;
+    }
+
+    // Later callers start a fresh verify rather than reuse this outcome
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        inFlight_.erase(key);
+    }
+    promise.set_value(outcome);
+    return outcome;
+}
@@ -0,0 +1,40 @@
+﻿#pragma once
+
+#include "SankeyDecoder.h"
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Outcome of one verify, shareable between decoders: the payload is immutable.
+struct VerifyOutcome {
+    LicenseStatus status;
+    std::shared_ptr<const nlohmann::json> payload;
+    VerifyReason reason = ReasonNone; // Diagnostics, see VerifyRecord
+    long long reasonArg = 0;
+    size_t payloadLen = 0;
+    VerifySource source = SourceInProcess;
+};
+
+// Process-wide request coalescing for identical verifies. MT5 runs every EA
+// of a terminal in one process, and after a reconnect they all verify the
+// same (key, license, account) at once; the first caller computes and the
+// rest wait for and share its outcome.
+class CVerifySingleFlight {
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_future<VerifyOutcome>> inFlight_;
+    std::atomic<long long> executed_;
+    std::atomic<long long> coalesced_;
+
+    CVerifySingleFlight();
+
+public:
+    static CVerifySingleFlight& instance();
+
+    VerifyOutcome run(const std::string& key, const std::function<VerifyOutcome()>& verify);
+
+    long long executed() const { return executed_.load(); }
+    long long coalesced() const { return coalesced_.load(); }
+};
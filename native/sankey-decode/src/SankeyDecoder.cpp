@@ -1,97 +1,377 @@
 ﻿#include "SankeyDecoder.h"
+#include "CSankeyKeyContext.h"
+#include "CLicenseFileView.h"
+#include "CLicenseBundle.h"
+#include "CLicenseFileWatcher.h"
+#include "CLicenseTicket.h"
+#include "CVerifySingleFlight.h"
+#include "CVerifyDaemonClient.h"
+#include "CKeyContextCache.h"
+#include "CSankeyKeyring.h"
+#include "CPayloadShapeCache.h"
+#include "CSankeySchema.h"
+#include "CTraceRecorder.h"
+#include "CSankeyEtw.h"
+#include "CVerifyLog.h"
+#include "CKernelDispatch.h"
+#include "CJsonString.h"
 #include <windows.h>
 #include <wincrypt.h>
 #include <vector>
+#include <memory>
 #include <cstring>
 #include <ctime>
 #include <sstream>
 #include <iomanip>
+#include <thread>
+#include <algorithm>
+#include <mutex>
 
-CSankeyLicenseDecoder::CSankeyLicenseDecoder() : isVerified_(false) {
+namespace {
+
+// Warmup self-verify: {"warmup":true,"expiry":"2037-12-31T00:00:00Z"} for
+// account "warmup" under the all-zero key, which guards nothing. The expiry
+// stays below 2038-01-19 so it fits the 32-bit long of getValueAsDateTime on Windows
+const char kWarmupKey[] = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA=";
+const char kWarmupLicense[] = "z70C0eu7tTlJjLehk5nUE7VlH9JZ5jYt64iNjpksRpADunmtzmEWhCi9/LZnU52V"
+                              "2C4zb/vj9gyRNPdm7W/2r6+/Mu68tnWc0/pajVQjhwoFa6tZLdsKVW/BUUNQ2eHv";
+const char kWarmupAccount[] = "warmup";
+
+std::atomic<unsigned>& decryptThreads() {
+    static std::atomic<unsigned> threads(0);
+    return threads;
+}
+
+DWORD WINAPI warmupThread(LPVOID module) {
+    CSankeyLicenseDecoder::warmup();
+    FreeLibraryAndExitThread(static_cast<HMODULE>(module), 0);
+    return 0;
+}
+
+} // namespace
+
+CSankeyLicenseDecoder::CSankeyLicenseDecoder()
+    : generation_(0), log_(new CVerifyLog(CVerifyLog::kDecoderSize)) {
+    CSankeyEtw::registerProvider();
 }
 
 CSankeyLicenseDecoder::~CSankeyLicenseDecoder() {
+    stopWatch();
 }
 
-// Utility: Base64 decode
-bool CSankeyLicenseDecoder::base64_decode(const std::string& in, std::vector<unsigned char>& out) {
-    DWORD len = 0;
-    if (!CryptStringToBinaryA(in.c_str(), 0, CRYPT_STRING_BASE64, NULL, &len, NULL, NULL))
+// Utility: Base64 decode (input need not be NUL-terminated)
+bool CSankeyLicenseDecoder::base64_decode(const char* in, size_t len, std::vector<unsigned char>& out) {
+    if (len == 0 || len > MAXDWORD) {
+        return false;
+    }
+    DWORD outLen = 0;
+    if (!CryptStringToBinaryA(in, (DWORD)len, CRYPT_STRING_BASE64, NULL, &outLen, NULL, NULL))
         return false;
-    out.resize(len);
-    return CryptStringToBinaryA(in.c_str(), 0, CRYPT_STRING_BASE64, out.data(), &len, NULL, NULL) != 0;
+    out.resize(outLen);
+    if (!CryptStringToBinaryA(in, (DWORD)len, CRYPT_STRING_BASE64, out.data(), &outLen, NULL, NULL))
+        return false;
+    out.resize(outLen);
+    return true;
 }
 
-// Utility: HMAC-SHA256
-bool CSankeyLicenseDecoder::hmac_sha256(const std::vector<unsigned char>& key, const std::vector<unsigned char>& data, std::vector<unsigned char>& mac) {
-    HCRYPTPROV hProv = 0;
+// Why base64_decode rejected its input; only called once it has. Whitespace
+// is skipped as CryptStringToBinary does, offsets count every character.
+VerifyReason CSankeyLicenseDecoder::base64Fault(const char* in, size_t len, long long& arg) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t chars = 0;
+    size_t padAt = 0;
+    size_t pads = 0;
+    for (size_t i = 0; i < len; ++i) {
+        char c = in[i];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            continue;
+        }
+        ++chars;
+        if (c == '=') {
+            if (pads++ == 0) padAt = i;
+        } else if (c == '\0' || !strchr(alphabet, c)) {
+            arg = (long long)i;
+            return ReasonBase64Character;
+        } else if (pads) {
+            arg = (long long)padAt;
+            return ReasonBase64Padding;
+        }
+    }
+    if (pads > 2) {
+        arg = (long long)padAt;
+        return ReasonBase64Padding;
+    }
+    arg = (long long)chars;
+    return ReasonBase64Length;
+}
+
+// The license MAC is HMAC-SHA256 over header || iv || cipher || accountId,
+// streamed without concatenating (header: none for v1, keyId for v2; fleet
+// licenses MAC their header with an empty accountId). Everything but the
+// accountId suffix is hashed by hmacBody, so identifyAccount can clone that
+// state per candidate.
+static bool hmacStart(const CSankeyKeyContext& keyCtx, const unsigned char* header, size_t headerLen, const unsigned char* iv,
+                      HCRYPTHASH& hHash) {
+    if (!keyCtx.createHmac(hHash)) return false;
+
+    bool ok = (!headerLen || CryptHashData(hHash, header, (DWORD)headerLen, 0)) &&
+              CryptHashData(hHash, iv, 16, 0);
+    if (!ok) {
+        CryptDestroyHash(hHash);
+        hHash = 0;
+    }
+    return ok;
+}
+
+static bool hmacBody(const CSankeyKeyContext& keyCtx, const unsigned char* header, size_t headerLen, const unsigned char* iv,
+                     const unsigned char* cipher, size_t cipherLen, HCRYPTHASH& hHash) {
+    if (!hmacStart(keyCtx, header, headerLen, iv, hHash)) return false;
+
+    if (!CryptHashData(hHash, cipher, (DWORD)cipherLen, 0)) {
+        CryptDestroyHash(hHash);
+        hHash = 0;
+        return false;
+    }
+    return true;
+}
+
+// Consumes hHash
+static bool hmacFinish(HCRYPTHASH hHash, const char* accountId, unsigned char mac[32]) {
+    bool ok = CryptHashData(hHash, (const BYTE*)accountId, (DWORD)strlen(accountId), 0) != 0;
+    if (ok) {
+        DWORD macLen = 32;
+        ok = CryptGetHashParam(hHash, HP_HASHVAL, mac, &macLen, 0) && macLen == 32;
+    }
+    CryptDestroyHash(hHash);
+    return ok;
+}
+
+bool CSankeyLicenseDecoder::hmac_sha256(const CSankeyKeyContext& keyCtx, const LicenseEnvelope& envelope, const char* accountId,
+                                        unsigned char mac[32]) {
     HCRYPTHASH hHash = 0;
+    return hmacBody(keyCtx, envelope.header, envelope.headerLen, envelope.iv, envelope.cipher, envelope.cipherLen, hHash) &&
+           hmacFinish(hHash, accountId, mac);
+}
+
+// Utility: key id of a v2 or fleet envelope, both "<prefix>:" + Base64(keyId || ...).
+// Decodes only the first Base64 quantum groups; false for v1 licenses.
+bool CSankeyLicenseDecoder::envelopeKeyId(const char* licenseB64, size_t licenseLen, unsigned char keyId[8]) {
+    const size_t prefixLen = 3;
+    const size_t idChars = 12; // 9 bytes, covers the 8-byte key id
+    if (licenseLen < prefixLen + idChars ||
+        (memcmp(licenseB64, "v2:", prefixLen) != 0 && memcmp(licenseB64, "f1:", prefixLen) != 0)) {
+        return false;
+    }
+
+    std::vector<unsigned char> head;
+    if (!base64_decode(licenseB64 + prefixLen, idChars, head) || head.size() < CSankeyKeyContext::kKeyIdLen) {
+        return false;
+    }
+    memcpy(keyId, head.data(), CSankeyKeyContext::kKeyIdLen);
+    return true;
+}
+
+// HMAC tag of any envelope kind, decoding only the Base64 that covers it.
+// The tag is MAC'd over everything it vouches for, so it identifies the
+// license without the rest of the text; false if the license is too short
+// or malformed up to the tag
+bool CSankeyLicenseDecoder::envelopeTag(const char* licenseB64, size_t licenseLen, unsigned char tag[32]) {
+    size_t headerLen = 0;
+    if (licenseLen >= 3 && memcmp(licenseB64, "v2:", 3) == 0) {
+        headerLen = CSankeyKeyContext::kKeyIdLen;
+    } else if (licenseLen >= 3 && memcmp(licenseB64, "f1:", 3) == 0) {
+        headerLen = CSankeyKeyContext::kKeyIdLen + 32 + 4;
+    }
+    if (headerLen > 0) {
+        licenseB64 += 3;
+        licenseLen -= 3;
+    }
+
+    // header || iv || hmac, rounded up to whole Base64 quads
+    size_t headChars = (headerLen + 48 + 2) / 3 * 4;
+    std::vector<unsigned char> head;
+    if (licenseLen < headChars || !base64_decode(licenseB64, headChars, head) || head.size() < headerLen + 48) {
+        return false;
+    }
+    memcpy(tag, head.data() + headerLen + 16, 32);
+    return true;
+}
+
+// Fused MAC check and AES-CBC decrypt, in place. The ciphertext is walked in
+// L1-sized blocks; each block is fed to the HMAC and then decrypted while it
+// is still in cache, so a large license is read from memory once. The final
+// block stays encrypted until the tag matches (its padding is the first
+// thing that depends on plaintext), and on a mismatch the blocks already
+// decrypted are wiped. plainLen is the unpadded size on Valid.
+LicenseStatus CSankeyLicenseDecoder::authDecrypt(const CSankeyKeyContext& keyCtx, LicenseEnvelope& envelope, const char* macAccountId,
+                                                 size_t& plainLen) {
+    static const size_t kBlock = 16 * 1024; // Multiple of the AES block size
+    static const size_t kParallelThreshold = 1024 * 1024;
+
+    unsigned char* data = envelope.cipher;
+    size_t len = envelope.cipherLen;
+    size_t tail = len == 0 ? 0 : (len - 1) % kBlock + 1;
+    size_t bulk = len - tail;
+
+    unsigned threads = decryptThreads().load();
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (bulk >= kParallelThreshold && threads > 1) {
+        return authDecryptParallel(keyCtx, envelope, macAccountId, bulk, threads, plainLen);
+    }
+
+    CTraceSpan span("hmac+decrypt");
+    envelope.reason = ReasonCryptoFailure;
     HCRYPTKEY hKey = 0;
+    if (!keyCtx.duplicateAesKey(hKey)) {
+        envelope.reasonArg = GetLastError();
+        return DecryptionFailed;
+    }
+    HCRYPTHASH hHash = 0;
+    if (!CryptSetKeyParam(hKey, KP_IV, envelope.iv, 0) ||
+        !hmacStart(keyCtx, envelope.header, envelope.headerLen, envelope.iv, hHash)) {
+        envelope.reasonArg = GetLastError();
+        CryptDestroyKey(hKey);
+        return DecryptionFailed;
+    }
 
-    struct {
-        BLOBHEADER hdr;
-        DWORD keyLen;
-    } blobHeader = {
-        {PLAINTEXTKEYBLOB, CUR_BLOB_VERSION, 0, CALG_RC2},
-        (DWORD)key.size()
-    };
+    bool ok = true;
+    for (size_t done = 0; ok && done < bulk; done += kBlock) {
+        DWORD n = (DWORD)kBlock;
+        ok = CryptHashData(hHash, data + done, n, 0) && CryptDecrypt(hKey, 0, FALSE, 0, data + done, &n);
+    }
+    if (ok && tail) {
+        ok = CryptHashData(hHash, data + bulk, (DWORD)tail, 0) != 0;
+    }
+
+    unsigned char mac[32];
+    if (ok) {
+        ok = hmacFinish(hHash, macAccountId, mac);
+    } else {
+        CryptDestroyHash(hHash);
+    }
 
-    std::vector<unsigned char> blob(sizeof(blobHeader) + key.size());
-    memcpy(blob.data(), &blobHeader, sizeof(blobHeader));
-    memcpy(blob.data() + sizeof(blobHeader), key.data(), key.size());
-
-    mac.resize(32);
-
-    if (!CryptAcquireContext(&hProv, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT)) return false;
-    bool ok = false;
-    if (CryptImportKey(hProv, blob.data(), blob.size(), 0, CRYPT_IPSEC_HMAC_KEY, &hKey)) {
-        if (CryptCreateHash(hProv, CALG_HMAC, hKey, 0, &hHash)) {
-            HMAC_INFO hmacInfo;
-            ZeroMemory(&hmacInfo, sizeof(hmacInfo));
-            hmacInfo.HashAlgid = CALG_SHA_256;
-            CryptSetHashParam(hHash, HP_HMAC_INFO, (BYTE*)&hmacInfo, 0);
-            CryptHashData(hHash, data.data(), data.size(), 0);
-            DWORD macLen = 32;
-            if (CryptGetHashParam(hHash, HP_HASHVAL, mac.data(), &macLen, 0)) ok = true;
-            CryptDestroyHash(hHash);
+    LicenseStatus status = Valid;
+    if (!ok) {
+        status = DecryptionFailed;
+        envelope.reasonArg = GetLastError();
+    } else if (memcmp(mac, envelope.hmac, 32) != 0) {
+        status = Tampered;
+        envelope.reason = ReasonTagMismatch;
+    } else {
+        DWORD n = (DWORD)tail;
+        if (CryptDecrypt(hKey, 0, TRUE, 0, data + bulk, &n)) {
+            plainLen = bulk + n;
+            envelope.reason = ReasonNone;
+        } else {
+            status = DecryptionFailed;
+            envelope.reason = ReasonCipherPadding;
+            envelope.reasonArg = GetLastError();
         }
-        CryptDestroyKey(hKey);
     }
-    CryptReleaseContext(hProv, 0);
-    return ok;
+    CryptDestroyKey(hKey);
+
+    if (status != Valid) {
+        SecureZeroMemory(data, bulk);
+    }
+    return status;
 }
 
-// Utility: AES-CBC decrypt
-bool CSankeyLicenseDecoder::aes_cbc_decrypt(const std::vector<unsigned char>& key, const std::vector<unsigned char>& iv,
-                     const std::vector<unsigned char>& cipher, std::vector<unsigned char>& plain) {
-    HCRYPTPROV hProv = 0;
-    HCRYPTKEY hKey = 0;
+// authDecrypt for multi-megabyte licenses. CBC decryption of a block only
+// needs the previous ciphertext block, so the bulk is split into ranges that
+// worker threads decrypt (each keyed with the ciphertext block before its
+// range as IV) while this thread runs the HMAC over the untouched
+// ciphertext. Workers write to a quarantine buffer that is copied over the
+// ciphertext only once the tag matches, and wiped either way; the tail is
+// handled as in authDecrypt.
+LicenseStatus CSankeyLicenseDecoder::authDecryptParallel(const CSankeyKeyContext& keyCtx, LicenseEnvelope& envelope,
+                                                         const char* macAccountId, size_t bulk, unsigned threads,
+                                                         size_t& plainLen) {
+    static const size_t kMinRange = 256 * 1024; // Multiple of the AES block size
 
-    struct {
-        BLOBHEADER hdr;
-        DWORD keyLen;
-    } blobHeader = {
-        {PLAINTEXTKEYBLOB, CUR_BLOB_VERSION, 0, CALG_AES_256},
-        (DWORD)key.size()
-    };
-    std::vector<unsigned char> blob(sizeof(blobHeader) + key.size());
-    memcpy(blob.data(), &blobHeader, sizeof(blobHeader));
-    memcpy(blob.data() + sizeof(blobHeader), key.data(), key.size());
-
-    bool ok = false;
-    if (!CryptAcquireContext(&hProv, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT)) return false;
-    if (CryptImportKey(hProv, blob.data(), blob.size(), 0, 0, &hKey)) {
-        CryptSetKeyParam(hKey, KP_IV, iv.data(), 0);
-        plain = cipher;
-        DWORD plen = (DWORD)plain.size();
-        if (CryptDecrypt(hKey, 0, TRUE, 0, plain.data(), &plen)) {
-            plain.resize(plen);
-            ok = true;
+    unsigned char* data = envelope.cipher;
+    size_t tail = envelope.cipherLen - bulk;
+
+    // Keys are duplicated up front; CryptDuplicateKey on one source key is not
+    // something to race from several threads
+    size_t ranges = std::min<size_t>(threads - 1, bulk / kMinRange);
+    ranges = std::max<size_t>(ranges, 1);
+    // Rounded up twice (division, then block size) so the ranges cover the
+    // whole bulk; that can leave fewer, and a short last one
+    size_t rangeLen = ((bulk + ranges - 1) / ranges + 15) & ~(size_t)15;
+    ranges = (bulk + rangeLen - 1) / rangeLen;
+    std::vector<HCRYPTKEY> keys(ranges + 1, 0);
+    bool ok = true;
+    for (size_t i = 0; ok && i < keys.size(); ++i) {
+        // keys[ranges] is for the tail, chained from the last bulk block
+        const unsigned char* iv = i == 0 ? envelope.iv : i == ranges ? data + bulk - 16 : data + i * rangeLen - 16;
+        ok = keyCtx.duplicateAesKey(keys[i]) && CryptSetKeyParam(keys[i], KP_IV, iv, 0);
+    }
+    HCRYPTHASH hHash = 0;
+    ok = ok && hmacStart(keyCtx, envelope.header, envelope.headerLen, envelope.iv, hHash);
+    if (!ok) {
+        envelope.reason = ReasonCryptoFailure;
+        envelope.reasonArg = GetLastError();
+        for (HCRYPTKEY hKey : keys) {
+            if (hKey) CryptDestroyKey(hKey);
+        }
+        return DecryptionFailed;
+    }
+
+    std::vector<unsigned char> quarantine(bulk);
+    std::vector<char> decrypted(ranges, 0);
+    std::vector<std::thread> workers;
+    workers.reserve(ranges);
+    for (size_t i = 0; i < ranges; ++i) {
+        size_t begin = i * rangeLen;
+        size_t end = std::min(begin + rangeLen, bulk);
+        workers.emplace_back([&, i, begin, end] {
+            CTraceSpan span("decrypt");
+            memcpy(quarantine.data() + begin, data + begin, end - begin);
+            DWORD n = (DWORD)(end - begin);
+            decrypted[i] = CryptDecrypt(keys[i], 0, FALSE, 0, quarantine.data() + begin, &n) != 0;
+        });
+    }
+
+    CTraceSpan hmacSpan("hmac");
+    bool hashed = CryptHashData(hHash, data, (DWORD)envelope.cipherLen, 0) != 0;
+    unsigned char mac[32];
+    if (hashed) {
+        hashed = hmacFinish(hHash, macAccountId, mac);
+    } else {
+        CryptDestroyHash(hHash);
+    }
+    hmacSpan.end();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    ok = hashed && std::find(decrypted.begin(), decrypted.end(), 0) == decrypted.end();
+
+    LicenseStatus status = Valid;
+    if (!ok) {
+        status = DecryptionFailed;
+        envelope.reason = ReasonCryptoFailure; // Error codes stay on the failing thread
+    } else if (memcmp(mac, envelope.hmac, 32) != 0) {
+        status = Tampered;
+        envelope.reason = ReasonTagMismatch;
+    } else {
+        // keys[ranges] was keyed with the last bulk ciphertext block
+        DWORD n = (DWORD)tail;
+        if (CryptDecrypt(keys[ranges], 0, TRUE, 0, data + bulk, &n)) {
+            memcpy(data, quarantine.data(), bulk);
+            plainLen = bulk + n;
+        } else {
+            status = DecryptionFailed;
+            envelope.reason = ReasonCipherPadding;
+            envelope.reasonArg = GetLastError();
         }
+    }
+    for (HCRYPTKEY hKey : keys) {
         CryptDestroyKey(hKey);
     }
-    CryptReleaseContext(hProv, 0);
-    return ok;
+    SecureZeroMemory(quarantine.data(), bulk);
+    return status;
 }
 
 // Parse ISO 8601 date string to UNIX timestamp
@@ -112,185 +392,896 @@ long CSankeyLicenseDecoder::parseISODateTime(const std::string& isoString) {
     return static_cast<long>(timestamp);
 }
 
-LicenseStatus CSankeyLicenseDecoder::verify(const char* masterKeyB64, const char* licenseB64, const char* accountId) {
-    isVerified_ = false;
-    payload_.clear();
+// With a schema set, its properties are resolved into typed slots here, once
+// per payload, instead of on every getter call
+void CSankeyLicenseDecoder::publish(std::shared_ptr<const nlohmann::json> payload) {
+    if (!payload) {
+        std::atomic_store(&payload_, std::shared_ptr<const PayloadSnapshot>());
+        return;
+    }
+
+    std::shared_ptr<PayloadSnapshot> snapshot = std::make_shared<PayloadSnapshot>();
+    snapshot->schema = std::atomic_load(&schema_);
+    if (snapshot->schema && payload->is_object()) {
+        const CSankeySchema& schema = *snapshot->schema;
+        snapshot->slots.resize(schema.propertyCount());
+        for (size_t i = 0; i < snapshot->slots.size(); ++i) {
+            // Typed from the value itself, so a slot is right even for a
+            // schema that was swapped in after this payload was checked
+            PayloadSlot& slot = snapshot->slots[i];
+            slot = {PayloadSlot::Absent, false, 0, 0.0, nullptr};
+            auto it = payload->find(schema.propertyName(i));
+            if (it == payload->end()) {
+                continue;
+            }
+            if (it->is_string()) {
+                slot.kind = PayloadSlot::String;
+                slot.string = &it->get_ref<const std::string&>();
+            } else if (it->is_number_integer()) {
+                slot.kind = PayloadSlot::Integer;
+                slot.integer = it->get<int64_t>();
+                slot.number = it->get<double>();
+            } else if (it->is_number()) {
+                slot.kind = PayloadSlot::Number;
+                slot.number = it->get<double>();
+            } else if (it->is_boolean()) {
+                slot.kind = PayloadSlot::Boolean;
+                slot.boolean = it->get<bool>();
+            } else {
+                slot.kind = PayloadSlot::Other;
+            }
+        }
+    } else {
+        snapshot->schema.reset();
+    }
+    snapshot->payload = std::move(payload);
 
+    std::atomic_store(&payload_, std::shared_ptr<const PayloadSnapshot>(std::move(snapshot)));
+    generation_.fetch_add(1);
+}
+
+std::shared_ptr<const CSankeyLicenseDecoder::PayloadSnapshot> CSankeyLicenseDecoder::currentPayload() const {
+    return std::atomic_load(&payload_);
+}
+
+const CSankeyLicenseDecoder::PayloadSlot* CSankeyLicenseDecoder::PayloadSnapshot::slot(const char* key) const {
+    if (!schema) {
+        return nullptr;
+    }
+    int ordinal = schema->ordinal(key);
+    return ordinal < 0 ? nullptr : &slots[ordinal];
+}
+
+void CSankeyLicenseDecoder::logVerify(const VerifyOutcome& outcome, size_t licenseLen, std::chrono::steady_clock::time_point started) {
+    VerifyRecord record;
+    record.time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    record.durationUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+    record.licenseLen = (long long)licenseLen;
+    record.payloadLen = (long long)outcome.payloadLen;
+    record.reasonArg = outcome.reasonArg;
+    record.status = outcome.status;
+    record.reason = outcome.reason;
+    record.source = outcome.source;
+    record.threadId = (int)GetCurrentThreadId();
+    log_->record(record);
+    CVerifyLog::process().record(record);
+}
+
+void CSankeyLicenseDecoder::logRejected(LicenseStatus status, VerifyReason reason) {
+    VerifyOutcome outcome;
+    outcome.status = status;
+    outcome.reason = reason;
+    logVerify(outcome, 0, std::chrono::steady_clock::now());
+}
+
+int CSankeyLicenseDecoder::readDiagnostics(VerifyRecord* records, int capacity) const {
+    return log_->read(records, capacity);
+}
+
+long CSankeyLicenseDecoder::payloadExpiry(const nlohmann::json& payload) {
+    if (payload.contains("expiry") && payload["expiry"].is_string()) {
+        std::string expiryStr = payload["expiry"];
+        return parseISODateTime(expiryStr);
+    }
+    return 0;
+}
+
+LicenseStatus CSankeyLicenseDecoder::verify(const char* masterKeyB64, const char* licenseB64, const char* accountId) {
     if (!masterKeyB64 || !licenseB64 || !accountId) {
+        logRejected(Invalid, ReasonNullArgument);
+        publish(nullptr);
         return Invalid;
     }
 
-    // Decode master key
-    std::vector<unsigned char> masterKey;
-    if (!base64_decode(masterKeyB64, masterKey)) {
+    // Decoded key contexts are cached per key; keyCtx pins ours meanwhile
+    std::shared_ptr<const CSankeyKeyContext> keyCtx = CKeyContextCache::instance().acquire(masterKeyB64);
+    if (!keyCtx) {
+        logRejected(KeyError, ReasonKeyInvalid);
+        publish(nullptr);
         return KeyError;
     }
-    if (masterKey.size() != 32) {
-        return KeyError;
+
+    return verify(*keyCtx, licenseB64, strlen(licenseB64), accountId);
+}
+
+LicenseStatus CSankeyLicenseDecoder::verify(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen, const char* accountId) {
+    std::shared_ptr<const nlohmann::json> payload;
+    LicenseStatus status = decode(keyCtx, licenseB64, licenseLen, accountId, payload);
+    publish(status == Valid ? payload : nullptr);
+    return status;
+}
+
+LicenseStatus CSankeyLicenseDecoder::verify(const CSankeyKeyring& keyring, const char* licenseB64, size_t licenseLen, const char* accountId) {
+    std::shared_ptr<const nlohmann::json> payload;
+    LicenseStatus status = KeyError;
+
+    unsigned char keyId[CSankeyKeyContext::kKeyIdLen];
+    if (envelopeKeyId(licenseB64, licenseLen, keyId)) {
+        // The envelope names its key: one lookup, at most one HMAC
+        std::shared_ptr<const CSankeyKeyContext> keyCtx = keyring.find(keyId);
+        if (keyCtx) {
+            status = decode(*keyCtx, licenseB64, licenseLen, accountId, payload);
+        } else {
+            logRejected(KeyError, ReasonKeyNotLoaded);
+        }
+    } else {
+        // v1 carries no key id; only a MAC mismatch means "try the next key"
+        std::vector<std::shared_ptr<const CSankeyKeyContext>> keys = keyring.keys();
+        for (const std::shared_ptr<const CSankeyKeyContext>& keyCtx : keys) {
+            status = decode(*keyCtx, licenseB64, licenseLen, accountId, payload);
+            if (status != Tampered) {
+                break;
+            }
+        }
+        if (keys.empty()) {
+            logRejected(KeyError, ReasonKeyNotLoaded);
+        }
+    }
+
+    publish(status == Valid ? payload : nullptr);
+    return status;
+}
+
+LicenseStatus CSankeyLicenseDecoder::verifyProjected(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen,
+                                                     const char* accountId, const std::vector<std::string>& projection) {
+    std::shared_ptr<const nlohmann::json> payload;
+    LicenseStatus status = decode(keyCtx, licenseB64, licenseLen, accountId, payload, &projection);
+    publish(status == Valid ? payload : nullptr);
+    return status;
+}
+
+LicenseStatus CSankeyLicenseDecoder::verifyFile(const CSankeyKeyContext& keyCtx, const char* licensePath, const char* accountId) {
+    std::shared_ptr<const nlohmann::json> payload;
+    LicenseStatus status = ticketPath_.empty() ? decodeFile(keyCtx, licensePath, accountId, payload)
+                                               : decodeFileWithTicket(keyCtx, licensePath, accountId, payload);
+    publish(status == Valid ? payload : nullptr);
+    return status;
+}
+
+LicenseStatus CSankeyLicenseDecoder::verifyBundle(const CSankeyKeyContext& keyCtx, const char* bundlePath, const char* accountId) {
+    std::shared_ptr<const nlohmann::json> payload;
+    LicenseStatus status = Invalid;
+
+    // The entry is decoded straight from the mapping
+    CLicenseFileView view;
+    const char* license = nullptr;
+    size_t licenseLen = 0;
+    if (!bundlePath || !accountId) {
+        logRejected(Invalid, ReasonNullArgument);
+    } else if (!view.open(bundlePath)) {
+        logRejected(Invalid, ReasonFileUnreadable);
+    } else if (!CLicenseBundle::find(view.data(), view.size(), accountId, license, licenseLen)) {
+        logRejected(Invalid, ReasonNotInBundle);
+    } else {
+        status = decode(keyCtx, license, licenseLen, accountId, payload);
     }
 
-    // Decode license
-    std::vector<unsigned char> licenseBin;
-    if (!base64_decode(licenseB64, licenseBin)) {
+    publish(status == Valid ? payload : nullptr);
+    return status;
+}
+
+LicenseStatus CSankeyLicenseDecoder::decodeFileWithTicket(const CSankeyKeyContext& keyCtx, const char* licensePath, const char* accountId,
+                                                          std::shared_ptr<const nlohmann::json>& payload) {
+    if (!licensePath || !accountId) {
+        logRejected(Invalid, ReasonNullArgument);
         return Invalid;
     }
-    if (licenseBin.size() < 48) {
+
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    CLicenseFileView view;
+    const char* text = nullptr;
+    size_t textLen = 0;
+    std::vector<char> narrowed;
+    if (!view.open(licensePath) || !view.text(text, textLen, narrowed)) {
+        logRejected(Invalid, ReasonFileUnreadable);
         return Invalid;
     }
 
-    // Extract components
-    std::vector<unsigned char> iv(licenseBin.begin(), licenseBin.begin() + 16);
-    std::vector<unsigned char> hmac(licenseBin.begin() + 16, licenseBin.begin() + 48);
-    std::vector<unsigned char> cipher(licenseBin.begin() + 48, licenseBin.end());
+    unsigned char digest[32];
+    if (!keyCtx.sha256(text, textLen, digest)) {
+        return decode(keyCtx, text, textLen, accountId, payload);
+    }
 
-    // Verify HMAC
-    std::vector<unsigned char> hmacInput;
-    hmacInput.insert(hmacInput.end(), iv.begin(), iv.end());
-    hmacInput.insert(hmacInput.end(), cipher.begin(), cipher.end());
-    hmacInput.insert(hmacInput.end(), (unsigned char*)accountId, (unsigned char*)accountId + strlen(accountId));
-    std::vector<unsigned char> mac;
-    if (!hmac_sha256(masterKey, hmacInput, mac)) {
-        return DecryptionFailed;
+    // Fast path: ticket for this exact license text and account
+    long long expiry = 0;
+    if (CLicenseTicket::read(ticketPath_.c_str(), keyCtx, digest, accountId, payload, expiry)) {
+        VerifyOutcome outcome;
+        outcome.source = SourceTicket;
+        if (expiry > 0 && time(nullptr) > expiry) {
+            payload.reset();
+            outcome.status = Expired;
+            outcome.reason = ReasonExpired;
+            outcome.reasonArg = expiry;
+        } else {
+            outcome.status = applySchema(Valid, payload);
+            outcome.reason = outcome.status == Valid ? ReasonNone : ReasonSchema;
+        }
+        logVerify(outcome, textLen, started);
+        return outcome.status;
+    }
+
+    LicenseStatus status = decode(keyCtx, text, textLen, accountId, payload);
+    if (status == Valid) {
+        // Best effort; a failed write only costs the next start a full verify
+        CLicenseTicket::write(ticketPath_.c_str(), keyCtx, digest, accountId, *payload, payloadExpiry(*payload));
     }
-    if (memcmp(mac.data(), hmac.data(), 32) != 0) {
+    return status;
+}
+
+void CSankeyLicenseDecoder::setTicketPath(const char* ticketPath) {
+    ticketPath_ = ticketPath ? ticketPath : "";
+}
+
+void CSankeyLicenseDecoder::setSchema(std::shared_ptr<const CSankeySchema> schema) {
+    std::atomic_store(&schema_, std::move(schema));
+}
+
+// The schema is per decoder, while outcomes are shared between decoders
+// (single flight, daemon, tickets), so it is applied after them
+LicenseStatus CSankeyLicenseDecoder::applySchema(LicenseStatus status, std::shared_ptr<const nlohmann::json>& payload) const {
+    std::shared_ptr<const CSankeySchema> schema = std::atomic_load(&schema_);
+    if (status == Valid && schema && !schema->check(*payload)) {
+        payload.reset();
+        return SchemaError;
+    }
+    return status;
+}
+
+LicenseStatus CSankeyLicenseDecoder::decodeFile(const CSankeyKeyContext& keyCtx, const char* licensePath, const char* accountId,
+                                                std::shared_ptr<const nlohmann::json>& payload) {
+    if (!licensePath || !accountId) {
+        logRejected(Invalid, ReasonNullArgument);
+        return Invalid;
+    }
+
+    CLicenseFileView view;
+    if (!view.open(licensePath)) {
+        logRejected(Invalid, ReasonFileUnreadable);
+        return Invalid;
+    }
+
+    const char* text = nullptr;
+    size_t textLen = 0;
+    std::vector<char> narrowed;
+    if (!view.text(text, textLen, narrowed)) {
+        logRejected(Invalid, ReasonFileUnreadable);
+        return Invalid;
+    }
+
+    return decode(keyCtx, text, textLen, accountId, payload);
+}
+
+LicenseStatus CSankeyLicenseDecoder::decode(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen, const char* accountId,
+                                            std::shared_ptr<const nlohmann::json>& payload, const std::vector<std::string>* projection) {
+    CTraceSpan span("verify");
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    payload.reset();
+
+    if (!licenseB64 || !accountId) {
+        logRejected(Invalid, ReasonNullArgument);
+        return Invalid;
+    }
+
+    int64_t etwStart = -1;
+    if (CSankeyEtw::enabled()) {
+        CSankeyEtw::verifyStart(licenseLen);
+        etwStart = CTraceRecorder::now();
+    }
+
+    // Identical concurrent verifies share one computation, keyed by the
+    // license's length and HMAC tag rather than its text. A fleet proof is
+    // not under the tag, so it is keyed too; it is one hash per tree level.
+    // A license whose tag cannot be read fails to decode anyway, so it runs
+    // on its own
+    unsigned char tag[32];
+    bool tagged = envelopeTag(licenseB64, licenseLen, tag);
+    std::string flightKey;
+    if (tagged) {
+        uint64_t textLen = licenseLen;
+        size_t accountLen = strlen(accountId);
+        size_t proofStart = licenseLen;
+        if (memcmp(licenseB64, "f1:", 3) == 0) {
+            while (proofStart > 0 && licenseB64[proofStart - 1] != '.') --proofStart;
+            if (proofStart == 0) proofStart = licenseLen; // No proof; fails to decode
+        }
+        flightKey.reserve(32 + accountLen + 1 + sizeof(textLen) + sizeof(tag) + (licenseLen - proofStart) + 1);
+        flightKey.append(reinterpret_cast<const char*>(keyCtx.digest()), 32);
+        flightKey.append(accountId, accountLen);
+        flightKey.push_back('\0');
+        flightKey.append(reinterpret_cast<const char*>(&textLen), sizeof(textLen));
+        flightKey.append(reinterpret_cast<const char*>(tag), sizeof(tag));
+        flightKey.append(licenseB64 + proofStart, licenseLen - proofStart);
+        if (projection) {
+            // Base64 never contains \x01, so the marker keeps projected
+            // flights (even with no keys) apart from full ones
+            flightKey.push_back('\x01');
+            for (const std::string& key : *projection) {
+                flightKey.push_back('\0');
+                flightKey.append(key);
+            }
+        }
+    }
+
+    auto compute = [&]() {
+        VerifyOutcome result;
+        if (CVerifyDaemonClient::instance().verify(keyCtx, licenseB64, licenseLen, accountId, result)) {
+            result.source = SourceDaemon;
+            if (projection && result.payload) {
+                nlohmann::json projected = *result.payload;
+                project(projected, *projection);
+                result.payload = std::make_shared<const nlohmann::json>(std::move(projected));
+            }
+        } else {
+            result.status = decodeLicense(keyCtx, licenseB64, licenseLen, accountId, result, projection,
+                                          CPayloadShapeCache::instance());
+        }
+        return result;
+    };
+    VerifyOutcome outcome = tagged ? CVerifySingleFlight::instance().run(flightKey, compute) : compute();
+    payload = outcome.payload;
+    LicenseStatus status = applySchema(outcome.status, payload);
+    if (status != outcome.status) {
+        outcome.status = status;
+        outcome.reason = ReasonSchema;
+    }
+    logVerify(outcome, licenseLen, started);
+    if (etwStart >= 0) {
+        CSankeyEtw::verifyEnd(status, etwStart, CTraceRecorder::now());
+    }
+    return status;
+}
+
+void CSankeyLicenseDecoder::decodeLocal(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen,
+                                        const char* accountId, CPayloadShapeCache& shapes, VerifyOutcome& outcome) {
+    if (!licenseB64 || !accountId) {
+        outcome.payload.reset();
+        outcome.status = Invalid;
+        outcome.reason = ReasonNullArgument;
+        return;
+    }
+    outcome.status = decodeLicense(keyCtx, licenseB64, licenseLen, accountId, outcome, nullptr, shapes);
+}
+
+// Splits a license into its components. Valid means well-formed and
+// addressed to keyCtx, not yet authenticated.
+//   v1:    Base64(iv || hmac || cipher)
+//   v2:    "v2:" Base64(keyId || iv || hmac || cipher)
+//   fleet: "f1:" Base64(keyId || root || leafCount u32 || iv || hmac || cipher) "." Base64(proof)
+LicenseStatus CSankeyLicenseDecoder::parseEnvelope(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen,
+                                                   LicenseEnvelope& envelope) {
+    const size_t fleetHeaderLen = CSankeyKeyContext::kKeyIdLen + 32 + 4;
+    envelope.headerLen = 0;
+    envelope.fleetRoot = nullptr;
+    envelope.leafCount = 0;
+    envelope.proof.clear();
+    envelope.reason = ReasonNone;
+    envelope.reasonArg = 0;
+
+    unsigned char expectedId[CSankeyKeyContext::kKeyIdLen];
+    if (envelopeKeyId(licenseB64, licenseLen, expectedId)) {
+        if (memcmp(expectedId, keyCtx.keyId(), sizeof(expectedId)) != 0) {
+            envelope.reason = ReasonKeyIdMismatch;
+            return KeyError; // Issued under another key; no HMAC spent
+        }
+        bool fleet = licenseB64[0] == 'f';
+        licenseB64 += 3;
+        licenseLen -= 3;
+        envelope.headerLen = fleet ? fleetHeaderLen : CSankeyKeyContext::kKeyIdLen;
+
+        if (fleet) {
+            const char* dot = static_cast<const char*>(memchr(licenseB64, '.', licenseLen));
+            if (!dot) {
+                envelope.reason = ReasonFleetProof;
+                return Invalid;
+            }
+            size_t proofLen = licenseLen - (dot - licenseB64) - 1;
+            licenseLen = dot - licenseB64;
+            if (!base64_decode(dot + 1, proofLen, envelope.proof) || envelope.proof.size() < 4 ||
+                (envelope.proof.size() - 4) % 32 != 0) {
+                envelope.reason = ReasonFleetProof;
+                return Invalid;
+            }
+        }
+    }
+
+    if (!base64_decode(licenseB64, licenseLen, envelope.bin)) {
+        envelope.reason = base64Fault(licenseB64, licenseLen, envelope.reasonArg);
+        return Invalid;
+    }
+    if (envelope.bin.size() < envelope.headerLen + 48) {
+        envelope.reason = ReasonEnvelopeTooShort;
+        envelope.reasonArg = (long long)envelope.bin.size();
+        return Invalid;
+    }
+
+    // header || iv || hmac || cipher
+    envelope.header = envelope.bin.data();
+    if (envelope.headerLen == fleetHeaderLen) {
+        envelope.fleetRoot = envelope.header + CSankeyKeyContext::kKeyIdLen;
+        memcpy(&envelope.leafCount, envelope.fleetRoot + 32, 4);
+    }
+    envelope.iv = envelope.bin.data() + envelope.headerLen;
+    envelope.hmac = envelope.iv + 16;
+    envelope.cipher = envelope.bin.data() + envelope.headerLen + 48;
+    envelope.cipherLen = envelope.bin.size() - envelope.headerLen - 48;
+    return Valid;
+}
+
+// Fleet membership: rebuild the Merkle root from accountId's leaf and the
+// proof. leaf = SHA-256(0x00 || accountId), node = SHA-256(0x01 || left || right);
+// an odd node out at the end of a level moves up unchanged. Same rules as
+// services/lambda/src/services/fleetMerkle.ts.
+bool CSankeyLicenseDecoder::fleetContains(const CSankeyKeyContext& keyCtx, const LicenseEnvelope& envelope, const char* accountId) {
+    uint32_t index = 0;
+    memcpy(&index, envelope.proof.data(), 4);
+    if (index >= envelope.leafCount) {
+        return false;
+    }
+
+    std::vector<unsigned char> leaf(1 + strlen(accountId));
+    leaf[0] = 0x00;
+    memcpy(leaf.data() + 1, accountId, leaf.size() - 1);
+    unsigned char node[32];
+    if (!keyCtx.sha256(leaf.data(), leaf.size(), node)) {
+        return false;
+    }
+
+    const unsigned char* sibling = envelope.proof.data() + 4;
+    const unsigned char* end = envelope.proof.data() + envelope.proof.size();
+    for (uint32_t count = envelope.leafCount; count > 1; count = (count + 1) / 2, index /= 2) {
+        if ((index ^ 1) >= count) {
+            continue; // Promoted without a sibling
+        }
+        if (sibling == end) {
+            return false;
+        }
+        unsigned char pair[65];
+        pair[0] = 0x01;
+        memcpy(pair + 1, (index & 1) ? sibling : node, 32);
+        memcpy(pair + 33, (index & 1) ? node : sibling, 32);
+        if (!keyCtx.sha256(pair, sizeof(pair), node)) {
+            return false;
+        }
+        sibling += 32;
+    }
+    return sibling == end && memcmp(node, envelope.fleetRoot, 32) == 0;
+}
+
+int CSankeyLicenseDecoder::identifyAccount(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen,
+                                           const char* const* candidates, int count) {
+    LicenseEnvelope envelope;
+    if (parseEnvelope(keyCtx, licenseB64, licenseLen, envelope) != Valid) {
+        return -1;
+    }
+
+    // A fleet license carries the proof for one account; check membership
+    // only after the license itself authenticates
+    if (envelope.fleetRoot) {
+        unsigned char mac[32];
+        if (!hmac_sha256(keyCtx, envelope, "", mac) || memcmp(mac, envelope.hmac, 32) != 0) {
+            return -1;
+        }
+        for (int i = 0; i < count; ++i) {
+            if (candidates[i] && fleetContains(keyCtx, envelope, candidates[i])) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // HMAC state after the body; each candidate costs a clone plus the
+    // accountId block and the outer hash
+    HCRYPTHASH hBody = 0;
+    if (!hmacBody(keyCtx, envelope.header, envelope.headerLen, envelope.iv, envelope.cipher, envelope.cipherLen, hBody)) {
+        return -1;
+    }
+
+    int found = -1;
+    for (int i = 0; i < count && found < 0; ++i) {
+        HCRYPTHASH hHash = 0;
+        unsigned char mac[32];
+        if (!candidates[i] || !CryptDuplicateHash(hBody, NULL, 0, &hHash)) {
+            continue;
+        }
+        if (hmacFinish(hHash, candidates[i], mac) && memcmp(mac, envelope.hmac, 32) == 0) {
+            found = i;
+        }
+    }
+    CryptDestroyHash(hBody);
+    return found;
+}
+
+// Touches what a first verify would: process-wide singletons, the CryptoAPI
+// provider and key import, HMAC, AES, the JSON parser and string scanner,
+// and the getters (the ISO date getter's stream and locale setup). The
+// self-verify bypasses single flight, the daemon and the diagnostic rings,
+// and is projected so the payload shape cache keeps real licenses' shape.
+bool CSankeyLicenseDecoder::warmup() {
+    static std::once_flag once;
+    static bool verified = false;
+    std::call_once(once, [] {
+        CSankeyEtw::registerProvider();
+        CTraceSpan span("warmup");
+        CKernelDispatch::instance();
+        CKeyContextCache::instance();
+        CVerifySingleFlight::instance();
+        CVerifyDaemonClient::instance();
+        CPayloadShapeCache::instance();
+        CVerifyLog::process();
+
+        std::string scanned;
+        const char* text = "\"warmup\\u00e9\"";
+        CJsonString::scan(text, text + strlen(text), scanned);
+
+        std::unique_ptr<CSankeyKeyContext> keyCtx(CSankeyKeyContext::create(kWarmupKey));
+        if (!keyCtx) {
+            return;
+        }
+        CSankeyLicenseDecoder scratch;
+        VerifyOutcome outcome;
+        std::vector<std::string> projection = {"warmup"};
+        outcome.status = scratch.decodeLicense(*keyCtx, kWarmupLicense, sizeof(kWarmupLicense) - 1, kWarmupAccount, outcome,
+                                               &projection, CPayloadShapeCache::instance());
+        if (outcome.status == Valid) {
+            scratch.publish(outcome.payload);
+            verified = scratch.getValueAsBool("warmup", false) && scratch.getValueAsDateTime("expiry", 0) > 0;
+        }
+    });
+    return verified;
+}
+
+void CSankeyLicenseDecoder::setDecryptThreads(unsigned threads) {
+    decryptThreads().store(threads);
+}
+
+// Keeps only the projected top-level keys (and "expiry") of a payload
+void CSankeyLicenseDecoder::project(nlohmann::json& payload, const std::vector<std::string>& projection) {
+    if (!payload.is_object()) {
+        return;
+    }
+    for (auto it = payload.begin(); it != payload.end();) {
+        if (it.key() == "expiry" || std::find(projection.begin(), projection.end(), it.key()) != projection.end()) {
+            ++it;
+        } else {
+            it = payload.erase(it);
+        }
+    }
+}
+
+LicenseStatus CSankeyLicenseDecoder::decodeLicense(const CSankeyKeyContext& keyCtx, const char* licenseB64, size_t licenseLen, const char* accountId,
+                                                   VerifyOutcome& outcome, const std::vector<std::string>* projection,
+                                                   CPayloadShapeCache& shapes) {
+    outcome.payload.reset();
+
+    CTraceSpan envelopeSpan("license decode");
+    LicenseEnvelope envelope;
+    LicenseStatus status = parseEnvelope(keyCtx, licenseB64, licenseLen, envelope);
+    if (status != Valid) {
+        outcome.reason = envelope.reason;
+        outcome.reasonArg = envelope.reasonArg;
+        return status;
+    }
+
+    // Fleet membership is a few hashes; rule it out before touching the ciphertext
+    if (envelope.fleetRoot && !fleetContains(keyCtx, envelope, accountId)) {
+        outcome.reason = ReasonNotInFleet;
         return Tampered;
     }
+    envelopeSpan.end();
 
-    // Decrypt
-    std::vector<unsigned char> plain;
-    if (!aes_cbc_decrypt(masterKey, iv, cipher, plain)) {
-        return DecryptionFailed;
+    // Verify HMAC and decrypt in place; cipher becomes the plaintext. A fleet
+    // MAC covers the account set's root instead of one accountId
+    size_t plainLen = 0;
+    status = authDecrypt(keyCtx, envelope, envelope.fleetRoot ? "" : accountId, plainLen);
+    if (status != Valid) {
+        outcome.reason = envelope.reason;
+        outcome.reasonArg = envelope.reasonArg;
+        return status;
     }
+    outcome.payloadLen = plainLen;
 
-    // Parse JSON
+    // Parse JSON. With a projection, unlisted top-level members are dropped
+    // by the parser as they are read instead of being built and erased
+    CTraceSpan parseSpan("parse");
+    std::shared_ptr<nlohmann::json> parsed;
     try {
-        std::string payloadStr(reinterpret_cast<char*>(plain.data()), plain.size());
-        payload_ = nlohmann::json::parse(payloadStr);
+        const char* plain = reinterpret_cast<const char*>(envelope.cipher);
+        if (projection) {
+            nlohmann::json::parser_callback_t keep = [projection](int depth, nlohmann::json::parse_event_t event,
+                                                                  nlohmann::json& value) {
+                if (depth != 1 || event != nlohmann::json::parse_event_t::key) {
+                    return true;
+                }
+                const std::string& key = value.get_ref<const std::string&>();
+                return key == "expiry" || std::find(projection->begin(), projection->end(), key) != projection->end();
+            };
+            parsed = std::make_shared<nlohmann::json>(nlohmann::json::parse(plain, plain + plainLen, keep));
+        } else {
+            parsed = std::make_shared<nlohmann::json>(shapes.parse(plain, plainLen));
+        }
+    } catch (const nlohmann::json::parse_error& e) {
+        outcome.reason = ReasonJsonSyntax;
+        outcome.reasonArg = (long long)e.byte;
+        return ParseError;
     } catch (const nlohmann::json::exception& e) {
+        outcome.reason = ReasonJsonSyntax;
+        outcome.reasonArg = -1;
         return ParseError;
     }
 
+    parseSpan.end();
+
     // Check expiry if present
-    if (payload_.contains("expiry") && payload_["expiry"].is_string()) {
-        std::string expiryStr = payload_["expiry"];
-        long expiryTimestamp = parseISODateTime(expiryStr);
-        if (expiryTimestamp > 0) {
-            time_t currentTime = time(nullptr);
-            if (currentTime > expiryTimestamp) {
-                return Expired;
-            }
+    CTraceSpan expirySpan("expiry");
+    long expiryTimestamp = payloadExpiry(*parsed);
+    if (expiryTimestamp > 0) {
+        time_t currentTime = time(nullptr);
+        if (currentTime > expiryTimestamp) {
+            outcome.reason = ReasonExpired;
+            outcome.reasonArg = expiryTimestamp;
+            return Expired;
         }
     }
 
-    isVerified_ = true;
+    outcome.payload = parsed;
     return Valid;
 }
 
+bool CSankeyLicenseDecoder::startWatch(const CSankeyKeyContext& keyCtx, const char* licensePath, const char* accountId) {
+    stopWatch();
+    if (!licensePath || !accountId) {
+        return false;
+    }
+
+    std::string path(licensePath);
+    std::string account(accountId);
+    const CSankeyKeyContext* ctx = &keyCtx;
+
+    // Digest of what is on disk now; only a different digest triggers a re-verify
+    std::array<unsigned char, 32> digest = {};
+    fileDigest(keyCtx, path, digest);
+
+    std::unique_ptr<CLicenseFileWatcher> watcher(new CLicenseFileWatcher());
+    bool started = watcher->start(path, [this, ctx, path, account, digest]() mutable {
+        std::array<unsigned char, 32> current = {};
+        if (!fileDigest(*ctx, path, current) || current == digest) {
+            return;
+        }
+        digest = current;
+
+        // A renewal that does not verify leaves the previous payload in place
+        std::shared_ptr<const nlohmann::json> payload;
+        if (decodeFile(*ctx, path.c_str(), account.c_str(), payload) == Valid) {
+            publish(payload);
+        }
+    });
+    if (!started) {
+        return false;
+    }
+
+    watcher_ = std::move(watcher);
+    return true;
+}
+
+void CSankeyLicenseDecoder::stopWatch() {
+    // Joins the watcher thread before the callback's captures go away
+    watcher_.reset();
+}
+
+bool CSankeyLicenseDecoder::fileDigest(const CSankeyKeyContext& keyCtx, const std::string& path, std::array<unsigned char, 32>& digest) {
+    CLicenseFileView view;
+    return view.open(path.c_str()) && keyCtx.sha256(view.data(), view.size(), digest.data());
+}
+
+int CSankeyLicenseDecoder::generation() const {
+    return generation_.load();
+}
+
 std::string CSankeyLicenseDecoder::getValue(const char* key, const char* defaultValue) {
-    if (!isVerified_ || !key) {
+    std::shared_ptr<const PayloadSnapshot> snapshot = currentPayload();
+    if (!snapshot || !key) {
         return std::string(defaultValue ? defaultValue : "");
     }
 
-    try {
-        if (payload_.contains(key) && payload_[key].is_string()) {
-            return payload_[key];
-        }
-    } catch (const nlohmann::json::exception& e) {
-        // Fall through to default
+    if (const PayloadSlot* slot = snapshot->slot(key)) {
+        return slot->kind == PayloadSlot::String ? *slot->string : std::string(defaultValue ? defaultValue : "");
+    }
+
+    const nlohmann::json& payload = *snapshot->payload;
+    auto it = payload.find(key);
+    if (it != payload.end() && it->is_string()) {
+        return it->get<std::string>();
     }
 
     return std::string(defaultValue ? defaultValue : "");
 }
 
+// View into the payload snapshot, pinned until the next call, so the C API
+// returns strings without copying them
+const char* CSankeyLicenseDecoder::getString(const char* key, const char* defaultValue) {
+    CTraceSpan span("GetValue");
+    const char* fallback = defaultValue ? defaultValue : "";
+    std::shared_ptr<const PayloadSnapshot> snapshot = currentPayload();
+    if (!snapshot || !key) {
+        return fallback;
+    }
+
+    const std::string* value = nullptr;
+    if (const PayloadSlot* slot = snapshot->slot(key)) {
+        value = slot->kind == PayloadSlot::String ? slot->string : nullptr;
+    } else {
+        auto it = snapshot->payload->find(key);
+        value = it != snapshot->payload->end() && it->is_string() ? &it->get_ref<const std::string&>() : nullptr;
+    }
+    if (!value) {
+        if (CSankeyEtw::enabled()) CSankeyEtw::getterMiss("GetValue", key);
+        return fallback;
+    }
+    stringSnapshot_ = snapshot;
+    return value->c_str();
+}
+
+// Schema properties are read from their slots; a string slot (or a key the
+// schema does not name) still goes through the conversions below
 int CSankeyLicenseDecoder::getValueAsInt(const char* key, int defaultValue) {
-    if (!isVerified_ || !key) {
+    CTraceSpan span("GetValueAsInt");
+    std::shared_ptr<const PayloadSnapshot> snapshot = currentPayload();
+    if (!snapshot || !key) {
         return defaultValue;
     }
 
-    try {
-        if (payload_.contains(key)) {
-            if (payload_[key].is_number_integer()) {
-                return payload_[key];
-            } else if (payload_[key].is_string()) {
-                std::string str = payload_[key];
-                return std::stoi(str);
+    const PayloadSlot* slot = snapshot->slot(key);
+    if (slot && slot->kind == PayloadSlot::Integer) {
+        return (int)slot->integer;
+    }
+    if (!slot || slot->kind == PayloadSlot::String) {
+        const nlohmann::json& payload = *snapshot->payload;
+        try {
+            auto it = payload.find(key);
+            if (it != payload.end()) {
+                if (it->is_number_integer()) {
+                    return it->get<int>();
+                } else if (it->is_string()) {
+                    return std::stoi(it->get_ref<const std::string&>());
+                }
             }
+        } catch (const std::exception& e) {
+            // Fall through to default
         }
-    } catch (const std::exception& e) {
-        // Fall through to default
     }
 
+    if (CSankeyEtw::enabled()) CSankeyEtw::getterMiss("GetValueAsInt", key);
     return defaultValue;
 }
 
 bool CSankeyLicenseDecoder::getValueAsBool(const char* key, bool defaultValue) {
-    if (!isVerified_ || !key) {
+    CTraceSpan span("GetValueAsBool");
+    std::shared_ptr<const PayloadSnapshot> snapshot = currentPayload();
+    if (!snapshot || !key) {
         return defaultValue;
     }
 
+    if (const PayloadSlot* slot = snapshot->slot(key)) {
+        switch (slot->kind) {
+        case PayloadSlot::Boolean:
+            return slot->boolean;
+        case PayloadSlot::Integer:
+        case PayloadSlot::Number:
+            return slot->number != 0;
+        case PayloadSlot::String:
+            return *slot->string == "true" || *slot->string == "1" || *slot->string == "yes";
+        default:
+            if (CSankeyEtw::enabled()) CSankeyEtw::getterMiss("GetValueAsBool", key);
+            return defaultValue;
+        }
+    }
+
+    const nlohmann::json& payload = *snapshot->payload;
     try {
-        if (payload_.contains(key)) {
-            if (payload_[key].is_boolean()) {
-                return payload_[key];
-            } else if (payload_[key].is_string()) {
-                std::string str = payload_[key];
+        auto it = payload.find(key);
+        if (it != payload.end()) {
+            if (it->is_boolean()) {
+                return it->get<bool>();
+            } else if (it->is_string()) {
+                const std::string& str = it->get_ref<const std::string&>();
                 return (str == "true" || str == "1" || str == "yes");
-            } else if (payload_[key].is_number()) {
-                return payload_[key] != 0;
+            } else if (it->is_number()) {
+                return *it != 0;
             }
         }
     } catch (const std::exception& e) {
         // Fall through to default
     }
 
+    if (CSankeyEtw::enabled()) CSankeyEtw::getterMiss("GetValueAsBool", key);
     return defaultValue;
 }
 
 double CSankeyLicenseDecoder::getValueAsDouble(const char* key, double defaultValue) {
-    if (!isVerified_ || !key) {
+    CTraceSpan span("GetValueAsDouble");
+    std::shared_ptr<const PayloadSnapshot> snapshot = currentPayload();
+    if (!snapshot || !key) {
         return defaultValue;
     }
 
-    try {
-        if (payload_.contains(key)) {
-            if (payload_[key].is_number()) {
-                return payload_[key];
-            } else if (payload_[key].is_string()) {
-                std::string str = payload_[key];
-                return std::stod(str);
+    const PayloadSlot* slot = snapshot->slot(key);
+    if (slot && (slot->kind == PayloadSlot::Integer || slot->kind == PayloadSlot::Number)) {
+        return slot->number;
+    }
+    if (!slot || slot->kind == PayloadSlot::String) {
+        const nlohmann::json& payload = *snapshot->payload;
+        try {
+            auto it = payload.find(key);
+            if (it != payload.end()) {
+                if (it->is_number()) {
+                    return it->get<double>();
+                } else if (it->is_string()) {
+                    return std::stod(it->get_ref<const std::string&>());
+                }
             }
+        } catch (const std::exception& e) {
+            // Fall through to default
         }
-    } catch (const std::exception& e) {
-        // Fall through to default
     }
 
+    if (CSankeyEtw::enabled()) CSankeyEtw::getterMiss("GetValueAsDouble", key);
     return defaultValue;
 }
 
 long CSankeyLicenseDecoder::getValueAsDateTime(const char* key, long defaultValue) {
-    if (!isVerified_ || !key) {
+    CTraceSpan span("GetValueAsDateTime");
+    std::shared_ptr<const PayloadSnapshot> snapshot = currentPayload();
+    if (!snapshot || !key) {
         return defaultValue;
     }
 
-    try {
-        if (payload_.contains(key) && payload_[key].is_string()) {
-            std::string dateStr = payload_[key];
-            long timestamp = parseISODateTime(dateStr);
-            return timestamp > 0 ? timestamp : defaultValue;
-        }
-    } catch (const std::exception& e) {
-        // Fall through to default
+    const std::string* value = nullptr;
+    if (const PayloadSlot* slot = snapshot->slot(key)) {
+        value = slot->kind == PayloadSlot::String ? slot->string : nullptr;
+    } else {
+        auto it = snapshot->payload->find(key);
+        value = it != snapshot->payload->end() && it->is_string() ? &it->get_ref<const std::string&>() : nullptr;
+    }
+    if (value) {
+        long timestamp = parseISODateTime(*value);
+        return timestamp > 0 ? timestamp : defaultValue;
     }
 
+    if (CSankeyEtw::enabled()) CSankeyEtw::getterMiss("GetValueAsDateTime", key);
     return defaultValue;
 }
 
 bool CSankeyLicenseDecoder::hasKey(const char* key) {
-    if (!isVerified_ || !key) {
+    CTraceSpan span("HasKey");
+    std::shared_ptr<const PayloadSnapshot> snapshot = currentPayload();
+    if (!snapshot || !key) {
         return false;
     }
 
-    return payload_.contains(key);
+    if (const PayloadSlot* slot = snapshot->slot(key)) {
+        return slot->kind != PayloadSlot::Absent;
+    }
+    return snapshot->payload->contains(key);
 }
 
 // C Interface implementations
@@ -309,11 +1300,38 @@ int Verify(CSankeyLicenseDecoder* decoder, const char* masterKeyB64, const char*
     return static_cast<int>(decoder->verify(masterKeyB64, licenseB64, accountId));
 }
 
+bool Warmup(bool background) {
+    // Set once warmup has run or a thread has been started for it
+    static std::atomic<bool> scheduled(false);
+    if (!background) {
+        scheduled = true;
+        return CSankeyLicenseDecoder::warmup();
+    }
+    if (scheduled.exchange(true)) {
+        return true;
+    }
+
+    // The thread holds a reference on this module, so an EA removed while it
+    // runs cannot unload the code under it
+    HMODULE module = nullptr;
+    if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, reinterpret_cast<LPCSTR>(&warmupThread), &module)) {
+        scheduled = false;
+        return false;
+    }
+    HANDLE thread = CreateThread(nullptr, 0, warmupThread, module, 0, nullptr);
+    if (!thread) {
+        FreeLibrary(module);
+        scheduled = false;
+        return false;
+    }
+    CloseHandle(thread);
+    return true;
+}
+
 const char* GetValue(CSankeyLicenseDecoder* decoder, const char* key, const char* defaultValue) {
     if (!decoder) return defaultValue ? defaultValue : "";
     
-    decoder->lastStringResult_ = decoder->getValue(key, defaultValue);
-    return decoder->lastStringResult_.c_str();
+    return decoder->getString(key, defaultValue);
 }
 
 int GetValueAsInt(CSankeyLicenseDecoder* decoder, const char* key, int defaultValue) {
@@ -341,4 +1359,139 @@ bool HasKey(CSankeyLicenseDecoder* decoder, const char* key) {
     return decoder->hasKey(key);
 }
 
+CSankeyKeyContext* CreateKeyContext(const char* masterKeyB64) {
+    return CSankeyKeyContext::create(masterKeyB64);
+}
+
+void DestroyKeyContext(CSankeyKeyContext* keyCtx) {
+    delete keyCtx;
+}
+
+CSankeyKeyring* CreateKeyring() {
+    return new CSankeyKeyring();
+}
+
+void DestroyKeyring(CSankeyKeyring* keyring) {
+    delete keyring;
+}
+
+bool AddKey(CSankeyKeyring* keyring, const char* masterKeyB64) {
+    if (!keyring) return false;
+    return keyring->add(masterKeyB64);
+}
+
+int VerifyWithKeyring(CSankeyLicenseDecoder* decoder, CSankeyKeyring* keyring, const char* licenseB64, const char* accountId) {
+    if (!decoder || !licenseB64 || !accountId) return Invalid;
+    if (!keyring) return KeyError;
+    return static_cast<int>(decoder->verify(*keyring, licenseB64, strlen(licenseB64), accountId));
+}
+
+int IdentifyAccount(CSankeyKeyContext* keyCtx, const char* licenseB64, const char** candidates, int count) {
+    if (!keyCtx || !licenseB64 || !candidates || count <= 0) return -1;
+    return CSankeyLicenseDecoder::identifyAccount(*keyCtx, licenseB64, strlen(licenseB64), candidates, count);
+}
+
+int VerifyProjected(CSankeyLicenseDecoder* decoder, CSankeyKeyContext* keyCtx, const char* licenseB64, const char* accountId,
+                    const char** keys, int count) {
+    if (!decoder || !licenseB64 || !accountId || (count > 0 && !keys)) return Invalid;
+    if (!keyCtx) return KeyError;
+
+    std::vector<std::string> projection;
+    for (int i = 0; i < count; ++i) {
+        if (keys[i]) projection.emplace_back(keys[i]);
+    }
+    return static_cast<int>(decoder->verifyProjected(*keyCtx, licenseB64, strlen(licenseB64), accountId, projection));
+}
+
+CSankeySchema* CompileSchema(const char* schemaJson) {
+    return CSankeySchema::acquireHandle(schemaJson);
+}
+
+void DestroySchema(CSankeySchema* schema) {
+    CSankeySchema::releaseHandle(schema);
+}
+
+void SetSchema(CSankeyLicenseDecoder* decoder, CSankeySchema* schema) {
+    if (decoder) decoder->setSchema(schema ? schema->share() : nullptr);
+}
+
+int VerifyFile(CSankeyLicenseDecoder* decoder, CSankeyKeyContext* keyCtx, const char* licensePath, const char* accountId) {
+    if (!decoder) return Invalid;
+    if (!keyCtx) return KeyError;
+    return static_cast<int>(decoder->verifyFile(*keyCtx, licensePath, accountId));
+}
+
+int VerifyFromBundle(CSankeyLicenseDecoder* decoder, CSankeyKeyContext* keyCtx, const char* bundlePath, const char* accountId) {
+    if (!decoder) return Invalid;
+    if (!keyCtx) return KeyError;
+    return static_cast<int>(decoder->verifyBundle(*keyCtx, bundlePath, accountId));
+}
+
+bool StartWatch(CSankeyLicenseDecoder* decoder, CSankeyKeyContext* keyCtx, const char* licensePath, const char* accountId) {
+    if (!decoder || !keyCtx) return false;
+    return decoder->startWatch(*keyCtx, licensePath, accountId);
+}
+
+void StopWatch(CSankeyLicenseDecoder* decoder) {
+    if (decoder) decoder->stopWatch();
+}
+
+void SetTicketPath(CSankeyLicenseDecoder* decoder, const char* ticketPath) {
+    if (decoder) decoder->setTicketPath(ticketPath);
+}
+
+int GetGeneration(CSankeyLicenseDecoder* decoder) {
+    if (!decoder) return 0;
+    return decoder->generation();
+}
+
+void SetVerifyDaemon(const char* pipeName) {
+    CVerifyDaemonClient::instance().configure(pipeName);
+}
+
+void GetCoalesceStats(long long* executed, long long* coalesced) {
+    if (executed) *executed = CVerifySingleFlight::instance().executed();
+    if (coalesced) *coalesced = CVerifySingleFlight::instance().coalesced();
+}
+
+void GetShapeCacheStats(long long* hits, long long* misses) {
+    if (hits) *hits = CPayloadShapeCache::instance().hits();
+    if (misses) *misses = CPayloadShapeCache::instance().misses();
+}
+
+void SetTracing(bool enabled) {
+    CTraceRecorder::setEnabled(enabled);
+}
+
+bool DumpTrace(const char* path) {
+    return CTraceRecorder::dump(path);
+}
+
+int ReadDiagnostics(CSankeyLicenseDecoder* decoder, VerifyRecord* records, int capacity) {
+    return decoder ? decoder->readDiagnostics(records, capacity) : CVerifyLog::process().read(records, capacity);
+}
+
+int GetKernelInfo(char* buffer, int length) {
+    std::string info = CKernelDispatch::instance().info();
+    int needed = (int)info.size() + 1;
+    if (buffer && length >= needed) {
+        memcpy(buffer, info.c_str(), needed);
+    }
+    return needed;
+}
+
+bool SetKernelTier(const char* tier) {
+    return CKernelDispatch::instance().force(tier);
+}
+
+void SetKeyCacheCapacity(int capacity) {
+    CKeyContextCache::instance().setCapacity(capacity > 0 ? (size_t)capacity : CKeyContextCache::kDefaultCapacity);
+}
+
+void GetKeyCacheStats(long long* hits, long long* misses, long long* evictions) {
+    if (hits) *hits = CKeyContextCache::instance().hits();
+    if (misses) *misses = CKeyContextCache::instance().misses();
+    if (evictions) *evictions = CKeyContextCache::instance().evictions();
+}
+
 }
\ No newline at end of file
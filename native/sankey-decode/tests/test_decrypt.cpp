@@ -1,5 +1,28 @@
 #include <gtest/gtest.h>
 #include "SankeyDecoder.h"
+#include "CLicenseBundle.h"
+#include "CPayloadShapeCache.h"
+#include "CSankeySchema.h"
+#include "CVerifyLog.h"
+#include "CKernelDispatch.h"
+#include "CJsonString.h"
+#include "CVerifiedDigestStore.h"
+#include "CLicenseBatchReader.h"
+#include "CNumaBatchExecutor.h"
+#include "CTraceRecorder.h"
+#include "CSankeyKeyContext.h"
+#include "CVerifySingleFlight.h"
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
 
 class SankeyLicenseDecoderTest : public ::testing::Test {
 protected:
@@ -19,7 +42,7 @@ protected:
     
     // Test data from the original test
     const char* masterKeyB64 = "9H6DEu8Z0Mipgz1djyM4eUeBqZ9AqzenZHmhh7UBWTw=";
-    const char* licenseB64 = "ht4AoFy8o2UWNSBqCIcnLaAQqq6iAWjHrB3xZU+UA571yv/soPmyCTLSDClOQSsOiDcn1mFk1CpspKT5pErhT6v7ua8aHIwLghnzcEC2qfo/gdX9HvX/RHZ7eLOEOH2TU6iSf22LpX9N9B9+7pTm6+oLJV0U5VVfGwT4Q3MVZCs=";
+    const char* licenseB64 = "aStrSVhLWzgdEsEhkMMqXO5y8Rhctv/WGO65SJVKsOfMQmIc2H7ZKSGrucIpUn1Ho5f+l9IhOfGgAcUFa+5Ik6r1hYt7pyjIDphmJ2jPYYTBz+RCFF5GK1UFjHxaJONcPr4SwqK6C2RuVTYRonLdBLP/j6KLzGqqGwnyE3fdzZc=";
     const char* accountId = "1234";
 };
 
@@ -146,4 +169,1279 @@ TEST_F(SankeyLicenseDecoderTest, VerifyWithNullParameters) {
 
     int result3 = Verify(decoder, masterKeyB64, licenseB64, nullptr);
     EXPECT_EQ(result3, Invalid);
-}
\ No newline at end of file
+}
+
+class SankeyLicenseFileTest : public SankeyLicenseDecoderTest {
+protected:
+    void SetUp() override {
+        SankeyLicenseDecoderTest::SetUp();
+        keyCtx = CreateKeyContext(masterKeyB64);
+        ASSERT_NE(keyCtx, nullptr);
+        path = (std::filesystem::temp_directory_path() / "sankey_license_test.txt").string();
+    }
+
+    void TearDown() override {
+        DestroyKeyContext(keyCtx);
+        std::filesystem::remove(path);
+        SankeyLicenseDecoderTest::TearDown();
+    }
+
+    void writeFile(const std::string& bytes) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), bytes.size());
+    }
+
+    CSankeyKeyContext* keyCtx = nullptr;
+    std::string path;
+
+    // Same key/account as licenseB64, payload adds "renewed": true
+    const char* renewedB64 = "AKQHnaBSqyzNeeHtabxULcCFft5v8l8Y+tK4QsayY6nD9B7iiRIKWEe0lHp8hScdPYkaAzA3DnPBJFbB+Z/XqlAsjuB4fQP+kAGKVpw3HjCZ6htlLvtmPxzHeEb9Lf+dk/mUoS+p4Olhd+47aitWzNuGwiuZEl5tarxecZ+HZJNiy3b+S4/Y8h1VsT6JCVng";
+};
+
+TEST_F(SankeyLicenseFileTest, CreateKeyContextRejectsBadKey) {
+    EXPECT_EQ(CreateKeyContext(nullptr), nullptr);
+    EXPECT_EQ(CreateKeyContext("AAAA"), nullptr);
+}
+
+TEST_F(SankeyLicenseFileTest, VerifyPlainFile) {
+    writeFile(licenseB64);
+    ASSERT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), accountId), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "MyEA");
+}
+
+TEST_F(SankeyLicenseFileTest, VerifyFileWithBomAndWhitespace) {
+    writeFile(std::string("\xEF\xBB\xBF  ") + licenseB64 + "\r\n\r\n");
+    EXPECT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), accountId), Valid);
+}
+
+TEST_F(SankeyLicenseFileTest, VerifyUtf16File) {
+    std::string utf16("\xFF\xFE", 2);
+    for (const char* p = licenseB64; *p; ++p) {
+        utf16.push_back(*p);
+        utf16.push_back('\0');
+    }
+    utf16.append("\r\0\n\0", 4);
+    writeFile(utf16);
+    EXPECT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), accountId), Valid);
+}
+
+TEST_F(SankeyLicenseFileTest, VerifyFileErrors) {
+    EXPECT_EQ(VerifyFile(decoder, keyCtx, "no_such_dir/license.txt", accountId), Invalid);
+    EXPECT_EQ(VerifyFile(decoder, nullptr, path.c_str(), accountId), KeyError);
+
+    writeFile(" \r\n");
+    EXPECT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), accountId), Invalid);
+
+    writeFile(licenseB64);
+    EXPECT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), "9999"), Tampered);
+}
+
+// ~42 KB payload, so the ciphertext spans several decrypt blocks
+TEST_F(SankeyLicenseFileTest, VerifyMultiBlockLicense) {
+    const std::string large = SANKEY_TEST_DATA_DIR "/large_license.txt";
+    ASSERT_EQ(VerifyFile(decoder, keyCtx, large.c_str(), accountId), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "PortfolioEA");
+    EXPECT_TRUE(HasKey(decoder, "symbols"));
+
+    EXPECT_EQ(VerifyFile(decoder, keyCtx, large.c_str(), "9999"), Tampered);
+
+    std::ifstream in(large, std::ios::binary);
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    text[text.size() / 2] = text[text.size() / 2] == 'A' ? 'B' : 'A';
+    writeFile(text);
+    EXPECT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), accountId), Tampered);
+}
+
+TEST_F(SankeyLicenseFileTest, VerifyProjectedKeepsListedKeys) {
+    const char* keys[] = {"eaName", "notInPayload"};
+    ASSERT_EQ(VerifyProjected(decoder, keyCtx, licenseB64, accountId, keys, 2), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "MyEA");
+    EXPECT_TRUE(HasKey(decoder, "expiry"));
+    EXPECT_FALSE(HasKey(decoder, "accountId"));
+    EXPECT_FALSE(HasKey(decoder, "notInPayload"));
+
+    // A full verify of the same license is not served the projected payload
+    ASSERT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+    EXPECT_TRUE(HasKey(decoder, "accountId"));
+
+    EXPECT_EQ(VerifyProjected(decoder, keyCtx, licenseB64, "9999", keys, 2), Tampered);
+    EXPECT_FALSE(HasKey(decoder, "eaName"));
+    EXPECT_EQ(VerifyProjected(decoder, keyCtx, licenseB64, accountId, nullptr, 2), Invalid);
+    EXPECT_EQ(VerifyProjected(decoder, nullptr, licenseB64, accountId, keys, 2), KeyError);
+}
+
+class SankeyLicenseWatchTest : public SankeyLicenseFileTest {
+protected:
+    bool waitForGeneration(int generation) {
+        for (int i = 0; i < 100; ++i) {
+            if (GetGeneration(decoder) >= generation) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        return false;
+    }
+};
+
+TEST_F(SankeyLicenseWatchTest, RenewalSwapsPayload) {
+    writeFile(licenseB64);
+    ASSERT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), accountId), Valid);
+    int generation = GetGeneration(decoder);
+    EXPECT_FALSE(HasKey(decoder, "renewed"));
+
+    ASSERT_TRUE(StartWatch(decoder, keyCtx, path.c_str(), accountId));
+    writeFile(renewedB64);
+    ASSERT_TRUE(waitForGeneration(generation + 1));
+    EXPECT_TRUE(GetValueAsBool(decoder, "renewed", false));
+    StopWatch(decoder);
+}
+
+TEST_F(SankeyLicenseWatchTest, UnverifiedRenewalKeepsPayload) {
+    writeFile(licenseB64);
+    ASSERT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), accountId), Valid);
+    int generation = GetGeneration(decoder);
+
+    ASSERT_TRUE(StartWatch(decoder, keyCtx, path.c_str(), accountId));
+    writeFile(licenseB64);                  // same digest: ignored
+    writeFile(std::string(licenseB64, 40)); // truncated: rejected
+    EXPECT_FALSE(waitForGeneration(generation + 1));
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "MyEA");
+}
+
+TEST_F(SankeyLicenseWatchTest, StartWatchErrors) {
+    EXPECT_FALSE(StartWatch(nullptr, keyCtx, path.c_str(), accountId));
+    EXPECT_FALSE(StartWatch(decoder, nullptr, path.c_str(), accountId));
+    EXPECT_FALSE(StartWatch(decoder, keyCtx, "no_such_dir/license.txt", accountId));
+    StopWatch(nullptr);
+}
+
+class SankeyLicenseTicketTest : public SankeyLicenseFileTest {
+protected:
+    void SetUp() override {
+        SankeyLicenseFileTest::SetUp();
+        ticketPath = (std::filesystem::temp_directory_path() / "sankey_ticket_test.bin").string();
+        std::filesystem::remove(ticketPath);
+        SetTicketPath(decoder, ticketPath.c_str());
+        writeFile(licenseB64);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(ticketPath);
+        SankeyLicenseFileTest::TearDown();
+    }
+
+    std::string ticketPath;
+};
+
+TEST_F(SankeyLicenseTicketTest, TicketWrittenAndReused) {
+    ASSERT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), accountId), Valid);
+    ASSERT_TRUE(std::filesystem::exists(ticketPath));
+
+    CSankeyLicenseDecoder* restarted = Create();
+    SetTicketPath(restarted, ticketPath.c_str());
+    EXPECT_EQ(VerifyFile(restarted, keyCtx, path.c_str(), accountId), Valid);
+    EXPECT_STREQ(GetValue(restarted, "eaName", ""), "MyEA");
+    EXPECT_GT(GetValueAsDateTime(restarted, "expiry", 0), 0);
+    Destroy(restarted);
+}
+
+TEST_F(SankeyLicenseTicketTest, TicketBoundToAccountAndLicense) {
+    ASSERT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), accountId), Valid);
+    EXPECT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), "9999"), Tampered);
+
+    writeFile(renewedB64);
+    ASSERT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), accountId), Valid);
+    EXPECT_TRUE(GetValueAsBool(decoder, "renewed", false));
+}
+
+TEST_F(SankeyLicenseTicketTest, TicketFromOtherKeyIgnored) {
+    ASSERT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), accountId), Valid);
+
+    CSankeyKeyContext* otherKey = CreateKeyContext("AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA=");
+    EXPECT_EQ(VerifyFile(decoder, otherKey, path.c_str(), accountId), Tampered);
+    DestroyKeyContext(otherKey);
+}
+
+TEST_F(SankeyLicenseTicketTest, CorruptTicketFallsBackToFullVerify) {
+    ASSERT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), accountId), Valid);
+
+    std::fstream ticket(ticketPath, std::ios::in | std::ios::out | std::ios::binary);
+    ticket.seekp(80);
+    ticket.put('\x7f');
+    ticket.close();
+
+    EXPECT_EQ(VerifyFile(decoder, keyCtx, path.c_str(), accountId), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "MyEA");
+}
+
+TEST_F(SankeyLicenseDecoderTest, ConcurrentIdenticalVerifiesAreCoalesced) {
+    const int kThreads = 12;
+    long long executedBefore = 0, coalescedBefore = 0;
+    GetCoalesceStats(&executedBefore, &coalescedBefore);
+
+    std::vector<CSankeyLicenseDecoder*> decoders(kThreads);
+    std::vector<int> results(kThreads, -1);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; ++i) {
+        decoders[i] = Create();
+        threads.emplace_back([&, i]() {
+            results[i] = Verify(decoders[i], masterKeyB64, licenseB64, accountId);
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    long long executed = 0, coalesced = 0;
+    GetCoalesceStats(&executed, &coalesced);
+    EXPECT_EQ((executed - executedBefore) + (coalesced - coalescedBefore), kThreads);
+
+    for (int i = 0; i < kThreads; ++i) {
+        EXPECT_EQ(results[i], Valid);
+        EXPECT_STREQ(GetValue(decoders[i], "eaName", ""), "MyEA");
+        Destroy(decoders[i]);
+    }
+}
+
+TEST_F(SankeyLicenseDecoderTest, EmptyProjectionNeverSharesAFullVerify) {
+    // An empty projection keeps only "expiry"; a full verify racing it must
+    // still get eaName, and the projected one must not
+    CSankeyKeyContext* keyCtx = CreateKeyContext(masterKeyB64);
+    ASSERT_NE(keyCtx, nullptr);
+    const char* nullKeys[] = {nullptr, nullptr};
+    for (int round = 0; round < 20; ++round) {
+        const int kThreads = 8;
+        std::vector<CSankeyLicenseDecoder*> decoders(kThreads);
+        std::vector<int> results(kThreads, -1);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; ++i) {
+            decoders[i] = Create();
+            threads.emplace_back([&, i]() {
+                results[i] = i % 2 ? VerifyProjected(decoders[i], keyCtx, licenseB64, accountId, i % 4 == 1 ? nullptr : nullKeys,
+                                                     i % 4 == 1 ? 0 : 2)
+                                   : Verify(decoders[i], masterKeyB64, licenseB64, accountId);
+            });
+        }
+        for (auto& t : threads) t.join();
+
+        for (int i = 0; i < kThreads; ++i) {
+            EXPECT_EQ(results[i], Valid);
+            EXPECT_EQ(HasKey(decoders[i], "eaName"), i % 2 == 0) << "thread " << i;
+            Destroy(decoders[i]);
+        }
+    }
+    DestroyKeyContext(keyCtx);
+}
+
+TEST_F(SankeyLicenseDecoderTest, UnreachableVerifyDaemonFallsBackInProcess) {
+    SetVerifyDaemon("\\\\.\\pipe\\sankey-verifyd-test-not-running");
+    EXPECT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "MyEA");
+    EXPECT_EQ(Verify(decoder, masterKeyB64, licenseB64, "5678"), Tampered);
+    SetVerifyDaemon(nullptr);
+}
+
+TEST_F(SankeyLicenseDecoderTest, KeyContextCacheReusesAndEvicts) {
+    long long hits = 0, misses = 0, evictions = 0;
+    GetKeyCacheStats(&hits, &misses, &evictions);
+
+    EXPECT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+    long long hitsAfter = 0, missesAfter = 0, evictionsAfter = 0;
+    GetKeyCacheStats(&hitsAfter, &missesAfter, &evictionsAfter);
+    EXPECT_GE(hitsAfter - hits, 1);
+
+    // One entry per shard; other products' keys push ours out
+    SetKeyCacheCapacity(1);
+    const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (char c : alphabet) {
+        std::string otherKeyB64 = std::string(1, c) + std::string(42, 'A') + "=";
+        EXPECT_EQ(Verify(decoder, otherKeyB64.c_str(), licenseB64, accountId), Tampered);
+    }
+    GetKeyCacheStats(&hits, &misses, &evictions);
+    EXPECT_GT(evictions, evictionsAfter);
+
+    // An evicted key is simply rebuilt
+    EXPECT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "MyEA");
+    SetKeyCacheCapacity(0);
+}
+
+class SankeyKeyringTest : public SankeyLicenseDecoderTest {
+protected:
+    // Issued by encryptLicenseV2 under masterKeyB64 (eaName "MyEA") and under
+    // rotatedKeyB64 (eaName "RotatedEA"); rotatedV1B64 is the v1 form of the latter
+    const char* v2LicenseB64 = "v2:ywXI0K555fziy9klvZRjH+Xt3dkqqF9KuVeDUCo+FNNmMxy0iwk8iLfj2c0ZgWDPy0DnIfbtv3vON1cEz6e0uz3MaZO3GjJWOKmlwn8DM62uZROdiIQfA3AuhF06VSWDZlUAnivyqCJVaLLt+D+/8ATBdLhsVPRxQrbskmnz+xHYbAqfA1T6Y4Y47lz/z/DjX8PGHdSCZmYAB1qPUgx25SbhsSf3GgpgATmOug61SlJTagHbEc+8di4zmtGZmse9pmrBM2xoz/E=";
+    const char* rotatedKeyB64 = "BwcHBwcHBwcHBwcHBwcHBwcHBwcHBwcHBwcHBwcHBwc=";
+    const char* rotatedV2B64 = "v2:S7Bvjk46dxVDnlql0Ow2zhe6flpo9MM7DmUq92OQhIhzj6sS6895Islrk+sASvLu/OaYLKCCBbqQNAc1gfiVlqR2WL+JLP6bvsPUX+ApqrEuhx5D1JHdhC2DoruN4foHIHtv0raLyQvItrY3ZJhaq18x0C6ADGyAAJ9fl2TOPryX9nh5GXqD37mdAv4TUzRoPTrD3txbr1r2GiW/RYJOHD+eX7FyneOeK1fMuSA1A0TbWdFS667sJTBLjiGW81D1SboLzyO6kHA=";
+    const char* rotatedV1B64 = "aNHt0SpvKTLy52O/pnb+dVgFSuzNSsCphmdWB0LZTeYEuCqjQD15vvlwkBVr19BjSU4w/bq9mrw/B8SxpceYcxlsriMq6btWo27polhmTxiIW8oWN1jrNCcqTq9GHLlfQ3CaRg5jDD1qZHLOxMo6psAGdPdkIh+Q45jOJTisibH7VOG3wGEseNMNxjc/fXyd9WvPTp4m0I15LpH/Rs7o82f8w2cWt0FiG2QN8Z2dSNLj+2WAIQ50wIaTLXkhI0wz";
+};
+
+TEST_F(SankeyKeyringTest, V2EnvelopeWithSingleKey) {
+    EXPECT_EQ(Verify(decoder, masterKeyB64, v2LicenseB64, accountId), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "MyEA");
+    EXPECT_EQ(Verify(decoder, masterKeyB64, v2LicenseB64, "5678"), Tampered);
+    EXPECT_EQ(Verify(decoder, rotatedKeyB64, v2LicenseB64, accountId), KeyError);
+}
+
+TEST_F(SankeyKeyringTest, KeyringSelectsKeyById) {
+    CSankeyKeyring* keyring = CreateKeyring();
+    ASSERT_NE(keyring, nullptr);
+    EXPECT_TRUE(AddKey(keyring, rotatedKeyB64));
+    EXPECT_TRUE(AddKey(keyring, masterKeyB64));
+    EXPECT_FALSE(AddKey(keyring, "not-a-key"));
+
+    EXPECT_EQ(VerifyWithKeyring(decoder, keyring, v2LicenseB64, accountId), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "MyEA");
+    EXPECT_EQ(VerifyWithKeyring(decoder, keyring, rotatedV2B64, accountId), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "RotatedEA");
+
+    // v1 licenses fall back to trying each key
+    EXPECT_EQ(VerifyWithKeyring(decoder, keyring, licenseB64, accountId), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "MyEA");
+    EXPECT_EQ(VerifyWithKeyring(decoder, keyring, rotatedV1B64, accountId), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "RotatedEA");
+    EXPECT_EQ(VerifyWithKeyring(decoder, keyring, rotatedV1B64, "5678"), Tampered);
+
+    DestroyKeyring(keyring);
+}
+
+TEST_F(SankeyKeyringTest, KeyringWithoutMatchingKey) {
+    CSankeyKeyring* keyring = CreateKeyring();
+    EXPECT_EQ(VerifyWithKeyring(decoder, keyring, licenseB64, accountId), KeyError);
+    ASSERT_TRUE(AddKey(keyring, rotatedKeyB64));
+    EXPECT_EQ(VerifyWithKeyring(decoder, keyring, v2LicenseB64, accountId), KeyError);
+    EXPECT_FALSE(HasKey(decoder, "eaName"));
+
+    EXPECT_EQ(VerifyWithKeyring(decoder, nullptr, v2LicenseB64, accountId), KeyError);
+    EXPECT_EQ(VerifyWithKeyring(decoder, keyring, nullptr, accountId), Invalid);
+    EXPECT_EQ(VerifyWithKeyring(nullptr, keyring, v2LicenseB64, accountId), Invalid);
+    DestroyKeyring(keyring);
+}
+
+TEST_F(SankeyKeyringTest, IdentifyAccountAmongCandidates) {
+    CSankeyKeyContext* keyCtx = CreateKeyContext(masterKeyB64);
+    ASSERT_NE(keyCtx, nullptr);
+
+    std::vector<std::string> accounts;
+    for (int i = 0; i < 5000; ++i) {
+        accounts.push_back(std::to_string(100000 + i));
+    }
+    accounts[4321] = accountId;
+    std::vector<const char*> candidates;
+    for (const std::string& account : accounts) {
+        candidates.push_back(account.c_str());
+    }
+
+    EXPECT_EQ(IdentifyAccount(keyCtx, licenseB64, candidates.data(), (int)candidates.size()), 4321);
+    EXPECT_EQ(IdentifyAccount(keyCtx, v2LicenseB64, candidates.data(), (int)candidates.size()), 4321);
+    EXPECT_EQ(IdentifyAccount(keyCtx, licenseB64, candidates.data(), 4321), -1);
+    EXPECT_EQ(IdentifyAccount(keyCtx, rotatedV2B64, candidates.data(), (int)candidates.size()), -1);
+
+    EXPECT_EQ(IdentifyAccount(nullptr, licenseB64, candidates.data(), 1), -1);
+    EXPECT_EQ(IdentifyAccount(keyCtx, nullptr, candidates.data(), 1), -1);
+    EXPECT_EQ(IdentifyAccount(keyCtx, licenseB64, nullptr, 1), -1);
+    EXPECT_EQ(IdentifyAccount(keyCtx, "not base64!", candidates.data(), 1), -1);
+    DestroyKeyContext(keyCtx);
+}
+
+class SankeyFleetLicenseTest : public SankeyLicenseDecoderTest {
+protected:
+    // encryptFleetLicense for accounts 1234, 3456, 5678, 7890, 9012 (eaName
+    // "FleetEA"): one body, each terminal gets its own inclusion proof
+    const char* fleet1234B64 = "f1:ywXI0K555fxfS8f2Uwn4quOYcdvBDdVf6FA7LFjIudQSk2PUugFFrgUAAACTyRdkhAsLZw4zKXDpcWoxSztrsYJCkqvJGdjmeK28wt9VL144Cu/OEpwEcKceBeclDhWgHCrDzpLvXtGYzgnXDK6Xj7MWFdOmbWAUW+QCyXRPQPpRAdyOsJXTTVEOH2TCqYukS2YB3ixERXP4Wzr8YcnHtNJYBSGXCL2vQL2zProRtRwHCCIfXQg23iN/3vEkpzPJvrxmDlqlW8lKu0RHdj9jPzuzKNJKQAGfy7jotGiGFI727xChUtQnuJ/l3sw=.AAAAAGBWycENLIqZ2itUtb5dRGYYPxRPMOTr7u/pKrng5v51+JS25V2vtd7NC0FuK+tIv5cwNlIRT2L2Fk3fE6Z4H9RVB01tiiCSGS/No2Fa7gWw23fqr+FHLRGXV5Tyn+swFA==";
+    const char* fleet9012B64 = "f1:ywXI0K555fxfS8f2Uwn4quOYcdvBDdVf6FA7LFjIudQSk2PUugFFrgUAAACTyRdkhAsLZw4zKXDpcWoxSztrsYJCkqvJGdjmeK28wt9VL144Cu/OEpwEcKceBeclDhWgHCrDzpLvXtGYzgnXDK6Xj7MWFdOmbWAUW+QCyXRPQPpRAdyOsJXTTVEOH2TCqYukS2YB3ixERXP4Wzr8YcnHtNJYBSGXCL2vQL2zProRtRwHCCIfXQg23iN/3vEkpzPJvrxmDlqlW8lKu0RHdj9jPzuzKNJKQAGfy7jotGiGFI727xChUtQnuJ/l3sw=.BAAAAAcbNqtFY3n5IE5HFK9jRd96dY7AYNxhObZ/swXtSgUM";
+};
+
+TEST_F(SankeyFleetLicenseTest, MemberAccountsVerify) {
+    EXPECT_EQ(Verify(decoder, masterKeyB64, fleet1234B64, "1234"), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "FleetEA");
+    // Odd leaf out: promoted up the tree, shorter proof
+    EXPECT_EQ(Verify(decoder, masterKeyB64, fleet9012B64, "9012"), Valid);
+}
+
+TEST_F(SankeyFleetLicenseTest, FlightsKeyedByEnvelopeTag) {
+    // Every envelope kind enters a flight keyed by its tag; text too short or
+    // malformed to carry one runs outside it
+    const char* v2 = "v2:ywXI0K555fziy9klvZRjH+Xt3dkqqF9KuVeDUCo+FNNmMxy0iwk8iLfj2c0ZgWDPy0DnIfbtv3vON1cEz6e0uz3MaZO3GjJWOKmlwn8DM62uZROdiIQfA3AuhF06VSWDZlUAnivyqCJVaLLt+D+/8ATBdLhsVPRxQrbskmnz+xHYbAqfA1T6Y4Y47lz/z/DjX8PGHdSCZmYAB1qPUgx25SbhsSf3GgpgATmOug61SlJTagHbEc+8di4zmtGZmse9pmrBM2xoz/E=";
+    auto flights = [] {
+        long long executed = 0, coalesced = 0;
+        GetCoalesceStats(&executed, &coalesced);
+        return executed + coalesced;
+    };
+    long long before = flights();
+    EXPECT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, v2, accountId), Valid);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, fleet1234B64, "1234"), Valid);
+    EXPECT_EQ(flights(), before + 3);
+
+    EXPECT_EQ(Verify(decoder, masterKeyB64, "dG9vIHNob3J0", accountId), Invalid);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, "v2:ywXI0K555fzi", accountId), Invalid);
+    EXPECT_EQ(flights(), before + 3);
+
+    // Same length, body and tag, altered proof: keyed apart, so each gets its
+    // own outcome even when verified together
+    std::string forged = fleet1234B64;
+    forged[forged.size() - 4] = forged[forged.size() - 4] == 'A' ? 'B' : 'A';
+    for (int round = 0; round < 20; ++round) {
+        const int kThreads = 8;
+        std::vector<CSankeyLicenseDecoder*> decoders(kThreads);
+        std::vector<int> results(kThreads, -1);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; ++i) {
+            decoders[i] = Create();
+            threads.emplace_back([&, i]() {
+                results[i] = Verify(decoders[i], masterKeyB64, i % 2 ? forged.c_str() : fleet1234B64, "1234");
+            });
+        }
+        for (auto& t : threads) t.join();
+
+        for (int i = 0; i < kThreads; ++i) {
+            EXPECT_EQ(results[i] == Valid, i % 2 == 0) << "thread " << i;
+            Destroy(decoders[i]);
+        }
+    }
+}
+
+TEST_F(SankeyFleetLicenseTest, ProofBindsOneAccount) {
+    // 5678 is in the fleet, but this proof is for 1234
+    EXPECT_EQ(Verify(decoder, masterKeyB64, fleet1234B64, "5678"), Tampered);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, fleet1234B64, "1111"), Tampered);
+    EXPECT_FALSE(HasKey(decoder, "eaName"));
+
+    // Proof of another member spliced onto the body
+    std::string body(fleet1234B64, strchr(fleet1234B64, '.'));
+    std::string spliced = body + strchr(fleet9012B64, '.');
+    EXPECT_EQ(Verify(decoder, masterKeyB64, spliced.c_str(), "1234"), Tampered);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, spliced.c_str(), "9012"), Valid);
+
+    EXPECT_EQ(Verify(decoder, masterKeyB64, body.c_str(), "1234"), Invalid);
+    EXPECT_EQ(Verify(decoder, "BwcHBwcHBwcHBwcHBwcHBwcHBwcHBwcHBwcHBwcHBwc=", fleet1234B64, "1234"), KeyError);
+}
+
+TEST_F(SankeyFleetLicenseTest, IdentifyAccountUsesProof) {
+    CSankeyKeyContext* keyCtx = CreateKeyContext(masterKeyB64);
+    const char* candidates[] = {"5678", "9012", "1234"};
+    EXPECT_EQ(IdentifyAccount(keyCtx, fleet1234B64, candidates, 3), 2);
+    EXPECT_EQ(IdentifyAccount(keyCtx, fleet9012B64, candidates, 3), 1);
+    EXPECT_EQ(IdentifyAccount(keyCtx, fleet1234B64, candidates, 2), -1);
+    DestroyKeyContext(keyCtx);
+}
+
+class SankeyLicenseBundleTest : public SankeyLicenseFileTest {
+protected:
+    void writeBundle(const std::vector<std::pair<std::string, std::string>>& entries) {
+        std::vector<unsigned char> bundle;
+        std::string error;
+        ASSERT_TRUE(CLicenseBundle::build(entries, bundle, error)) << error;
+        writeFile(std::string(bundle.begin(), bundle.end()));
+    }
+};
+
+TEST_F(SankeyLicenseBundleTest, LookupFindsEveryEntry) {
+    // Every tree shape up to a few levels, including incomplete last levels
+    for (int n = 1; n <= 70; ++n) {
+        std::vector<std::pair<std::string, std::string>> entries;
+        for (int i = 0; i < n; ++i) {
+            entries.emplace_back(std::to_string(5000 + i * 7), "license-" + std::to_string(i));
+        }
+        std::vector<unsigned char> bundle;
+        std::string error;
+        ASSERT_TRUE(CLicenseBundle::build(entries, bundle, error));
+
+        for (int i = 0; i < n; ++i) {
+            const char* license = nullptr;
+            size_t licenseLen = 0;
+            ASSERT_TRUE(CLicenseBundle::find(bundle.data(), bundle.size(), entries[i].first.c_str(), license, licenseLen));
+            EXPECT_EQ(std::string(license, licenseLen), entries[i].second);
+        }
+        const char* license = nullptr;
+        size_t licenseLen = 0;
+        EXPECT_FALSE(CLicenseBundle::find(bundle.data(), bundle.size(), "5001", license, licenseLen));
+        EXPECT_FALSE(CLicenseBundle::find(bundle.data(), bundle.size(), "", license, licenseLen));
+
+        std::vector<CLicenseBundle::Entry> all;
+        ASSERT_TRUE(CLicenseBundle::entries(bundle.data(), bundle.size(), all));
+        ASSERT_EQ(all.size(), (size_t)n);
+        for (const CLicenseBundle::Entry& entry : all) {
+            ASSERT_TRUE(CLicenseBundle::find(bundle.data(), bundle.size(), std::string(entry.accountId, entry.accountIdLen).c_str(),
+                                             license, licenseLen));
+            EXPECT_EQ(std::string(license, licenseLen), std::string(entry.license, entry.licenseLen));
+        }
+    }
+}
+
+TEST_F(SankeyLicenseBundleTest, VerifyFromBundle) {
+    std::vector<std::pair<std::string, std::string>> entries;
+    for (int i = 0; i < 1000; ++i) {
+        entries.emplace_back(std::to_string(100000 + i), "bm90IGEgbGljZW5zZQ==");
+    }
+    entries.emplace_back(accountId, licenseB64);
+    writeBundle(entries);
+
+    EXPECT_EQ(VerifyFromBundle(decoder, keyCtx, path.c_str(), accountId), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "MyEA");
+    EXPECT_EQ(VerifyFromBundle(decoder, keyCtx, path.c_str(), "100500"), Invalid);
+    EXPECT_EQ(VerifyFromBundle(decoder, keyCtx, path.c_str(), "5555"), Invalid);
+    EXPECT_FALSE(HasKey(decoder, "eaName"));
+
+    EXPECT_EQ(VerifyFromBundle(decoder, nullptr, path.c_str(), accountId), KeyError);
+    EXPECT_EQ(VerifyFromBundle(decoder, keyCtx, nullptr, accountId), Invalid);
+    EXPECT_EQ(VerifyFromBundle(nullptr, keyCtx, path.c_str(), accountId), Invalid);
+
+    // A plain license file is not a bundle
+    writeFile(licenseB64);
+    EXPECT_EQ(VerifyFromBundle(decoder, keyCtx, path.c_str(), accountId), Invalid);
+}
+
+TEST_F(SankeyLicenseBundleTest, BuildRejectsDuplicates) {
+    std::vector<unsigned char> bundle;
+    std::string error;
+    EXPECT_FALSE(CLicenseBundle::build({{"1234", "a"}, {"5678", "b"}, {"1234", "c"}}, bundle, error));
+    EXPECT_NE(error.find("duplicate"), std::string::npos);
+    EXPECT_FALSE(CLicenseBundle::build({}, bundle, error));
+}
+
+class VerifiedDigestStoreTest : public SankeyLicenseFileTest {
+protected:
+    CVerifiedDigestStore::Key key(int i) {
+        CVerifiedDigestStore::Key k;
+        std::string license = "license-" + std::to_string(i);
+        keyCtx->sha256(license.data(), license.size(), k.licenseDigest);
+        keyCtx->sha256(accountId, strlen(accountId), k.accountDigest);
+        memcpy(k.keyId, keyCtx->keyId(), CSankeyKeyContext::kKeyIdLen);
+        return k;
+    }
+
+    CVerifiedDigestStore::Record record(int i) {
+        CVerifiedDigestStore::Record r = {};
+        r.status = i % 2 ? Expired : Valid;
+        r.expiry = 1700000000 + i;
+        r.verifiedAt = 1690000000;
+        return r;
+    }
+};
+
+TEST_F(VerifiedDigestStoreTest, RecordsPersistAcrossGrowthAndReopen) {
+    {
+        CVerifiedDigestStore store;
+        ASSERT_TRUE(store.open(path.c_str()));
+        EXPECT_EQ(store.size(), 0u);
+        // Past half of the initial 1024 slots, so the table is rebuilt at least once
+        for (int i = 0; i < 3000; ++i) {
+            ASSERT_TRUE(store.put(*keyCtx, key(i), record(i)));
+        }
+        EXPECT_EQ(store.size(), 3000u);
+        ASSERT_TRUE(store.flush());
+    }
+
+    CVerifiedDigestStore store;
+    ASSERT_TRUE(store.open(path.c_str()));
+    EXPECT_EQ(store.size(), 3000u);
+    for (int i = 0; i < 3000; ++i) {
+        CVerifiedDigestStore::Record r;
+        ASSERT_TRUE(store.find(*keyCtx, key(i), r));
+        EXPECT_EQ(r.status, record(i).status);
+        EXPECT_EQ(r.expiry, record(i).expiry);
+    }
+    CVerifiedDigestStore::Record r;
+    EXPECT_FALSE(store.find(*keyCtx, key(3000), r));
+
+    // Same bytes under another key are a different record
+    CSankeyKeyContext* otherKey = CreateKeyContext("AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA=");
+    ASSERT_NE(otherKey, nullptr);
+    CVerifiedDigestStore::Key k = key(0);
+    memcpy(k.keyId, otherKey->keyId(), CSankeyKeyContext::kKeyIdLen);
+    EXPECT_FALSE(store.find(*otherKey, k, r));
+    DestroyKeyContext(otherKey);
+}
+
+TEST_F(VerifiedDigestStoreTest, EditedRecordIsAMiss) {
+    {
+        CVerifiedDigestStore store;
+        ASSERT_TRUE(store.open(path.c_str()));
+        CVerifiedDigestStore::Record tampered = record(0);
+        tampered.status = Tampered;
+        ASSERT_TRUE(store.put(*keyCtx, key(0), tampered));
+    }
+
+    // Flip the stored status to Valid without the MAC key
+    std::string bytes;
+    {
+        std::ifstream in(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    size_t edited = 0;
+    for (size_t off = CVerifiedDigestStore::kHeaderSize; off + CVerifiedDigestStore::kSlotSize <= bytes.size();
+         off += CVerifiedDigestStore::kSlotSize) {
+        if (bytes[off] == 1) {
+            bytes[off + 4] = (char)Valid;
+            ++edited;
+        }
+    }
+    ASSERT_EQ(edited, 1u);
+    writeFile(bytes);
+
+    CVerifiedDigestStore store;
+    ASSERT_TRUE(store.open(path.c_str()));
+    CVerifiedDigestStore::Record r;
+    EXPECT_FALSE(store.find(*keyCtx, key(0), r));
+
+    // A re-verify overwrites it in place
+    ASSERT_TRUE(store.put(*keyCtx, key(0), record(0)));
+    EXPECT_EQ(store.size(), 1u);
+    ASSERT_TRUE(store.find(*keyCtx, key(0), r));
+    EXPECT_EQ(r.status, Valid);
+
+    // Anything that is not a store is started over
+    writeFile("not a store");
+    ASSERT_TRUE(store.open(path.c_str()));
+    EXPECT_EQ(store.size(), 0u);
+}
+
+TEST_F(VerifiedDigestStoreTest, PruneDropsUnseenRecords) {
+    {
+        CVerifiedDigestStore store;
+        ASSERT_TRUE(store.open(path.c_str()));
+        for (int i = 0; i < 100; ++i) {
+            ASSERT_TRUE(store.put(*keyCtx, key(i), record(i)));
+        }
+    }
+
+    CVerifiedDigestStore store;
+    ASSERT_TRUE(store.open(path.c_str()));
+    CVerifiedDigestStore::Record r;
+    for (int i = 0; i < 100; i += 2) {
+        ASSERT_TRUE(store.find(*keyCtx, key(i), r));
+    }
+    ASSERT_TRUE(store.put(*keyCtx, key(100), record(100)));
+    EXPECT_EQ(store.prune(), 50u);
+    EXPECT_EQ(store.size(), 51u);
+    EXPECT_TRUE(store.find(*keyCtx, key(100), r));
+    EXPECT_TRUE(store.find(*keyCtx, key(98), r));
+    EXPECT_FALSE(store.find(*keyCtx, key(99), r));
+}
+
+TEST(LicenseBatchReaderTest, EveryModeDeliversEveryFileOnce) {
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "sankey_batch_reader_test";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    for (int i = 0; i < 300; ++i) {
+        std::filesystem::path dir = root / std::to_string(1000 + i);
+        std::filesystem::create_directory(dir);
+        // Mix of empty, small and larger-than-a-buffer files
+        size_t size = i == 7 ? 0 : i == 11 ? 100 * 1024 : 16 + i;
+        std::ofstream out(dir / "license.txt", std::ios::binary);
+        out << std::string(size, (char)('A' + i % 26));
+    }
+    std::filesystem::create_directory(root / "no-license");
+
+    std::vector<CLicenseBatchReader::File> files;
+    ASSERT_TRUE(CLicenseBatchReader::scan(root.string().c_str(), files));
+    ASSERT_EQ(files.size(), 301u);
+
+    for (CLicenseBatchReader::Mode mode : {CLicenseBatchReader::Plain, CLicenseBatchReader::Pool, CLicenseBatchReader::Iocp}) {
+        CLicenseBatchReader reader(mode, 8, 4);
+        std::map<std::string, int> calls;
+        size_t failed = 0;
+        ASSERT_TRUE(reader.run(files, [&](const CLicenseBatchReader::File& file, const unsigned char* data, size_t size, bool ok) {
+            ++calls[file.accountId];
+            if (!ok) {
+                ++failed;
+                EXPECT_EQ(file.accountId, "no-license");
+                return;
+            }
+            int i = std::stoi(file.accountId) - 1000;
+            size_t expected = i == 7 ? 0 : i == 11 ? 100 * 1024 : 16 + i;
+            ASSERT_EQ(size, expected) << CLicenseBatchReader::modeName(mode);
+            EXPECT_TRUE(std::all_of(data, data + size, [i](unsigned char c) { return c == 'A' + i % 26; }));
+        }));
+        EXPECT_EQ(calls.size(), 301u) << CLicenseBatchReader::modeName(mode);
+        EXPECT_TRUE(std::all_of(calls.begin(), calls.end(), [](const std::pair<const std::string, int>& c) { return c.second == 1; }));
+        EXPECT_EQ(failed, 1u);
+    }
+    std::filesystem::remove_all(root);
+}
+
+TEST(NumaBatchExecutorTest, SharesCoverTheBatchOnce) {
+    for (bool numa : {true, false}) {
+        CNumaBatchExecutor executor(numa, 6);
+        ASSERT_FALSE(executor.nodes().empty());
+        const size_t count = 10000;
+        std::vector<std::atomic<int>> visits(count);
+        std::vector<std::pair<size_t, size_t>> shares(executor.nodes().size(), {0, 0});
+        std::atomic<bool> badWorker(false);
+
+        executor.run(
+            count, [&](size_t node, size_t begin, size_t end) { shares[node] = {begin, end}; },
+            [&](size_t node, unsigned worker, size_t index) {
+                if (worker >= executor.threadsOn(node) || index < shares[node].first || index >= shares[node].second) {
+                    badWorker = true;
+                }
+                ++visits[index];
+            });
+
+        EXPECT_FALSE(badWorker);
+        EXPECT_TRUE(std::all_of(visits.begin(), visits.end(), [](const std::atomic<int>& v) { return v == 1; }));
+        size_t covered = 0;
+        for (const std::pair<size_t, size_t>& share : shares) {
+            covered += share.second - share.first;
+        }
+        EXPECT_EQ(covered, count);
+
+        void* memory = executor.allocate(0, 4096);
+        ASSERT_NE(memory, nullptr);
+        memset(memory, 0xA5, 4096);
+        CNumaBatchExecutor::release(memory);
+    }
+}
+
+TEST_F(SankeyLicenseDecoderTest, RepeatedVerifiesHitShapeCache) {
+    ASSERT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+    long long hits = 0, misses = 0;
+    GetShapeCacheStats(&hits, &misses);
+
+    ASSERT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "MyEA");
+    long long hitsAfter = 0, missesAfter = 0;
+    GetShapeCacheStats(&hitsAfter, &missesAfter);
+    EXPECT_EQ(hitsAfter, hits + 1);
+    EXPECT_EQ(missesAfter, misses);
+}
+
+// v1 license (Base64 of iv || HMAC(iv || cipher || accountId) || cipher)
+// built with the decoder's own key context, for payloads too large to keep
+// under tests/data
+static std::string issueV1License(const CSankeyKeyContext& keyCtx, const std::string& payload, const char* accountId) {
+    std::vector<unsigned char> envelope(48 + payload.size() + 16);
+    unsigned char* iv = envelope.data();
+    unsigned char* cipher = envelope.data() + 48;
+    for (int i = 0; i < 16; ++i) iv[i] = (unsigned char)(i * 17);
+    memcpy(cipher, payload.data(), payload.size());
+
+    HCRYPTKEY hKey = 0;
+    DWORD cipherLen = (DWORD)payload.size();
+    bool ok = keyCtx.duplicateAesKey(hKey) && CryptSetKeyParam(hKey, KP_IV, iv, 0) &&
+              CryptEncrypt(hKey, 0, TRUE, 0, cipher, &cipherLen, (DWORD)(payload.size() + 16));
+    if (hKey) CryptDestroyKey(hKey);
+    HCRYPTHASH hHash = 0;
+    DWORD macLen = 32;
+    ok = ok && keyCtx.createHmac(hHash) && CryptHashData(hHash, iv, 16, 0) && CryptHashData(hHash, cipher, cipherLen, 0) &&
+         CryptHashData(hHash, reinterpret_cast<const BYTE*>(accountId), (DWORD)strlen(accountId), 0) &&
+         CryptGetHashParam(hHash, HP_HASHVAL, envelope.data() + 16, &macLen, 0);
+    if (hHash) CryptDestroyHash(hHash);
+    if (!ok) return "";
+    envelope.resize(48 + cipherLen);
+
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((envelope.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < envelope.size(); i += 3) {
+        uint32_t v = envelope[i] << 16;
+        if (i + 1 < envelope.size()) v |= envelope[i + 1] << 8;
+        if (i + 2 < envelope.size()) v |= envelope[i + 2];
+        out.push_back(alphabet[(v >> 18) & 63]);
+        out.push_back(alphabet[(v >> 12) & 63]);
+        out.push_back(i + 1 < envelope.size() ? alphabet[(v >> 6) & 63] : '=');
+        out.push_back(i + 2 < envelope.size() ? alphabet[v & 63] : '=');
+    }
+    return out;
+}
+
+TEST_F(SankeyLicenseDecoderTest, ParallelDecryptMatchesSingleThreaded) {
+    std::unique_ptr<CSankeyKeyContext> keyCtx(CSankeyKeyContext::create(masterKeyB64));
+    ASSERT_NE(keyCtx, nullptr);
+
+    // The cipher's bulk (all but its last 16 KB block) is 8,142,848 bytes,
+    // not a multiple of 16 * ranges for 31 ranges (32 threads)
+    std::string blob(8142848 + 1000 - 96, '\0');
+    for (size_t i = 0; i < blob.size(); ++i) blob[i] = (char)('a' + i % 26);
+    std::string payload = R"({"eaName":"BigEA","accountId":"1234","blob":")" + blob + R"(","expiry":"2037-12-31T23:59:59Z"})";
+    std::string license = issueV1License(*keyCtx, payload, accountId);
+    ASSERT_FALSE(license.empty());
+
+    for (unsigned threads : {1u, 2u, 3u, 7u, 32u}) {
+        CSankeyLicenseDecoder::setDecryptThreads(threads);
+        ASSERT_EQ(Verify(decoder, masterKeyB64, license.c_str(), accountId), Valid) << threads;
+        EXPECT_TRUE(GetValue(decoder, "blob", "") == blob) << threads;
+        EXPECT_EQ(Verify(decoder, masterKeyB64, license.c_str(), "9999"), Tampered) << threads;
+    }
+    CSankeyLicenseDecoder::setDecryptThreads(0);
+}
+
+TEST_F(SankeyLicenseDecoderTest, DecodeLocalTouchesNoProcessState) {
+    std::unique_ptr<CSankeyKeyContext> keyCtx(CSankeyKeyContext::create(masterKeyB64));
+    ASSERT_NE(keyCtx, nullptr);
+    long long hits = 0, misses = 0, executed = 0, coalesced = 0;
+    GetShapeCacheStats(&hits, &misses);
+    GetCoalesceStats(&executed, &coalesced);
+
+    CPayloadShapeCache shapes;
+    for (int i = 0; i < 2; ++i) {
+        VerifyOutcome outcome;
+        decoder->decodeLocal(*keyCtx, licenseB64, strlen(licenseB64), accountId, shapes, outcome);
+        ASSERT_EQ(outcome.status, Valid);
+        EXPECT_EQ((*outcome.payload)["eaName"], "MyEA");
+    }
+    EXPECT_EQ(shapes.hits(), 1);
+    EXPECT_EQ(shapes.misses(), 1);
+
+    // Expired {"expiry": "2020-01-01T00:00:00Z"}: the outcome carries the expiry
+    const char* expired = "fgjuOQDIn/avlxu2KCm9aXhS6KTHGEYy1SM80Y5XOQFxiEmOd1NBn6Sr6fzd1178Pfl356TmN7Z6T4M39TpKrDw2/Mkxgpjg7d7hCQ4G"
+                          "rucWXoxFH1ngAGjShXG5kHQ65N14+qGVXdcFHlMhDw+6OqKbJIk8gwEwaHeyYWG+aMY=";
+    VerifyOutcome outcome;
+    decoder->decodeLocal(*keyCtx, expired, strlen(expired), accountId, shapes, outcome);
+    EXPECT_EQ(outcome.status, Expired);
+    EXPECT_EQ(outcome.reason, ReasonExpired);
+    EXPECT_EQ(outcome.reasonArg, 1577836800);
+
+    long long hitsAfter = 0, missesAfter = 0, executedAfter = 0, coalescedAfter = 0;
+    GetShapeCacheStats(&hitsAfter, &missesAfter);
+    GetCoalesceStats(&executedAfter, &coalescedAfter);
+    EXPECT_EQ(hitsAfter, hits);
+    EXPECT_EQ(missesAfter, misses);
+    EXPECT_EQ(executedAfter, executed);
+    VerifyRecord record;
+    EXPECT_EQ(ReadDiagnostics(decoder, &record, 1), 0);
+    EXPECT_FALSE(HasKey(decoder, "eaName"));
+}
+
+TEST(PayloadShapeCacheTest, FastPathMatchesGeneralParser) {
+    CPayloadShapeCache& cache = CPayloadShapeCache::instance();
+    auto parse = [&](const std::string& text) { return cache.parse(text.data(), text.size()); };
+
+    const std::string learned = R"({"s":"a","u":1,"i":-2,"f":1.5,"b":true,"n":null,"a":[1,"]"],"o":{"k":"}"}})";
+    const std::string sameShape[] = {
+        R"({"s":"b\"q","u":123456789012,"i":-0,"f":2.5e3,"b":false,"n":null,"a":[],"o":{}})",
+        "{\"s\":\"\xC3\xA9\",\"u\":7,\"i\":-9,\"f\":-0.25,\"b\":true,\"n\":null,\"a\":[[2]],\"o\":{\"x\":[1]}}\r\n",
+    };
+    EXPECT_EQ(parse(learned), nlohmann::json::parse(learned));
+
+    long long hits = cache.hits();
+    for (const std::string& text : sameShape) {
+        EXPECT_EQ(parse(text), nlohmann::json::parse(text));
+    }
+    EXPECT_EQ(cache.hits(), hits + 2);
+
+    // Type, order or key-set changes fall back to the general parser
+    const std::string otherShapes[] = {
+        R"({"s":"a","u":1.5,"i":-2,"f":1.5,"b":true,"n":null,"a":[],"o":{}})",
+        R"({"u":1,"s":"a"})",
+        R"({"u":1,"s":"a","extra":0})",
+    };
+    long long misses = cache.misses();
+    for (const std::string& text : otherShapes) {
+        EXPECT_EQ(parse(text), nlohmann::json::parse(text));
+    }
+    EXPECT_EQ(cache.misses(), misses + 3);
+
+    // Malformed values are rejected as by the general parser
+    EXPECT_THROW(parse(R"({"u":01,"s":"a","extra":0})"), nlohmann::json::parse_error);
+    EXPECT_THROW(parse(R"({"u":1,"s":"a","extra":0)"), nlohmann::json::parse_error);
+}
+
+TEST(PayloadShapeCacheTest, StringStageMatchesGeneralParser) {
+    CPayloadShapeCache& cache = CPayloadShapeCache::instance();
+    auto doc = [](const std::string& s) { return "{\"s\":\"" + s + "\",\"n\":1}"; };
+    auto parse = [&](const std::string& text) { return cache.parse(text.data(), text.size()); };
+    parse(doc("learn"));
+
+    const std::string valid[] = {
+        "0123456789abcdef0123456789abcdef0123456789",
+        "0123456789abcdef\\\"0123456789abcdef\\\\",
+        "\\u00e9\\ud83d\\ude00\\/\\b\\f\\n\\r\\t",
+        "\xE6\x97\xA5\xE6\x9C\xAC\xE8\xAA\x9E and \xF0\x9F\x98\x80 past the first sixteen bytes",
+        "",
+    };
+    long long hits = cache.hits();
+    for (const std::string& s : valid) {
+        EXPECT_EQ(parse(doc(s)), nlohmann::json::parse(doc(s))) << s;
+    }
+    EXPECT_EQ(cache.hits(), hits + 5);
+
+    const std::string invalid[] = {
+        "\xC0\xAF",         // Overlong
+        "\xED\xA0\x80",     // Encoded surrogate
+        "\xF4\x90\x80\x80", // Above U+10FFFF
+        "\xE6\x97",         // Truncated
+        "\\udc00",          // Lone low surrogate
+        "\\ud800x",         // High surrogate without its pair
+        "0123456789abcdef\x01",
+        "\\x",
+    };
+    for (const std::string& s : invalid) {
+        EXPECT_THROW(parse(doc(s)), nlohmann::json::parse_error) << s;
+    }
+}
+
+TEST_F(SankeyLicenseDecoderTest, SchemaCheckedAtVerify) {
+    CSankeySchema* schema = CompileSchema(R"({
+        "type": "object",
+        "required": ["eaName", "accountId"],
+        "properties": {"eaName": {"type": "string", "minLength": 1, "maxLength": 16},
+                       "lots": {"type": "number", "minimum": 0}}
+    })");
+    ASSERT_NE(schema, nullptr);
+    SetSchema(decoder, schema);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "MyEA");
+
+    CSankeySchema* strict = CompileSchema(R"({"required": ["riskPercent"]})");
+    ASSERT_NE(strict, nullptr);
+    SetSchema(decoder, strict);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), SchemaError);
+    EXPECT_FALSE(HasKey(decoder, "eaName"));
+
+    SetSchema(decoder, nullptr);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+    DestroySchema(strict);
+    DestroySchema(schema);
+
+    EXPECT_EQ(CompileSchema(nullptr), nullptr);
+    EXPECT_EQ(CompileSchema("{"), nullptr);
+    EXPECT_EQ(CompileSchema(R"({"type": "array"})"), nullptr);
+    EXPECT_EQ(CompileSchema(R"({"properties": {"a": {"pattern": "x"}}})"), nullptr);
+    EXPECT_EQ(CompileSchema(R"({"properties": {"a": {"type": "float"}}})"), nullptr);
+}
+
+TEST_F(SankeyLicenseDecoderTest, IntegerSchemaMatchesIntegerGetter) {
+    // Payload {"maxTrades": 3, "maxLots": 3.0, ...}: a key the schema passes
+    // as "integer" must be one GetValueAsInt reads
+    const char* license =
+        "ud0glEYmmfeyvCZF8+dXhh2IUsDxxPeVZ4hcCuRQrVjID5X/IhjaHq5/ixgY2Re8f3DnaC/a0UQ4BFNukBrObilkkEf783HVKg5mM3w79ypL"
+        "D/jVlKx3XqeVbRVtUgdI0BS4CIaJ77Nqfmipr+U/4xB4e/AAbej96BGpz59qelUBjubG/HsYJ2mkZqCNcnTtK9A5UYBa2jtXPd61wn1Kow==";
+    CSankeySchema* trades = CompileSchema(R"({"required": ["maxTrades"], "properties": {"maxTrades": {"type": "integer"}}})");
+    CSankeySchema* lots = CompileSchema(R"({"required": ["maxLots"], "properties": {"maxLots": {"type": "integer"}}})");
+    CSankeySchema* lotsNumber = CompileSchema(R"({"required": ["maxLots"], "properties": {"maxLots": {"type": "number"}}})");
+    ASSERT_NE(trades, nullptr);
+    ASSERT_NE(lots, nullptr);
+    ASSERT_NE(lotsNumber, nullptr);
+
+    SetSchema(decoder, trades);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, license, accountId), Valid);
+    EXPECT_EQ(GetValueAsInt(decoder, "maxTrades", -1), 3);
+
+    SetSchema(decoder, lots);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, license, accountId), SchemaError);
+
+    SetSchema(decoder, lotsNumber);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, license, accountId), Valid);
+    EXPECT_EQ(GetValueAsDouble(decoder, "maxLots", -1.0), 3.0);
+    EXPECT_EQ(GetValueAsInt(decoder, "maxLots", -1), -1);
+
+    SetSchema(decoder, nullptr);
+    DestroySchema(lotsNumber);
+    DestroySchema(lots);
+    DestroySchema(trades);
+}
+
+TEST_F(SankeyLicenseDecoderTest, SchemaGettersReadTypedSlots) {
+    std::unique_ptr<CSankeyKeyContext> keyCtx(CSankeyKeyContext::create(masterKeyB64));
+    ASSERT_NE(keyCtx, nullptr);
+    std::string license = issueV1License(*keyCtx,
+        R"({"eaName":"SlotEA","accountId":"1234","maxTrades":7,"lots":0.25,"hedge":true,"mode":"2",)"
+        R"("start":"2024-01-02T03:04:05Z","tags":["a"],"extra":11,"expiry":"2037-12-31T23:59:59Z"})", accountId);
+    CSankeySchema* schema = CompileSchema(R"({
+        "required": ["eaName", "maxTrades", "eaName"],
+        "properties": {"eaName": {"type": "string"}, "maxTrades": {"type": "integer"}, "lots": {"type": "number"},
+                       "hedge": {"type": "boolean"}, "mode": {"type": ["integer", "string"]}, "start": {"type": "string"},
+                       "tags": {"type": "array"}, "comment": {"type": "string"}}
+    })");
+    ASSERT_NE(schema, nullptr);
+    SetSchema(decoder, schema);
+    ASSERT_EQ(Verify(decoder, masterKeyB64, license.c_str(), accountId), Valid);
+
+    EXPECT_STREQ(GetValue(decoder, "eaName", ""), "SlotEA");
+    EXPECT_EQ(GetValueAsInt(decoder, "maxTrades", -1), 7);
+    EXPECT_EQ(GetValueAsDouble(decoder, "maxTrades", -1.0), 7.0);
+    EXPECT_EQ(GetValueAsDouble(decoder, "lots", -1.0), 0.25);
+    EXPECT_EQ(GetValueAsInt(decoder, "lots", -1), -1);
+    EXPECT_TRUE(GetValueAsBool(decoder, "hedge", false));
+    EXPECT_TRUE(GetValueAsBool(decoder, "lots", false));
+    EXPECT_EQ(GetValueAsInt(decoder, "mode", -1), 2);
+    EXPECT_EQ(GetValueAsDateTime(decoder, "start", 0), 1704164645);
+    EXPECT_STREQ(GetValue(decoder, "tags", "none"), "none");
+    EXPECT_TRUE(HasKey(decoder, "tags"));
+
+    // Optional and absent, then keys the schema does not name
+    EXPECT_FALSE(HasKey(decoder, "comment"));
+    EXPECT_STREQ(GetValue(decoder, "comment", "none"), "none");
+    EXPECT_EQ(GetValueAsInt(decoder, "comment", 5), 5);
+    EXPECT_EQ(GetValueAsInt(decoder, "extra", -1), 11);
+    EXPECT_STREQ(GetValue(decoder, "accountId", ""), "1234");
+    EXPECT_FALSE(HasKey(decoder, "missing"));
+
+    SetSchema(decoder, nullptr);
+    DestroySchema(schema);
+}
+
+TEST_F(SankeyLicenseDecoderTest, SchemaOutlivesItsHandle) {
+    // The wrapper destroys the replaced schema right after SetSchema; the
+    // decoder's own reference keeps the one it is checking alive.
+    CSankeySchema* strict = CompileSchema(R"({"required": ["riskPercent"]})");
+    ASSERT_NE(strict, nullptr);
+    SetSchema(decoder, strict);
+    DestroySchema(strict);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), SchemaError);
+
+    std::atomic<bool> stop(false);
+    std::thread verifier([&] {
+        while (!stop.load()) {
+            int status = Verify(decoder, masterKeyB64, licenseB64, accountId);
+            EXPECT_TRUE(status == Valid || status == SchemaError) << status;
+        }
+    });
+    for (int i = 0; i < 200; ++i) {
+        CSankeySchema* schema = CompileSchema(i % 2 ? R"({"required": ["riskPercent"]})" : R"({"required": ["eaName"]})");
+        ASSERT_NE(schema, nullptr);
+        SetSchema(decoder, schema);
+        DestroySchema(schema);
+    }
+    stop.store(true);
+    verifier.join();
+
+    SetSchema(decoder, nullptr);
+    EXPECT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+}
+
+TEST(SankeySchemaTest, OpcodesCoverTypesRangesAndLengths) {
+    std::string error;
+    std::unique_ptr<CSankeySchema> schema(CSankeySchema::compile(R"({
+        "required": ["lots"],
+        "properties": {"lots": {"type": "integer", "minimum": 1, "maximum": 10},
+                       "label": {"type": ["string", "null"], "maxLength": 3},
+                       "flag": {"type": "boolean"}}
+    })", error));
+    ASSERT_NE(schema, nullptr) << error;
+
+    EXPECT_TRUE(schema->check(nlohmann::json::parse(R"({"lots": 5})")));
+    EXPECT_TRUE(schema->check(nlohmann::json::parse(R"({"lots": 5, "label": null, "flag": true})")));
+    EXPECT_FALSE(schema->check(nlohmann::json::parse(R"({"lots": 5.0})")));
+    EXPECT_TRUE(schema->check(nlohmann::json::parse("{\"lots\": 1, \"label\": \"\xC3\xA9\xC3\xA9\xC3\xA9\"}")));
+    EXPECT_FALSE(schema->check(nlohmann::json::parse(R"({"label": "a"})")));
+    EXPECT_FALSE(schema->check(nlohmann::json::parse(R"({"lots": 5.5})")));
+    EXPECT_FALSE(schema->check(nlohmann::json::parse(R"({"lots": 0})")));
+    EXPECT_FALSE(schema->check(nlohmann::json::parse(R"({"lots": 11})")));
+    EXPECT_FALSE(schema->check(nlohmann::json::parse(R"({"lots": 5, "label": "abcd"})")));
+    EXPECT_FALSE(schema->check(nlohmann::json::parse(R"({"lots": 5, "flag": "true"})")));
+    EXPECT_FALSE(schema->check(nlohmann::json::parse("[]")));
+}
+
+TEST_F(SankeyLicenseDecoderTest, TraceRecordsVerifyStages) {
+    std::string path = (std::filesystem::temp_directory_path() / "sankey_trace_test.json").string();
+    auto spanNames = [&]() {
+        EXPECT_TRUE(DumpTrace(path.c_str()));
+        std::ifstream in(path);
+        nlohmann::json trace = nlohmann::json::parse(in);
+        std::vector<std::string> names;
+        for (const nlohmann::json& event : trace["traceEvents"]) {
+            EXPECT_EQ(event["ph"], "X");
+            EXPECT_GE(event["dur"].get<double>(), 0.0);
+            names.push_back(event["name"].get<std::string>());
+        }
+        return names;
+    };
+
+    SetTracing(true);
+    CSankeyKeyContext* keyCtx = CreateKeyContext(masterKeyB64);
+    ASSERT_EQ(VerifyProjected(decoder, keyCtx, licenseB64, accountId, nullptr, 0), Valid);
+    GetValueAsInt(decoder, "eaName", 0);
+    SetTracing(false);
+    DestroyKeyContext(keyCtx);
+
+    std::vector<std::string> names = spanNames();
+    for (const char* stage : {"key decode", "verify", "license decode", "hmac+decrypt", "parse", "expiry", "GetValueAsInt"}) {
+        EXPECT_NE(std::find(names.begin(), names.end(), stage), names.end()) << stage;
+    }
+
+    // Nothing is recorded while tracing is off
+    GetValueAsInt(decoder, "eaName", 0);
+    EXPECT_EQ(spanNames().size(), names.size());
+    std::filesystem::remove(path);
+}
+
+TEST(TraceRecorderTest, ExitedThreadRingsAreCapped) {
+    const size_t retained = CTraceRecorder::kRetainedRings;
+    CTraceRecorder::setEnabled(true);
+    size_t before = CTraceRecorder::ringCount();
+    for (int round = 0; round < 20; ++round) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 16; ++t) {
+            threads.emplace_back([]() {
+                int64_t now = CTraceRecorder::now();
+                CTraceRecorder::record("short-lived", now, now + 1);
+            });
+        }
+        for (std::thread& t : threads) {
+            t.join();
+        }
+    }
+    CTraceRecorder::setEnabled(false);
+
+    // 320 threads came and went; only the most recent ones stay for dumps
+    EXPECT_LE(CTraceRecorder::ringCount(), before + retained);
+    std::string path = (std::filesystem::temp_directory_path() / "sankey_trace_cap_test.json").string();
+    ASSERT_TRUE(CTraceRecorder::dump(path.c_str()));
+    std::ifstream in(path);
+    nlohmann::json trace = nlohmann::json::parse(in);
+    size_t kept = 0;
+    for (const nlohmann::json& event : trace["traceEvents"]) {
+        kept += event["name"] == "short-lived";
+    }
+    EXPECT_GT(kept, 0u);
+    EXPECT_LE(kept, retained);
+    in.close();
+    std::filesystem::remove(path);
+}
+
+TEST_F(SankeyLicenseDecoderTest, DiagnosticsRecordFailureReasons) {
+    std::string license = licenseB64;
+    std::string badChar = license;
+    badChar[10] = '!';
+    std::string truncated = license.substr(0, license.size() - 1);
+
+    ASSERT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+    ASSERT_EQ(Verify(decoder, masterKeyB64, licenseB64, "9999"), Tampered);
+    ASSERT_EQ(Verify(decoder, masterKeyB64, badChar.c_str(), accountId), Invalid);
+    ASSERT_EQ(Verify(decoder, masterKeyB64, truncated.c_str(), accountId), Invalid);
+    ASSERT_EQ(Verify(decoder, "short", licenseB64, accountId), KeyError);
+
+    VerifyRecord records[8];
+    ASSERT_EQ(ReadDiagnostics(decoder, records, 8), 5);
+    EXPECT_EQ(records[0].status, Valid);
+    EXPECT_EQ(records[0].reason, ReasonNone);
+    EXPECT_EQ(records[0].licenseLen, (long long)license.size());
+    EXPECT_GT(records[0].payloadLen, 0);
+    EXPECT_GT(records[0].time, 0);
+    EXPECT_GE(records[0].durationUs, 0);
+    EXPECT_EQ(records[1].reason, ReasonTagMismatch);
+    EXPECT_EQ(records[2].reason, ReasonBase64Character);
+    EXPECT_EQ(records[2].reasonArg, 10);
+    EXPECT_EQ(records[3].reason, ReasonBase64Length);
+    EXPECT_EQ(records[3].reasonArg, (long long)truncated.size());
+    EXPECT_EQ(records[4].status, KeyError);
+    EXPECT_EQ(records[4].reason, ReasonKeyInvalid);
+
+    // Capacity keeps the most recent; the process ring saw the same verifies
+    ASSERT_EQ(ReadDiagnostics(decoder, records, 2), 2);
+    EXPECT_EQ(records[1].reason, ReasonKeyInvalid);
+    ASSERT_EQ(ReadDiagnostics(nullptr, records, 1), 1);
+    EXPECT_EQ(records[0].reason, ReasonKeyInvalid);
+    EXPECT_EQ(ReadDiagnostics(decoder, nullptr, 8), 0);
+}
+
+TEST(VerifyLogTest, RingKeepsNewestRecordsAcrossThreads) {
+    CVerifyLog log(16);
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; ++t) {
+        writers.emplace_back([&log, t] {
+            for (int i = 0; i < 1000; ++i) {
+                VerifyRecord record = {};
+                record.reasonArg = i;
+                record.threadId = t;
+                log.record(record);
+            }
+        });
+    }
+    VerifyRecord records[16];
+    for (int i = 0; i < 100; ++i) {
+        EXPECT_LE(log.read(records, 16), 16); // Reads alongside writers
+    }
+    for (std::thread& writer : writers) {
+        writer.join();
+    }
+
+    // A writer lapped mid-write drops its record, so allow for gaps
+    int count = log.read(records, 16);
+    ASSERT_GT(count, 0);
+    int last[4] = {-1, -1, -1, -1};
+    for (int i = 0; i < count; ++i) {
+        const VerifyRecord& record = records[i];
+        ASSERT_GE(record.threadId, 0);
+        ASSERT_LT(record.threadId, 4);
+        EXPECT_GT(record.reasonArg, last[record.threadId]); // Per-thread order survives
+        last[record.threadId] = (int)record.reasonArg;
+    }
+}
+
+TEST(KernelDispatchTest, KernelsAgreeWithScalar) {
+    CKernelDispatch::Tier detected = CKernelDispatch::instance().detected();
+    std::vector<CKernelDispatch::FindSpecialFn> kernels = {CJsonString::findSpecialScalar};
+    if (detected >= CKernelDispatch::Sse2) kernels.push_back(CJsonString::findSpecialSse2);
+    if (detected >= CKernelDispatch::Avx2) kernels.push_back(CJsonString::findSpecialAvx2);
+
+    // One special byte at every offset of strings that straddle the 16/32-byte steps
+    const char specials[] = {'"', '\\', '\x01', '\x1f', '\x80', '\xff'};
+    for (size_t len = 0; len <= 70; ++len) {
+        for (size_t at = 0; at <= len; ++at) {
+            for (char special : specials) {
+                std::string text(len, 'a');
+                if (at < len) text[at] = special;
+                const char* expected = CJsonString::findSpecialScalar(text.data(), text.data() + len);
+                for (CKernelDispatch::FindSpecialFn kernel : kernels) {
+                    ASSERT_EQ(kernel(text.data(), text.data() + len), expected) << len << " " << at;
+                }
+            }
+        }
+    }
+}
+
+TEST_F(SankeyLicenseDecoderTest, KernelTierCanBeForced) {
+    auto info = []() {
+        std::vector<char> buffer(GetKernelInfo(nullptr, 0));
+        EXPECT_EQ(GetKernelInfo(buffer.data(), (int)buffer.size()), (int)buffer.size());
+        return nlohmann::json::parse(buffer.data());
+    };
+
+    nlohmann::json detected = info();
+    EXPECT_EQ(detected["active"], detected["detected"]);
+    EXPECT_FALSE(detected["forced"].get<bool>());
+    EXPECT_EQ(detected["kernels"]["aes-cbc"], "cryptoapi");
+
+    ASSERT_TRUE(SetKernelTier("scalar"));
+    nlohmann::json forced = info();
+    EXPECT_EQ(forced["active"], "scalar");
+    EXPECT_EQ(forced["kernels"]["json-string"], "scalar");
+    EXPECT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+    EXPECT_EQ(GetValue(decoder, "eaName", ""), std::string("MyEA"));
+
+    EXPECT_FALSE(SetKernelTier("mmx"));
+    EXPECT_EQ(info()["active"], "scalar");
+    ASSERT_TRUE(SetKernelTier(nullptr));
+    EXPECT_EQ(info()["active"], detected["detected"]);
+
+    char tiny[4];
+    EXPECT_GT(GetKernelInfo(tiny, sizeof(tiny)), (int)sizeof(tiny));
+}
+
+TEST_F(SankeyLicenseDecoderTest, WarmupSelfVerifiesWithoutSideEffects) {
+    long long hits = 0, misses = 0, executed = 0, coalesced = 0;
+    GetShapeCacheStats(&hits, &misses);
+    GetCoalesceStats(&executed, &coalesced);
+    VerifyRecord before[1] = {};
+    int recorded = ReadDiagnostics(nullptr, before, 1);
+
+    EXPECT_TRUE(Warmup(false));
+    EXPECT_TRUE(Warmup(false)); // Later calls return the first outcome
+    EXPECT_TRUE(Warmup(true));
+
+    long long hitsAfter = 0, missesAfter = 0, executedAfter = 0, coalescedAfter = 0;
+    GetShapeCacheStats(&hitsAfter, &missesAfter);
+    GetCoalesceStats(&executedAfter, &coalescedAfter);
+    EXPECT_EQ(hitsAfter + missesAfter, hits + misses);
+    EXPECT_EQ(executedAfter, executed);
+    VerifyRecord after[1] = {};
+    EXPECT_EQ(ReadDiagnostics(nullptr, after, 1), recorded);
+    EXPECT_EQ(after[0].time, before[0].time);
+
+    EXPECT_FALSE(HasKey(decoder, "warmup"));
+    EXPECT_EQ(Verify(decoder, masterKeyB64, licenseB64, accountId), Valid);
+}
+
+TEST_F(SankeyLicenseDecoderTest, WarmupLicenseExpiryFitsWindowsLong) {
+    // The DLL's built-in warmup license; long is 32 bits on Windows, so an
+    // expiry past 2038-01-19 wraps negative there and warmup would always fail
+    const char* warmupKey = "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA=";
+    const char* warmupLicense = "z70C0eu7tTlJjLehk5nUE7VlH9JZ5jYt64iNjpksRpADunmtzmEWhCi9/LZnU52V"
+                                "2C4zb/vj9gyRNPdm7W/2r6+/Mu68tnWc0/pajVQjhwoFa6tZLdsKVW/BUUNQ2eHv";
+    ASSERT_EQ(Verify(decoder, warmupKey, warmupLicense, "warmup"), Valid);
+    long long expiry = GetValueAsDateTime(decoder, "expiry", 0);
+    EXPECT_GT(expiry, 0);
+    EXPECT_LE(expiry, (long long)INT32_MAX);
+}
@@ -0,0 +1,523 @@
+﻿// sankey-audit: nightly verification of every license in an archive.
+//
+//   sankey-audit (--bundle PATH | --dir PATH) --store PATH (--key BASE64 | --keys-file PATH)...
+//                [--report PATH] [--prune] [--full]
+//                [--reader iocp|pool|plain] [--window N] [--threads N]
+//                [--verify-threads N] [--no-numa]
+//   sankey-audit --dir PATH --bench-read [--window N] [--threads N]
+//
+// The archive is a license bundle, or a directory with one subdirectory
+// per account holding license.txt. Directories are read by a
+// CLicenseBatchReader (--reader, default iocp) with --window reads in
+// flight; --bench-read times each reader on the directory without
+// verifying (the first pass also warms the file cache, so run it twice).
+//
+// Outcomes are kept in a CVerifiedDigestStore keyed by (license digest,
+// account digest, key id). A license whose bytes, account and key match a
+// stored record is not decrypted again: only its expiry is re-evaluated
+// against the stored epoch, so a run costs one SHA-256 per license plus a
+// full verify of what changed since the last run. --full verifies
+// everything and refreshes the store; --prune drops records for licenses
+// no longer in the archive. --report writes one JSON object per license.
+//
+// Licenses the store cannot answer are queued and verified together by a
+// CNumaBatchExecutor: on a multi-socket host each node verifies its own
+// share with pinned threads, its own key contexts and node-local copies of
+// input and results, and the main thread merges them into the store.
+// Workers verify with CSankeyLicenseDecoder::decodeLocal and a shape cache
+// each, so nothing process-wide is shared on the hot path; the daemon is
+// never consulted, as the audit is the reference answer.
+// --no-numa runs the same batch on one unpinned pool for comparison.
+#include "SankeyDecoder.h"
+#include "CLicenseBatchReader.h"
+#include "CLicenseBundle.h"
+#include "CLicenseFileView.h"
+#include "CNumaBatchExecutor.h"
+#include "CPayloadShapeCache.h"
+#include "CSankeyKeyContext.h"
+#include "CSankeyKeyring.h"
+#include "CVerifiedDigestStore.h"
+#include "CVerifySingleFlight.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const char* const kStatusNames[] = {"Valid", "Expired", "Invalid", "Tampered", "KeyError", "DecryptionFailed",
+                                    "ParseError", "SchemaError"};
+const int kStatusCount = sizeof(kStatusNames) / sizeof(kStatusNames[0]);
+
+// Stored Valid/Expired outcomes are authentic payloads; only the clock moves them
+int reevaluate(int status, long long expiry, time_t now) {
+    if (status != Valid && status != Expired) {
+        return status;
+    }
+    return expiry > 0 && (long long)now > expiry ? Expired : Valid;
+}
+
+// A license the store could not answer, queued for the parallel verify
+struct PendingVerify {
+    std::string accountId;
+    std::string license;
+    CVerifiedDigestStore::Key key;
+    int keyIndex; // Key the envelope names, or -1 to try every key in order (v1)
+};
+
+struct VerifyResult {
+    int status;
+    int keyIndex; // Key that decided the outcome
+    long long expiry;
+    unsigned char payloadDigest[32];
+};
+
+// What one NUMA node's threads touch while verifying, all built on the node
+struct NodeState {
+    std::vector<std::unique_ptr<CSankeyKeyContext>> keys; // Replicas, in keyring order
+    std::vector<std::unique_ptr<CSankeyLicenseDecoder>> decoders; // One per worker
+    std::vector<std::unique_ptr<CPayloadShapeCache>> shapes;       // One per worker
+    char* input = nullptr; // The node's licenses, copied next to it
+    std::vector<size_t> offsets;
+    VerifyResult* results = nullptr;
+    size_t begin = 0;
+};
+
+class CAudit {
+private:
+    const CSankeyKeyring& keyring_;
+    const std::vector<std::string>& keyTexts_;
+    std::vector<std::shared_ptr<const CSankeyKeyContext>> keys_;
+    const CSankeyKeyContext& hasher_; // Digests are keyless; any provider will do
+    CVerifiedDigestStore& store_;
+    FILE* report_;
+    bool full_;
+    time_t now_;
+    std::vector<PendingVerify> pending_;
+
+    void verifyOne(NodeState& node, unsigned worker, size_t index);
+    void record(const std::string& accountId, int status, long long expiry, const char* source);
+
+public:
+    size_t cached = 0;
+    size_t verified = 0;
+    size_t stored = 0;
+    size_t unreadable = 0;
+    size_t byStatus[kStatusCount] = {};
+
+    CAudit(const CSankeyKeyring& keyring, const std::vector<std::string>& keyTexts, CVerifiedDigestStore& store, FILE* report,
+           bool full)
+        : keyring_(keyring), keyTexts_(keyTexts), keys_(keyring.keys()), hasher_(*keys_.front()), store_(store),
+          report_(report), full_(full), now_(time(nullptr)) {}
+
+    // Answers from the store, or queues the license for verifyPending
+    void check(const std::string& accountId, const char* license, size_t licenseLen);
+    void unreadableFile(const std::string& accountId);
+    // Verifies the queue across the executor's nodes, then stores and reports
+    // the results from this thread
+    bool verifyPending(const CNumaBatchExecutor& executor);
+    void writeReport(const std::string& accountId, const char* status, long long expiry, const char* source);
+};
+
+void CAudit::check(const std::string& accountId, const char* license, size_t licenseLen) {
+    PendingVerify item;
+    if (!hasher_.sha256(license, licenseLen, item.key.licenseDigest) ||
+        !hasher_.sha256(accountId.data(), accountId.size(), item.key.accountDigest)) {
+        unreadableFile(accountId);
+        return;
+    }
+
+    // v2 names its key; v1 may belong to any of them, in keyring order
+    item.keyIndex = -1;
+    unsigned char keyId[CSankeyKeyContext::kKeyIdLen];
+    if (CSankeyLicenseDecoder::envelopeKeyId(license, licenseLen, keyId)) {
+        for (size_t k = 0; k < keys_.size(); ++k) {
+            if (memcmp(keys_[k]->keyId(), keyId, sizeof(keyId)) == 0) {
+                item.keyIndex = (int)k;
+            }
+        }
+        if (item.keyIndex < 0) {
+            record(accountId, KeyError, 0, "verify");
+            return;
+        }
+    }
+
+    for (size_t k = 0; k < keys_.size() && !full_; ++k) {
+        if (item.keyIndex >= 0 && (size_t)item.keyIndex != k) {
+            continue;
+        }
+        CVerifiedDigestStore::Record hit;
+        memcpy(item.key.keyId, keys_[k]->keyId(), CSankeyKeyContext::kKeyIdLen);
+        if (store_.find(*keys_[k], item.key, hit)) {
+            ++cached;
+            record(accountId, reevaluate(hit.status, hit.expiry, now_), hit.expiry, "store");
+            return;
+        }
+    }
+
+    item.accountId = accountId;
+    item.license.assign(license, licenseLen);
+    pending_.push_back(std::move(item));
+}
+
+void CAudit::verifyOne(NodeState& node, unsigned worker, size_t index) {
+    const PendingVerify& item = pending_[index];
+    const char* license = node.input + node.offsets[index - node.begin];
+    size_t licenseLen = node.offsets[index - node.begin + 1] - node.offsets[index - node.begin];
+    CSankeyLicenseDecoder& decoder = *node.decoders[worker];
+    VerifyResult& result = node.results[index - node.begin];
+    memset(&result, 0, sizeof(result));
+
+    VerifyOutcome outcome;
+    size_t first = item.keyIndex < 0 ? 0 : (size_t)item.keyIndex;
+    size_t last = item.keyIndex < 0 ? node.keys.size() : first + 1;
+    for (size_t k = first; k < last; ++k) {
+        result.keyIndex = (int)k;
+        decoder.decodeLocal(*node.keys[k], license, licenseLen, item.accountId.c_str(), *node.shapes[worker], outcome);
+        if (outcome.status != Tampered) {
+            break;
+        }
+    }
+    result.status = outcome.status;
+
+    if (result.status == Valid) {
+        result.expiry = decoder.payloadExpiry(*outcome.payload);
+        std::string text = outcome.payload->dump();
+        node.keys[result.keyIndex]->sha256(text.data(), text.size(), result.payloadDigest);
+    } else if (result.status == Expired && outcome.reason == ReasonExpired) {
+        result.expiry = outcome.reasonArg;
+    }
+}
+
+bool CAudit::verifyPending(const CNumaBatchExecutor& executor) {
+    std::vector<NodeState> nodes(executor.nodes().size());
+    std::atomic<bool> prepared(true);
+
+    executor.run(
+        pending_.size(),
+        [&](size_t n, size_t begin, size_t end) {
+            NodeState& node = nodes[n];
+            node.begin = begin;
+            for (const std::string& text : keyTexts_) {
+                // Contexts carry the expanded AES/HMAC keys; built here, they live on this node
+                node.keys.emplace_back(CSankeyKeyContext::create(text.c_str()));
+                if (!node.keys.back()) {
+                    prepared = false;
+                    node.keys.clear();
+                    return;
+                }
+            }
+            for (unsigned w = 0; w < executor.threadsOn(n); ++w) {
+                node.decoders.emplace_back(new CSankeyLicenseDecoder());
+                node.shapes.emplace_back(new CPayloadShapeCache());
+            }
+
+            size_t bytes = 0;
+            node.offsets.push_back(0);
+            for (size_t i = begin; i < end; ++i) {
+                bytes += pending_[i].license.size();
+                node.offsets.push_back(bytes);
+            }
+            node.input = static_cast<char*>(executor.allocate(n, bytes));
+            node.results = static_cast<VerifyResult*>(executor.allocate(n, (end - begin) * sizeof(VerifyResult)));
+            if (!node.input || !node.results) {
+                prepared = false;
+                node.keys.clear();
+                return;
+            }
+            for (size_t i = begin; i < end; ++i) {
+                memcpy(node.input + node.offsets[i - begin], pending_[i].license.data(), pending_[i].license.size());
+            }
+        },
+        [&](size_t n, unsigned worker, size_t index) {
+            if (!nodes[n].keys.empty()) {
+                verifyOne(nodes[n], worker, index);
+            }
+        });
+
+    // Merge: the store and report are single-threaded
+    for (size_t n = 0; n < nodes.size() && prepared; ++n) {
+        NodeState& node = nodes[n];
+        size_t count = node.offsets.empty() ? 0 : node.offsets.size() - 1;
+        for (size_t i = node.begin; i < node.begin + count; ++i) {
+            PendingVerify& item = pending_[i];
+            const VerifyResult& result = node.results[i - node.begin];
+
+            // A v1 MAC mismatch under every loaded key may be a key we do not
+            // have yet, so only outcomes that belong to (license, key) are kept
+            if (item.keyIndex >= 0 || result.status != Tampered) {
+                CVerifiedDigestStore::Record entry;
+                entry.status = result.status;
+                entry.expiry = result.expiry;
+                entry.verifiedAt = (long long)now_;
+                memcpy(entry.payloadDigest, result.payloadDigest, sizeof(entry.payloadDigest));
+                const CSankeyKeyContext& keyCtx = *keys_[result.keyIndex];
+                memcpy(item.key.keyId, keyCtx.keyId(), CSankeyKeyContext::kKeyIdLen);
+                stored += store_.put(keyCtx, item.key, entry);
+            }
+            ++verified;
+            record(item.accountId, result.status, result.expiry, "verify");
+        }
+    }
+
+    for (NodeState& node : nodes) {
+        CNumaBatchExecutor::release(node.input);
+        CNumaBatchExecutor::release(node.results);
+    }
+    pending_.clear();
+    return prepared;
+}
+
+void CAudit::record(const std::string& accountId, int status, long long expiry, const char* source) {
+    ++byStatus[status];
+    writeReport(accountId, kStatusNames[status], expiry, source);
+}
+
+void CAudit::unreadableFile(const std::string& accountId) {
+    ++unreadable;
+    writeReport(accountId, "Unreadable", 0, "read");
+}
+
+void CAudit::writeReport(const std::string& accountId, const char* status, long long expiry, const char* source) {
+    if (!report_) {
+        return;
+    }
+    nlohmann::json line = {{"accountId", accountId}, {"status", status}, {"expiry", expiry}, {"source", source}};
+    fprintf(report_, "%s\n", line.dump().c_str());
+}
+
+// Reads every file with each reader and nothing else
+int benchRead(const std::vector<CLicenseBatchReader::File>& files, size_t window, unsigned threads) {
+    printf("%-6s %10s %12s %10s %10s\n", "reader", "files", "files/s", "MB/s", "failed");
+    for (CLicenseBatchReader::Mode mode : {CLicenseBatchReader::Plain, CLicenseBatchReader::Pool, CLicenseBatchReader::Iocp}) {
+        CLicenseBatchReader reader(mode, window, threads);
+        size_t bytes = 0;
+        size_t failed = 0;
+        Clock::time_point started = Clock::now();
+        bool ran = reader.run(files, [&](const CLicenseBatchReader::File&, const unsigned char*, size_t size, bool ok) {
+            bytes += size;
+            failed += !ok;
+        });
+        double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+        if (!ran) {
+            printf("%-6s unavailable\n", CLicenseBatchReader::modeName(mode));
+            continue;
+        }
+        printf("%-6s %10zu %12.0f %10.1f %10zu\n", CLicenseBatchReader::modeName(mode), files.size(),
+               files.size() / seconds, bytes / seconds / (1024.0 * 1024.0), failed);
+    }
+    return 0;
+}
+
+void usage() {
+    fprintf(stderr,
+            "usage: sankey-audit (--bundle PATH | --dir PATH) --store PATH (--key BASE64 | --keys-file PATH)...\n"
+            "                    [--report PATH] [--prune] [--full]\n"
+            "                    [--reader iocp|pool|plain] [--window N] [--threads N]\n"
+            "                    [--verify-threads N] [--no-numa]\n"
+            "       sankey-audit --dir PATH --bench-read [--window N] [--threads N]\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string bundlePath;
+    std::string dirPath;
+    std::string storePath;
+    std::string reportPath;
+    bool prune = false;
+    bool full = false;
+    bool benchReads = false;
+    CLicenseBatchReader::Mode readerMode = CLicenseBatchReader::Iocp;
+    size_t window = 64;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned verifyThreads = threads;
+    bool numa = true;
+    CSankeyKeyring keyring;
+    std::vector<std::string> keyTexts; // Distinct keys in keyring order, replicated per node
+    size_t badKeys = 0;
+    auto addKey = [&](const std::string& text) {
+        size_t before = keyring.keys().size();
+        if (!keyring.add(text.c_str())) {
+            ++badKeys;
+        } else if (keyring.keys().size() > before) {
+            keyTexts.push_back(text);
+        }
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--prune") {
+            prune = true;
+            continue;
+        }
+        if (arg == "--full") {
+            full = true;
+            continue;
+        }
+        if (arg == "--bench-read") {
+            benchReads = true;
+            continue;
+        }
+        if (arg == "--no-numa") {
+            numa = false;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (arg == "--bundle") {
+            bundlePath = value;
+        } else if (arg == "--dir") {
+            dirPath = value;
+        } else if (arg == "--store") {
+            storePath = value;
+        } else if (arg == "--report") {
+            reportPath = value;
+        } else if (arg == "--reader") {
+            if (!CLicenseBatchReader::parseMode(value, readerMode)) {
+                usage();
+                return 2;
+            }
+        } else if (arg == "--window") {
+            window = (size_t)std::max(1, atoi(value));
+        } else if (arg == "--threads") {
+            threads = (unsigned)std::max(1, atoi(value));
+        } else if (arg == "--verify-threads") {
+            verifyThreads = (unsigned)std::max(1, atoi(value));
+        } else if (arg == "--key") {
+            addKey(value);
+        } else if (arg == "--keys-file") {
+            std::ifstream in(value);
+            std::string line;
+            while (std::getline(in, line)) {
+                line.erase(line.find_last_not_of(" \t\r\n") + 1);
+                if (!line.empty() && line[0] != '#') {
+                    addKey(line);
+                }
+            }
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    std::vector<CLicenseBatchReader::File> files;
+    if (!dirPath.empty() && !CLicenseBatchReader::scan(dirPath.c_str(), files)) {
+        fprintf(stderr, "sankey-audit: cannot list %s\n", dirPath.c_str());
+        return 1;
+    }
+    if (benchReads) {
+        if (dirPath.empty()) {
+            usage();
+            return 2;
+        }
+        return benchRead(files, window, threads);
+    }
+
+    if (badKeys > 0) {
+        fprintf(stderr, "sankey-audit: ignoring %zu invalid master key(s)\n", badKeys);
+    }
+    if (bundlePath.empty() == dirPath.empty() || storePath.empty() || keyring.keys().empty()) {
+        usage();
+        return 2;
+    }
+
+    CLicenseFileView bundle;
+    std::vector<CLicenseBundle::Entry> entries;
+    if (!bundlePath.empty() &&
+        (!bundle.open(bundlePath.c_str()) || !CLicenseBundle::entries(bundle.data(), bundle.size(), entries))) {
+        fprintf(stderr, "sankey-audit: %s is not a license bundle\n", bundlePath.c_str());
+        return 1;
+    }
+    CVerifiedDigestStore store;
+    if (!store.open(storePath.c_str())) {
+        fprintf(stderr, "sankey-audit: cannot open store %s\n", storePath.c_str());
+        return 1;
+    }
+    FILE* report = nullptr;
+    if (!reportPath.empty() && !(report = fopen(reportPath.c_str(), "w"))) {
+        fprintf(stderr, "sankey-audit: cannot write %s\n", reportPath.c_str());
+        return 1;
+    }
+
+    Clock::time_point started = Clock::now();
+    CAudit audit(keyring, keyTexts, store, report, full);
+    size_t total = 0;
+    if (!bundlePath.empty()) {
+        for (const CLicenseBundle::Entry& entry : entries) {
+            audit.check(std::string(entry.accountId, entry.accountIdLen), entry.license, entry.licenseLen);
+        }
+        total = entries.size();
+    } else {
+        // Files are checked straight from the reader's buffers, one at a time
+        std::vector<char> narrowed;
+        CLicenseBatchReader reader(readerMode, window, threads);
+        bool ran = reader.run(files, [&](const CLicenseBatchReader::File& file, const unsigned char* data, size_t size, bool ok) {
+            const char* text = nullptr;
+            size_t textLen = 0;
+            if (ok && CLicenseFileView::text(data, size, text, textLen, narrowed)) {
+                audit.check(file.accountId, text, textLen);
+            } else {
+                audit.unreadableFile(file.accountId);
+            }
+        });
+        if (!ran) {
+            fprintf(stderr, "sankey-audit: %s reader failed\n", CLicenseBatchReader::modeName(readerMode));
+            return 1;
+        }
+        total = files.size();
+    }
+
+    CNumaBatchExecutor executor(numa, verifyThreads);
+    if (!audit.verifyPending(executor)) {
+        fprintf(stderr, "sankey-audit: cannot set up verify workers\n");
+        return 1;
+    }
+
+    size_t pruned = prune ? store.prune() : 0;
+    bool flushed = store.flush();
+    if (report) {
+        fclose(report);
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - started).count();
+
+    printf("licenses       %zu\n", total);
+    printf("from store     %zu\n", audit.cached);
+    printf("verified       %zu (%zu stored)\n", audit.verified, audit.stored);
+    printf("nodes          %zu (", executor.nodes().size());
+    for (size_t n = 0; n < executor.nodes().size(); ++n) {
+        printf("%s%u", n ? "+" : "", executor.threadsOn(n));
+    }
+    printf(" threads)\n");
+    if (audit.unreadable > 0) {
+        printf("unreadable     %zu\n", audit.unreadable);
+    }
+    if (prune) {
+        printf("pruned         %zu\n", pruned);
+    }
+    for (int s = 0; s < kStatusCount; ++s) {
+        if (audit.byStatus[s] > 0) {
+            printf("%-14s %zu\n", kStatusNames[s], audit.byStatus[s]);
+        }
+    }
+    printf("elapsed        %.3f s\n", seconds);
+
+    if (!flushed) {
+        fprintf(stderr, "sankey-audit: could not flush %s\n", storePath.c_str());
+        return 1;
+    }
+    return 0;
+}
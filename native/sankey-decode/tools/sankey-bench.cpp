@@ -0,0 +1,175 @@
+﻿// sankey-bench: verify and getter timings for one license, as an EA sees them.
+//
+//   sankey-bench --key BASE64 --license PATH --account ID [--schema PATH]
+//                [--verifies N] [--ticks N] [--get KEY[:TYPE]]... [--tier NAME]
+//
+// Verifies the license N times (no ticket, no daemon), then simulates N
+// ticks that each read every --get key with the getter for its TYPE
+// (string, int, double, bool or datetime; default string), the way OnTick
+// handlers poll license parameters. With --schema the verifies include the
+// schema check. --tier forces a SIMD kernel tier (scalar, sse2, sse4, avx2,
+// avx512) to A/B kernels; the kernels used are printed either way. For a
+// per-stage breakdown, record the run with the sankey.wprp ETW profile
+// copied next to this binary.
+#include "SankeyDecoder.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Getter {
+    std::string key;
+    std::string type;
+};
+
+bool readText(const char* path, std::string& text) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    std::ostringstream buffer;
+    buffer << in.rdbuf();
+    text = buffer.str();
+    text.erase(text.find_last_not_of(" \t\r\n") + 1);
+    return true;
+}
+
+double nanosSince(Clock::time_point start) {
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+void usage() {
+    fprintf(stderr,
+            "usage: sankey-bench --key BASE64 --license PATH --account ID [--schema PATH]\n"
+            "                    [--verifies N] [--ticks N] [--get KEY[:TYPE]]... [--tier NAME]\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string key, licensePath, accountId, schemaPath, tier;
+    int verifies = 1000;
+    int ticks = 1000000;
+    std::vector<Getter> getters;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (arg == "--key") {
+            key = value;
+        } else if (arg == "--license") {
+            licensePath = value;
+        } else if (arg == "--account") {
+            accountId = value;
+        } else if (arg == "--schema") {
+            schemaPath = value;
+        } else if (arg == "--verifies") {
+            verifies = std::max(1, atoi(value));
+        } else if (arg == "--ticks") {
+            ticks = std::max(1, atoi(value));
+        } else if (arg == "--tier") {
+            tier = value;
+        } else if (arg == "--get") {
+            std::string spec = value;
+            size_t colon = spec.rfind(':');
+            if (colon == std::string::npos) {
+                getters.push_back({spec, "string"});
+            } else {
+                getters.push_back({spec.substr(0, colon), spec.substr(colon + 1)});
+            }
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (key.empty() || licensePath.empty() || accountId.empty()) {
+        usage();
+        return 2;
+    }
+    if (getters.empty()) {
+        getters = {{"eaName", "string"}, {"accountId", "string"}, {"expiry", "datetime"}};
+    }
+
+    std::string license;
+    if (!readText(licensePath.c_str(), license)) {
+        fprintf(stderr, "sankey-bench: cannot read %s\n", licensePath.c_str());
+        return 1;
+    }
+
+    if (!tier.empty() && !SetKernelTier(tier.c_str())) {
+        fprintf(stderr, "sankey-bench: kernel tier %s is unknown or not supported by this CPU\n", tier.c_str());
+        return 1;
+    }
+    std::vector<char> kernels(GetKernelInfo(nullptr, 0));
+    GetKernelInfo(kernels.data(), (int)kernels.size());
+
+    CSankeySchema* schema = nullptr;
+    if (!schemaPath.empty()) {
+        std::string schemaJson;
+        if (!readText(schemaPath.c_str(), schemaJson) || !(schema = CompileSchema(schemaJson.c_str()))) {
+            fprintf(stderr, "sankey-bench: cannot compile schema %s\n", schemaPath.c_str());
+            return 1;
+        }
+    }
+
+    CSankeyLicenseDecoder* decoder = Create();
+    SetVerifyDaemon(nullptr);
+    SetSchema(decoder, schema);
+
+    int status = Valid;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < verifies && status == Valid; ++i) {
+        status = Verify(decoder, key.c_str(), license.c_str(), accountId.c_str());
+    }
+    double verifyNanos = nanosSince(start) / verifies;
+    if (status != Valid) {
+        fprintf(stderr, "sankey-bench: verify returned %d\n", status);
+        Destroy(decoder);
+        DestroySchema(schema);
+        return 1;
+    }
+
+    // Sum the results so the calls cannot be optimized away
+    double sink = 0;
+    start = Clock::now();
+    for (int t = 0; t < ticks; ++t) {
+        for (const Getter& getter : getters) {
+            const char* k = getter.key.c_str();
+            if (getter.type == "int") {
+                sink += GetValueAsInt(decoder, k, 0);
+            } else if (getter.type == "double") {
+                sink += GetValueAsDouble(decoder, k, 0.0);
+            } else if (getter.type == "bool") {
+                sink += GetValueAsBool(decoder, k, false);
+            } else if (getter.type == "datetime") {
+                sink += (double)GetValueAsDateTime(decoder, k, 0);
+            } else {
+                sink += GetValue(decoder, k, "")[0];
+            }
+        }
+    }
+    double tickNanos = nanosSince(start) / ticks;
+    size_t gets = getters.size();
+
+    printf("license   %zu bytes%s\n", license.size(), schema ? ", schema checked" : "");
+    printf("verify    %.1f us\n", verifyNanos / 1000.0);
+    printf("tick      %.1f ns (%zu getter calls, %.1f ns each)\n", tickNanos, gets, tickNanos / gets);
+    printf("kernels   %s\n", kernels.data());
+    printf("checksum  %.0f\n", sink);
+
+    Destroy(decoder);
+    DestroySchema(schema);
+    return 0;
+}
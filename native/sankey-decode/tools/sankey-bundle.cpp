@@ -0,0 +1,149 @@
+﻿// sankey-bundle: build a license bundle for VerifyFromBundle.
+//
+//   sankey-bundle INPUT OUTPUT
+//
+// INPUT is issuance output in any of these forms:
+//   - JSON array, or one JSON object per line, of license API responses
+//     ({"data": {"encryptedLicense": ..., "payload": {"accountId": ...}}}),
+//     their "data" objects, or {"accountId": ..., "license": ...}
+//   - JSON object mapping accountId to license (encryptFleetLicense)
+//   - text lines "accountId license" (whitespace separated, # comments)
+#include "CLicenseBundle.h"
+#include <nlohmann/json.hpp>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+typedef std::vector<std::pair<std::string, std::string>> Entries;
+
+bool addRecord(const nlohmann::json& record, Entries& entries) {
+    const nlohmann::json& item = record.contains("data") ? record["data"] : record;
+    if (!item.is_object()) {
+        return false;
+    }
+
+    std::string accountId;
+    std::string license;
+    if (item.contains("accountId") && item["accountId"].is_string()) {
+        accountId = item["accountId"].get<std::string>();
+    } else if (item.contains("payload") && item["payload"].is_object() && item["payload"].contains("accountId") &&
+               item["payload"]["accountId"].is_string()) {
+        accountId = item["payload"]["accountId"].get<std::string>();
+    }
+    if (item.contains("license") && item["license"].is_string()) {
+        license = item["license"].get<std::string>();
+    } else if (item.contains("encryptedLicense") && item["encryptedLicense"].is_string()) {
+        license = item["encryptedLicense"].get<std::string>();
+    }
+    if (accountId.empty() || license.empty()) {
+        return false;
+    }
+    entries.emplace_back(accountId, license);
+    return true;
+}
+
+bool parseJson(const std::string& text, Entries& entries) {
+    nlohmann::json doc = nlohmann::json::parse(text, nullptr, false);
+    if (doc.is_discarded()) {
+        // One response per line
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) {
+                continue;
+            }
+            nlohmann::json record = nlohmann::json::parse(line, nullptr, false);
+            if (record.is_discarded() || !addRecord(record, entries)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (doc.is_array()) {
+        for (const nlohmann::json& record : doc) {
+            if (!addRecord(record, entries)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (addRecord(doc, entries)) {
+        return true;
+    }
+    for (auto it = doc.begin(); it != doc.end(); ++it) {
+        if (!it.value().is_string()) {
+            return false;
+        }
+        entries.emplace_back(it.key(), it.value().get<std::string>());
+    }
+    return true;
+}
+
+bool parseText(const std::string& text, Entries& entries) {
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        std::string accountId;
+        std::string license;
+        if (!(fields >> accountId) || accountId[0] == '#') {
+            continue;
+        }
+        if (!(fields >> license)) {
+            return false;
+        }
+        entries.emplace_back(accountId, license);
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: sankey-bundle INPUT OUTPUT\n");
+        return 2;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in) {
+        fprintf(stderr, "sankey-bundle: cannot read %s\n", argv[1]);
+        return 1;
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string text = buffer.str();
+    if (text.size() >= 3 && text.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+        text.erase(0, 3);
+    }
+
+    Entries entries;
+    size_t first = text.find_first_not_of(" \t\r\n");
+    bool parsed = first != std::string::npos && (text[first] == '{' || text[first] == '[') ? parseJson(text, entries)
+                                                                                          : parseText(text, entries);
+    if (!parsed) {
+        fprintf(stderr, "sankey-bundle: %s is not recognised issuance output\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<unsigned char> bundle;
+    std::string error;
+    if (!CLicenseBundle::build(entries, bundle, error)) {
+        fprintf(stderr, "sankey-bundle: %s\n", error.c_str());
+        return 1;
+    }
+
+    std::ofstream out(argv[2], std::ios::binary | std::ios::trunc);
+    if (!out.write(reinterpret_cast<const char*>(bundle.data()), bundle.size())) {
+        fprintf(stderr, "sankey-bundle: cannot write %s\n", argv[2]);
+        return 1;
+    }
+    fprintf(stderr, "sankey-bundle: %zu licenses, %zu bytes\n", entries.size(), bundle.size());
+    return 0;
+}
@@ -0,0 +1,362 @@
+﻿// sankey-replay: drive the DLL's C exports with recorded or synthetic EA
+// call patterns and report per-export throughput and latency.
+//
+//   sankey-replay (--trace PATH | --key BASE64 --license PATH --account ID [--decoders N])
+//                 [--threads N] [--rate TICKS_PER_SEC] [--duration SEC] [--ticks N]
+//
+// A trace is text, one call per line (# starts a comment):
+//   verify DECODER KEY LICENSE ACCOUNT   init-time Verify; LICENSE may be @path
+//   tick DECODER EXPORT KEY              a call made on every tick, where EXPORT is
+//                                        GetValue, GetValueAsInt, GetValueAsBool,
+//                                        GetValueAsDouble, GetValueAsDateTime or HasKey
+// DECODER is any token; each one is a separate decoder handle, as each EA
+// instance in a terminal has its own. Without --trace, --decoders copies of
+// a typical EA (one license, five getters per tick) are synthesized.
+//
+// Decoders are spread over --threads threads (MT5 runs each chart's EA on
+// its own thread). Each thread ticks its decoders --rate times per second,
+// or back to back with --rate 0, for --duration seconds or --ticks ticks.
+// Every call goes through the exported C functions and is timed on its own.
+#include "SankeyDecoder.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+enum Export { ExpVerify, ExpGetValue, ExpGetValueAsInt, ExpGetValueAsBool, ExpGetValueAsDouble, ExpGetValueAsDateTime,
+              ExpHasKey, ExpCount };
+
+const char* const kExportNames[ExpCount] = {"Verify", "GetValue", "GetValueAsInt", "GetValueAsBool", "GetValueAsDouble",
+                                            "GetValueAsDateTime", "HasKey"};
+
+struct Call {
+    Export exp;
+    std::string key;
+};
+
+struct DecoderPlan {
+    std::string name;
+    std::string masterKey;
+    std::string license;
+    std::string accountId;
+    std::vector<Call> tick;
+    CSankeyLicenseDecoder* handle = nullptr;
+};
+
+// Log-linear latency histogram: 16 sub-buckets per power of two of
+// nanoseconds, so quantiles are within ~6% at any scale
+class LatencyHistogram {
+private:
+    static const int kSubBits = 4;
+    static const int kBuckets = 64 << kSubBits;
+    std::vector<long long> counts_;
+    long long total_ = 0;
+    long long max_ = 0;
+
+    static int bucketOf(long long ns) {
+        if (ns < (1 << kSubBits)) {
+            return (int)ns;
+        }
+        int log2 = 63;
+        while (!(ns >> log2)) --log2;
+        int shift = log2 - kSubBits;
+        return ((shift + 1) << kSubBits) + (int)((ns >> shift) & ((1 << kSubBits) - 1));
+    }
+
+    static long long upperBound(int bucket) {
+        if (bucket < (1 << kSubBits)) {
+            return bucket;
+        }
+        int shift = (bucket >> kSubBits) - 1;
+        long long sub = (bucket & ((1 << kSubBits) - 1)) | (1 << kSubBits);
+        return ((sub + 1) << shift) - 1;
+    }
+
+public:
+    LatencyHistogram() : counts_(kBuckets, 0) {}
+
+    void record(long long ns) {
+        ++counts_[std::min(bucketOf(std::max(0LL, ns)), kBuckets - 1)];
+        ++total_;
+        max_ = std::max(max_, ns);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < kBuckets; ++i) counts_[i] += other.counts_[i];
+        total_ += other.total_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    long long total() const { return total_; }
+    long long max() const { return max_; }
+
+    long long quantile(double q) const {
+        long long rank = (long long)std::ceil(q * total_);
+        long long seen = 0;
+        for (int i = 0; i < kBuckets; ++i) {
+            seen += counts_[i];
+            if (seen >= rank && counts_[i]) return std::min(upperBound(i), max_);
+        }
+        return max_;
+    }
+};
+
+struct ThreadResult {
+    LatencyHistogram latency[ExpCount];
+    long long ticks = 0;
+    long long failedVerifies = 0;
+};
+
+bool parseExport(const std::string& name, Export& exp) {
+    for (int i = ExpGetValue; i < ExpCount; ++i) {
+        if (name == kExportNames[i]) {
+            exp = (Export)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool readText(const std::string& path, std::string& text) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    std::ostringstream buffer;
+    buffer << in.rdbuf();
+    text = buffer.str();
+    text.erase(text.find_last_not_of(" \t\r\n") + 1);
+    return true;
+}
+
+bool loadTrace(const std::string& path, std::vector<DecoderPlan>& plans) {
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "sankey-replay: cannot read %s\n", path.c_str());
+        return false;
+    }
+
+    std::map<std::string, size_t> byName;
+    auto planFor = [&](const std::string& name) -> DecoderPlan& {
+        auto it = byName.find(name);
+        if (it == byName.end()) {
+            it = byName.emplace(name, plans.size()).first;
+            plans.emplace_back();
+            plans.back().name = name;
+        }
+        return plans[it->second];
+    };
+
+    std::string line;
+    for (int lineNo = 1; std::getline(in, line); ++lineNo) {
+        std::istringstream fields(line);
+        std::string op, decoder;
+        if (!(fields >> op) || op[0] == '#') {
+            continue;
+        }
+        fields >> decoder;
+        if (op == "verify") {
+            DecoderPlan& plan = planFor(decoder);
+            if (!(fields >> plan.masterKey >> plan.license >> plan.accountId)) {
+                fprintf(stderr, "sankey-replay: %s:%d: verify DECODER KEY LICENSE ACCOUNT\n", path.c_str(), lineNo);
+                return false;
+            }
+            if (plan.license[0] == '@' && !readText(plan.license.substr(1), plan.license)) {
+                fprintf(stderr, "sankey-replay: %s:%d: cannot read license file\n", path.c_str(), lineNo);
+                return false;
+            }
+        } else if (op == "tick") {
+            std::string name;
+            Call call;
+            if (!(fields >> name >> call.key) || !parseExport(name, call.exp)) {
+                fprintf(stderr, "sankey-replay: %s:%d: tick DECODER EXPORT KEY\n", path.c_str(), lineNo);
+                return false;
+            }
+            planFor(decoder).tick.push_back(call);
+        } else {
+            fprintf(stderr, "sankey-replay: %s:%d: unknown call %s\n", path.c_str(), lineNo, op.c_str());
+            return false;
+        }
+    }
+
+    for (const DecoderPlan& plan : plans) {
+        if (plan.license.empty()) {
+            fprintf(stderr, "sankey-replay: decoder %s has no verify line\n", plan.name.c_str());
+            return false;
+        }
+    }
+    return !plans.empty();
+}
+
+void runCall(CSankeyLicenseDecoder* decoder, const Call& call, LatencyHistogram* latency) {
+    const char* key = call.key.c_str();
+    Clock::time_point start = Clock::now();
+    switch (call.exp) {
+    case ExpGetValue: GetValue(decoder, key, ""); break;
+    case ExpGetValueAsInt: GetValueAsInt(decoder, key, 0); break;
+    case ExpGetValueAsBool: GetValueAsBool(decoder, key, false); break;
+    case ExpGetValueAsDouble: GetValueAsDouble(decoder, key, 0.0); break;
+    case ExpGetValueAsDateTime: GetValueAsDateTime(decoder, key, 0); break;
+    case ExpHasKey: HasKey(decoder, key); break;
+    default: break;
+    }
+    latency[call.exp].record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+void runThread(std::vector<DecoderPlan*> plans, double rate, Clock::time_point deadline, long long maxTicks,
+               ThreadResult& result) {
+    // Init: every EA verifies once when attached
+    for (DecoderPlan* plan : plans) {
+        plan->handle = Create();
+        Clock::time_point start = Clock::now();
+        int status = Verify(plan->handle, plan->masterKey.c_str(), plan->license.c_str(), plan->accountId.c_str());
+        result.latency[ExpVerify].record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        if (status != Valid) {
+            ++result.failedVerifies;
+        }
+    }
+
+    Clock::duration period = rate > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate))
+                                      : Clock::duration::zero();
+    Clock::time_point next = Clock::now();
+    while ((maxTicks == 0 || result.ticks < maxTicks) && Clock::now() < deadline) {
+        for (DecoderPlan* plan : plans) {
+            for (const Call& call : plan->tick) {
+                runCall(plan->handle, call, result.latency);
+            }
+        }
+        ++result.ticks;
+        if (rate > 0) {
+            next += period;
+            std::this_thread::sleep_until(next);
+        }
+    }
+
+    for (DecoderPlan* plan : plans) {
+        Destroy(plan->handle);
+        plan->handle = nullptr;
+    }
+}
+
+void usage() {
+    fprintf(stderr,
+            "usage: sankey-replay (--trace PATH | --key BASE64 --license PATH --account ID [--decoders N])\n"
+            "                     [--threads N] [--rate TICKS_PER_SEC] [--duration SEC] [--ticks N]\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string tracePath, masterKey, licensePath, accountId;
+    int decoders = 8;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    double rate = 0;
+    double duration = 10;
+    long long maxTicks = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (arg == "--trace") {
+            tracePath = value;
+        } else if (arg == "--key") {
+            masterKey = value;
+        } else if (arg == "--license") {
+            licensePath = value;
+        } else if (arg == "--account") {
+            accountId = value;
+        } else if (arg == "--decoders") {
+            decoders = std::max(1, atoi(value));
+        } else if (arg == "--threads") {
+            threads = (unsigned)std::max(1, atoi(value));
+        } else if (arg == "--rate") {
+            rate = std::max(0.0, atof(value));
+        } else if (arg == "--duration") {
+            duration = std::max(0.0, atof(value));
+        } else if (arg == "--ticks") {
+            maxTicks = std::max(0LL, atoll(value));
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    std::vector<DecoderPlan> plans;
+    if (!tracePath.empty()) {
+        if (!loadTrace(tracePath, plans)) {
+            return 1;
+        }
+    } else if (!masterKey.empty() && !licensePath.empty() && !accountId.empty()) {
+        DecoderPlan plan;
+        plan.masterKey = masterKey;
+        plan.accountId = accountId;
+        if (!readText(licensePath, plan.license)) {
+            fprintf(stderr, "sankey-replay: cannot read %s\n", licensePath.c_str());
+            return 1;
+        }
+        plan.tick = {{ExpHasKey, "eaName"}, {ExpGetValueAsBool, "trial"}, {ExpGetValueAsInt, "maxPositions"},
+                     {ExpGetValueAsDouble, "maxLots"}, {ExpGetValueAsDateTime, "expiry"}};
+        for (int i = 0; i < decoders; ++i) {
+            plan.name = "ea" + std::to_string(i);
+            plans.push_back(plan);
+        }
+    } else {
+        usage();
+        return 2;
+    }
+
+    // Round-robin, like charts spread over terminal threads
+    threads = std::min<unsigned>(threads, (unsigned)plans.size());
+    std::vector<std::vector<DecoderPlan*>> assigned(threads);
+    for (size_t i = 0; i < plans.size(); ++i) {
+        assigned[i % threads].push_back(&plans[i]);
+    }
+
+    SetVerifyDaemon(nullptr);
+    std::vector<ThreadResult> results(threads);
+    std::vector<std::thread> workers;
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(duration));
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back(runThread, assigned[t], rate, deadline, maxTicks, std::ref(results[t]));
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    ThreadResult total;
+    for (const ThreadResult& result : results) {
+        for (int i = 0; i < ExpCount; ++i) total.latency[i].merge(result.latency[i]);
+        total.ticks += result.ticks;
+        total.failedVerifies += result.failedVerifies;
+    }
+
+    printf("%zu decoder(s) on %u thread(s), %.2f s, %lld thread tick(s), %lld failed verify(s)\n\n",
+           plans.size(), threads, elapsed, total.ticks, total.failedVerifies);
+    printf("%-20s %12s %12s %10s %10s %10s %10s\n", "export", "calls", "calls/s", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+    for (int i = 0; i < ExpCount; ++i) {
+        const LatencyHistogram& h = total.latency[i];
+        if (h.total() == 0) {
+            continue;
+        }
+        printf("%-20s %12lld %12.0f %10lld %10lld %10lld %10lld\n", kExportNames[i], h.total(), h.total() / elapsed,
+               h.quantile(0.50), h.quantile(0.99), h.quantile(0.999), h.max());
+    }
+    return total.failedVerifies == 0 ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+﻿// sankey-startup: DLL load to first Valid, as a terminal starting an EA sees it.
+//
+//   sankey-startup --key BASE64 --license PATH --account ID [--dll PATH]
+//                  [--warmup none|sync|background]
+//
+// Loads the DLL with LoadLibrary (default SankeyDecoder.dll next to this
+// binary), resolves the exports and verifies the license twice, timing the
+// load, the optional Warmup call, the first and the second Verify, and load
+// to first Valid. A process measures one cold start, so run it repeatedly
+// for a distribution, e.g.
+//   for /L %i in (1,1,20) do sankey-startup --key ... --warmup sync
+// With --warmup background the verify starts right after Warmup(true), the
+// way an EA's OnInit would carry on with its own setup.
+#include "SankeyDecoder.h"
+#include <windows.h>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+typedef CSankeyLicenseDecoder* (*CreateFn)();
+typedef void (*DestroyFn)(CSankeyLicenseDecoder*);
+typedef int (*VerifyFn)(CSankeyLicenseDecoder*, const char*, const char*, const char*);
+typedef bool (*WarmupFn)(bool);
+
+bool readText(const char* path, std::string& text) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    std::ostringstream buffer;
+    buffer << in.rdbuf();
+    text = buffer.str();
+    text.erase(text.find_last_not_of(" \t\r\n") + 1);
+    return true;
+}
+
+double microsSince(Clock::time_point start) {
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count() / 1000.0;
+}
+
+void usage() {
+    fprintf(stderr,
+            "usage: sankey-startup --key BASE64 --license PATH --account ID [--dll PATH]\n"
+            "                      [--warmup none|sync|background]\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string key, licensePath, accountId, dllPath = "SankeyDecoder.dll", warmup = "none";
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (arg == "--key") {
+            key = value;
+        } else if (arg == "--license") {
+            licensePath = value;
+        } else if (arg == "--account") {
+            accountId = value;
+        } else if (arg == "--dll") {
+            dllPath = value;
+        } else if (arg == "--warmup") {
+            warmup = value;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (key.empty() || licensePath.empty() || accountId.empty() ||
+        (warmup != "none" && warmup != "sync" && warmup != "background")) {
+        usage();
+        return 2;
+    }
+
+    std::string license;
+    if (!readText(licensePath.c_str(), license)) {
+        fprintf(stderr, "sankey-startup: cannot read %s\n", licensePath.c_str());
+        return 1;
+    }
+
+    Clock::time_point start = Clock::now();
+    HMODULE dll = LoadLibraryA(dllPath.c_str());
+    double loadMicros = microsSince(start);
+    if (!dll) {
+        fprintf(stderr, "sankey-startup: cannot load %s\n", dllPath.c_str());
+        return 1;
+    }
+
+    CreateFn create = reinterpret_cast<CreateFn>(GetProcAddress(dll, "Create"));
+    DestroyFn destroy = reinterpret_cast<DestroyFn>(GetProcAddress(dll, "Destroy"));
+    VerifyFn verify = reinterpret_cast<VerifyFn>(GetProcAddress(dll, "Verify"));
+    WarmupFn warmupFn = reinterpret_cast<WarmupFn>(GetProcAddress(dll, "Warmup"));
+    if (!create || !destroy || !verify || !warmupFn) {
+        fprintf(stderr, "sankey-startup: %s lacks the expected exports\n", dllPath.c_str());
+        FreeLibrary(dll);
+        return 1;
+    }
+
+    double warmupMicros = 0;
+    if (warmup != "none") {
+        Clock::time_point warmupStart = Clock::now();
+        bool ok = warmupFn(warmup == "background");
+        warmupMicros = microsSince(warmupStart);
+        if (!ok) {
+            fprintf(stderr, "sankey-startup: Warmup failed\n");
+        }
+    }
+
+    CSankeyLicenseDecoder* decoder = create();
+    Clock::time_point verifyStart = Clock::now();
+    int status = verify(decoder, key.c_str(), license.c_str(), accountId.c_str());
+    double firstMicros = microsSince(verifyStart);
+    double toValidMicros = microsSince(start);
+
+    verifyStart = Clock::now();
+    int again = verify(decoder, key.c_str(), license.c_str(), accountId.c_str());
+    double secondMicros = microsSince(verifyStart);
+    destroy(decoder);
+    FreeLibrary(dll);
+
+    if (status != Valid || again != Valid) {
+        fprintf(stderr, "sankey-startup: verify returned %d, then %d\n", status, again);
+        return 1;
+    }
+
+    printf("load           %9.1f us\n", loadMicros);
+    if (warmup != "none") {
+        printf("warmup         %9.1f us (%s)\n", warmupMicros, warmup.c_str());
+    }
+    printf("first verify   %9.1f us\n", firstMicros);
+    printf("second verify  %9.1f us\n", secondMicros);
+    printf("load to Valid  %9.1f us\n", toValidMicros);
+    return 0;
+}
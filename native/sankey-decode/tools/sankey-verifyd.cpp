@@ -0,0 +1,368 @@
+﻿// sankey-verifyd: local verification daemon for hosts running many terminals.
+//
+//   sankey-verifyd [--pipe NAME] [--workers N] [--batch N] [--cache N] [--clients N]
+//                  --keys-file PATH...
+//
+// Keys files hold one Base64 master key per line ('#' starts a comment);
+// PATH "-" reads them from stdin. Keys are never taken on the command line,
+// where any process on the host can read them.
+//
+// Serves the CVerifyDaemonProtocol over a named pipe. Key contexts are built
+// once at startup and shared by all clients; verified payloads are cached by
+// (key, account, license) so every terminal after the first gets its answer
+// without decrypting or parsing. The cache holds up to --cache outcomes in
+// sharded LRU order. Queued requests are drained in batches grouped by key
+// so one key context stays hot per run.
+//
+// Each connection has a serving thread, at most --clients at a time; while
+// all are busy no pipe instance is listening and clients verify in-process.
+// Connections idle for kIdleTimeoutMillis are closed, since clients keep
+// theirs open between verifies.
+#include "SankeyDecoder.h"
+#include "CSankeyKeyContext.h"
+#include "CVerifyDaemonClient.h"
+#include "CVerifyDaemonProtocol.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+const DWORD kIdleTimeoutMillis = 30000;
+
+struct VerifyJob {
+    VerifyDaemonRequest request;
+    std::promise<std::vector<unsigned char>> reply;
+};
+
+struct CachedOutcome {
+    std::shared_ptr<const nlohmann::json> payload;
+    std::vector<unsigned char> packedPayload;
+    long expiry;
+};
+
+// Verified outcomes by (key digest, account, license). Split into shards,
+// each with its own mutex and LRU list like CKeyContextCache, so workers
+// answering different licenses rarely contend and a full cache evicts its
+// coldest entries instead of starting over.
+class COutcomeCache {
+private:
+    static const size_t kShards = 16;
+
+    struct Entry {
+        std::string key;
+        CachedOutcome outcome;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> lru; // Most recently used first
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    };
+
+    Shard shards_[kShards];
+    size_t shardLimit_;
+
+    Shard& shard(const std::string& key) { return shards_[std::hash<std::string>()(key) % kShards]; }
+
+public:
+    explicit COutcomeCache(size_t capacity) : shardLimit_(std::max<size_t>(1, capacity / kShards)) {}
+
+    // Valid with the packed payload, Expired (and dropped) once past its
+    // expiry, or false on a miss
+    bool find(const std::string& key, time_t now, int32_t& status, std::vector<unsigned char>& packedPayload) {
+        Shard& s = shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.index.find(key);
+        if (it == s.index.end()) {
+            return false;
+        }
+        const CachedOutcome& outcome = it->second->outcome;
+        if (outcome.expiry > 0 && now > outcome.expiry) {
+            status = Expired;
+            s.lru.erase(it->second);
+            s.index.erase(it);
+            return true;
+        }
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        status = Valid;
+        packedPayload = outcome.packedPayload;
+        return true;
+    }
+
+    void insert(const std::string& key, CachedOutcome outcome) {
+        Shard& s = shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.index.find(key);
+        if (it != s.index.end()) {
+            it->second->outcome = std::move(outcome);
+            s.lru.splice(s.lru.begin(), s.lru, it->second);
+            return;
+        }
+        s.lru.push_front(Entry{key, std::move(outcome)});
+        s.index.emplace(key, s.lru.begin());
+        while (s.lru.size() > shardLimit_) {
+            s.index.erase(s.lru.back().key);
+            s.lru.pop_back();
+        }
+    }
+};
+
+class CVerifyDaemon {
+private:
+    std::map<std::string, std::unique_ptr<CSankeyKeyContext>> keys_; // By key digest; read-only once serving
+    std::mutex queueMutex_;
+    std::condition_variable queueReady_;
+    std::deque<VerifyJob*> queue_;
+    COutcomeCache cache_;
+    size_t batchSize_;
+    std::mutex clientsMutex_;
+    std::condition_variable clientDone_;
+    unsigned clients_;    // Serving threads running
+    unsigned maxClients_;
+
+    void workerLoop();
+    void process(CSankeyLicenseDecoder& decoder, VerifyJob& job);
+    void serveClient(HANDLE hPipe);
+
+public:
+    CVerifyDaemon(size_t cacheLimit, size_t batchSize, unsigned maxClients)
+        : cache_(cacheLimit), batchSize_(batchSize), clients_(0), maxClients_(maxClients) {}
+
+    bool addKey(const char* masterKeyB64);
+    size_t keyCount() const { return keys_.size(); }
+    int run(const std::string& pipeName, unsigned workers);
+};
+
+bool CVerifyDaemon::addKey(const char* masterKeyB64) {
+    std::unique_ptr<CSankeyKeyContext> keyCtx(CSankeyKeyContext::create(masterKeyB64));
+    if (!keyCtx) {
+        return false;
+    }
+    std::string digest(reinterpret_cast<const char*>(keyCtx->digest()), 32);
+    keys_[digest] = std::move(keyCtx);
+    return true;
+}
+
+void CVerifyDaemon::workerLoop() {
+    CSankeyLicenseDecoder decoder;
+    std::vector<VerifyJob*> batch;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(queueMutex_);
+            queueReady_.wait(lock, [this]() { return !queue_.empty(); });
+            size_t n = std::min(batchSize_, queue_.size());
+            batch.assign(queue_.begin(), queue_.begin() + n);
+            queue_.erase(queue_.begin(), queue_.begin() + n);
+        }
+
+        std::stable_sort(batch.begin(), batch.end(), [](const VerifyJob* a, const VerifyJob* b) {
+            return memcmp(a->request.keyDigest, b->request.keyDigest, 32) < 0;
+        });
+        for (VerifyJob* job : batch) {
+            process(decoder, *job);
+        }
+    }
+}
+
+void CVerifyDaemon::process(CSankeyLicenseDecoder& decoder, VerifyJob& job) {
+    const VerifyDaemonRequest& request = job.request;
+    VerifyDaemonResponse response;
+    response.status = KeyError;
+    memset(response.mac, 0, sizeof(response.mac));
+
+    std::string digest(reinterpret_cast<const char*>(request.keyDigest), 32);
+    auto key = keys_.find(digest);
+    if (key != keys_.end()) {
+        const CSankeyKeyContext& keyCtx = *key->second;
+        std::string cacheKey = digest + request.accountId + '\0' + request.license;
+
+        if (!cache_.find(cacheKey, time(nullptr), response.status, response.payload)) {
+            std::shared_ptr<const nlohmann::json> payload;
+            response.status = decoder.decode(keyCtx, request.license.data(), request.license.size(),
+                                             request.accountId.c_str(), payload);
+            if (response.status == Valid) {
+                CachedOutcome outcome;
+                outcome.payload = payload;
+                outcome.packedPayload = nlohmann::json::to_msgpack(*payload);
+                outcome.expiry = decoder.payloadExpiry(*payload);
+                response.payload = outcome.packedPayload;
+                cache_.insert(cacheKey, std::move(outcome));
+            }
+        }
+
+        CVerifyDaemonProtocol::responseMac(keyCtx, request, response.status, response.payload, response.mac);
+    }
+
+    std::vector<unsigned char> message;
+    CVerifyDaemonProtocol::encodeResponse(response, message);
+    job.reply.set_value(std::move(message));
+}
+
+void CVerifyDaemon::serveClient(HANDLE hPipe) {
+    std::vector<unsigned char> message;
+    while (CVerifyDaemonProtocol::readMessage(hPipe, message, kIdleTimeoutMillis)) {
+        VerifyJob job;
+        if (!CVerifyDaemonProtocol::decodeRequest(message, job.request)) {
+            break;
+        }
+        std::future<std::vector<unsigned char>> reply = job.reply.get_future();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            queue_.push_back(&job);
+        }
+        queueReady_.notify_one();
+
+        message = reply.get();
+        if (!CVerifyDaemonProtocol::writeMessage(hPipe, message, kIdleTimeoutMillis)) {
+            break;
+        }
+    }
+    DisconnectNamedPipe(hPipe);
+    CloseHandle(hPipe);
+
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex_);
+        --clients_;
+    }
+    clientDone_.notify_one();
+}
+
+int CVerifyDaemon::run(const std::string& pipeName, unsigned workers) {
+    for (unsigned i = 0; i < workers; ++i) {
+        std::thread(&CVerifyDaemon::workerLoop, this).detach();
+    }
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(clientsMutex_);
+            clientDone_.wait(lock, [this]() { return clients_ < maxClients_; });
+        }
+
+        HANDLE hPipe = CreateNamedPipeA(pipeName.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+                                        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                        PIPE_UNLIMITED_INSTANCES, 64 * 1024, 64 * 1024, 0, NULL);
+        if (hPipe == INVALID_HANDLE_VALUE) {
+            fprintf(stderr, "sankey-verifyd: cannot create pipe %s (error %lu)\n", pipeName.c_str(), (unsigned long)GetLastError());
+            return 1;
+        }
+
+        OVERLAPPED overlapped;
+        ZeroMemory(&overlapped, sizeof(overlapped));
+        overlapped.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+        BOOL connected = ConnectNamedPipe(hPipe, &overlapped);
+        if (!connected) {
+            DWORD error = GetLastError();
+            if (error == ERROR_IO_PENDING) {
+                DWORD unused = 0;
+                connected = GetOverlappedResult(hPipe, &overlapped, &unused, TRUE);
+            } else {
+                connected = error == ERROR_PIPE_CONNECTED;
+            }
+        }
+        CloseHandle(overlapped.hEvent);
+
+        if (!connected) {
+            CloseHandle(hPipe);
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(clientsMutex_);
+            ++clients_;
+        }
+        std::thread(&CVerifyDaemon::serveClient, this, hPipe).detach();
+    }
+}
+
+void usage() {
+    fprintf(stderr,
+            "usage: sankey-verifyd [--pipe NAME] [--workers N] [--batch N] [--cache N] [--clients N]\n"
+            "                      --keys-file PATH...\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string pipeName = CVerifyDaemonProtocol::defaultPipeName();
+    unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+    size_t batchSize = 32;
+    size_t cacheLimit = 100000;
+    unsigned maxClients = 64;
+    std::vector<std::string> keys;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        const char* value = argv[++i];
+        if (arg == "--pipe") {
+            pipeName = value;
+        } else if (arg == "--workers") {
+            workers = std::max(1, atoi(value));
+        } else if (arg == "--batch") {
+            batchSize = (size_t)std::max(1, atoi(value));
+        } else if (arg == "--cache") {
+            cacheLimit = (size_t)std::max(1, atoi(value));
+        } else if (arg == "--clients") {
+            maxClients = (unsigned)std::max(1, atoi(value));
+        } else if (arg == "--key") {
+            fprintf(stderr, "sankey-verifyd: --key is not supported, keys on the command line are visible to other processes; use --keys-file\n");
+            return 2;
+        } else if (arg == "--keys-file") {
+            std::ifstream file;
+            if (strcmp(value, "-") != 0) {
+                file.open(value);
+                if (!file) {
+                    fprintf(stderr, "sankey-verifyd: cannot read keys file %s\n", value);
+                    return 2;
+                }
+            }
+            std::istream& in = file.is_open() ? file : std::cin;
+            std::string line;
+            while (std::getline(in, line)) {
+                line.erase(line.find_last_not_of(" \t\r\n") + 1);
+                if (!line.empty() && line[0] != '#') {
+                    keys.push_back(line);
+                }
+            }
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    // Never forward to ourselves, whatever SANKEY_VERIFYD_PIPE says
+    CVerifyDaemonClient::instance().configure(nullptr);
+
+    CVerifyDaemon daemon(cacheLimit, batchSize, maxClients);
+    for (const std::string& key : keys) {
+        if (!daemon.addKey(key.c_str())) {
+            fprintf(stderr, "sankey-verifyd: ignoring invalid master key\n");
+        }
+    }
+    if (daemon.keyCount() == 0) {
+        usage();
+        return 2;
+    }
+
+    fprintf(stderr, "sankey-verifyd: serving %zu key(s) on %s with %u worker(s)\n", daemon.keyCount(), pipeName.c_str(), workers);
+    return daemon.run(pipeName, workers);
+}
@@ -1,11 +1,70 @@
 import { webcrypto } from 'crypto';
 import { LicensePayload } from '../models/licensePayload';
+import { buildFleetTree, decodeFleetProof, encodeFleetProof, verifyFleetProof } from './fleetMerkle';
+
+// v2 エンベロープ: "v2:" + Base64(keyId(8) + IV(16) + HMAC(32) + Ciphertext)
+// keyId は SHA-256(マスターキー) の先頭 8 バイト。HMAC の対象にも含める
+const V2_PREFIX = 'v2:';
+const KEY_ID_LENGTH = 8;
+
+// フリートライセンス: "f1:" + Base64(keyId(8) + root(32) + leafCount(u32 LE) + IV + HMAC + Ciphertext)
+//                     + "." + Base64(証明: index(u32 LE) + 兄弟ノード(32)...)
+// HMAC は keyId + root + leafCount + IV + Ciphertext が対象で accountId は含めない。
+// accountId は証明から root を再計算して照合する（fleetMerkle.ts）
+const FLEET_PREFIX = 'f1:';
+const FLEET_HEADER_LENGTH = KEY_ID_LENGTH + 32 + 4;
+
+export async function computeKeyId(key: CryptoKey): Promise<Uint8Array> {
+  const rawKey = await webcrypto.subtle.exportKey("raw", key);
+  const digest = await webcrypto.subtle.digest('SHA-256', rawKey);
+  return new Uint8Array(digest).subarray(0, KEY_ID_LENGTH);
+}
 
 export async function encryptLicense(
     key: CryptoKey,
     payload: LicensePayload,
     accountId: string
 ): Promise<string> {
+  return (await sealLicense(key, payload, accountId, new Uint8Array(0))).toString('base64');
+}
+
+// キーローテーション用。検証側 (VerifyWithKeyring) が keyId で鍵を直接選択できる
+export async function encryptLicenseV2(
+    key: CryptoKey,
+    payload: LicensePayload,
+    accountId: string
+): Promise<string> {
+  const keyId = await computeKeyId(key);
+  return V2_PREFIX + (await sealLicense(key, payload, accountId, keyId)).toString('base64');
+}
+
+// 複数アカウント用。1 回の暗号化で全アカウント分のライセンス文字列 (accountId → ライセンス) を返す
+export async function encryptFleetLicense(
+    key: CryptoKey,
+    payload: LicensePayload,
+    accountIds: string[]
+): Promise<Record<string, string>> {
+  const tree = buildFleetTree(accountIds);
+  const leafCount = Buffer.alloc(4);
+  leafCount.writeUInt32LE(tree.leafCount);
+  const header = Buffer.concat([await computeKeyId(key), tree.root, leafCount]);
+
+  const body = FLEET_PREFIX + (await sealLicense(key, payload, '', header)).toString('base64');
+
+  const licenses: Record<string, string> = {};
+  for (const accountId of tree.accountIds) {
+    licenses[accountId] = body + '.' + encodeFleetProof(tree.proofFor(accountId)!).toString('base64');
+  }
+  return licenses;
+}
+
+// header は IV の前に置かれ HMAC の対象になる部分 (v1: なし, v2: keyId, フリート: keyId + root + leafCount)
+async function sealLicense(
+    key: CryptoKey,
+    payload: LicensePayload,
+    accountId: string,
+    header: Uint8Array
+): Promise<Buffer> {
   // --- 鍵長の検証 ---
   const rawKey = await webcrypto.subtle.exportKey("raw", key);
   if (rawKey.byteLength !== 32) {
@@ -35,22 +94,20 @@ export async function encryptLicense(
       ['sign']
   );
 
-  // --- HMAC の生成 (AES-CBC 暗号文 + IV + accountId) ---
+  // --- HMAC の生成 (header + IV + AES-CBC 暗号文 + accountId) ---
   const hmac = await webcrypto.subtle.sign(
       'HMAC',
       hmacKey,
-      Buffer.concat([iv, new Uint8Array(ctBuffer), new TextEncoder().encode(accountId)])
+      Buffer.concat([header, iv, new Uint8Array(ctBuffer), new TextEncoder().encode(accountId)])
   );
 
-  // --- IV + HMAC + Ciphertext を結合 ---
-  const combined = Buffer.concat([
+  // --- header + IV + HMAC + Ciphertext を結合 ---
+  return Buffer.concat([
+    header,
     iv,
     new Uint8Array(hmac),
     new Uint8Array(ctBuffer)
   ]);
-
-  // --- Base64 エンコードして返却 ---
-  return combined.toString('base64');
 }
 
 export async function decryptLicense(
@@ -63,11 +120,25 @@ export async function decryptLicense(
     throw new Error("Invalid key length. Only 256-bit keys are supported.");
   }
 
-  const encryptedBuffer = Buffer.from(encrypted, 'base64');
+  const isV2 = encrypted.startsWith(V2_PREFIX);
+  const isFleet = encrypted.startsWith(FLEET_PREFIX);
+  let encoded = isV2 || isFleet ? encrypted.slice(3) : encrypted;
+  let proofEncoded = '';
+  if (isFleet) {
+    [encoded, proofEncoded = ''] = encoded.split('.');
+  }
+  const encryptedBuffer = Buffer.from(encoded, 'base64');
+
+  // --- v2 / フリートは keyId で鍵の取り違えを HMAC 前に判定 ---
+  const header = encryptedBuffer.subarray(0, isFleet ? FLEET_HEADER_LENGTH : isV2 ? KEY_ID_LENGTH : 0);
+  if ((isV2 || isFleet) && !Buffer.from(await computeKeyId(key)).equals(header.subarray(0, KEY_ID_LENGTH))) {
+    throw new Error("Key ID mismatch. License was issued with a different master key.");
+  }
+  const body = encryptedBuffer.subarray(header.length);
 
-  const iv = encryptedBuffer.subarray(0, 16);
-  const hmac = encryptedBuffer.subarray(16, 48); // 32 bytes (SHA-256)
-  const ciphertext = encryptedBuffer.subarray(48);
+  const iv = body.subarray(0, 16);
+  const hmac = body.subarray(16, 48); // 32 bytes (SHA-256)
+  const ciphertext = body.subarray(48);
 
   const hmacKey = await webcrypto.subtle.importKey(
       'raw',
@@ -81,13 +152,22 @@ export async function decryptLicense(
       'HMAC',
       hmacKey,
       hmac,
-      Buffer.concat([iv, ciphertext, new TextEncoder().encode(accountId)])
+      Buffer.concat([header, iv, ciphertext, new TextEncoder().encode(isFleet ? '' : accountId)])
   );
 
   if (!isValid) {
     throw new Error("HMAC verification failed. Data may be tampered with.");
   }
 
+  // --- フリートは accountId が root に含まれることを証明で確認 ---
+  if (isFleet) {
+    const root = header.subarray(KEY_ID_LENGTH, KEY_ID_LENGTH + 32);
+    const leafCount = header.readUInt32LE(KEY_ID_LENGTH + 32);
+    if (!verifyFleetProof(root, leafCount, accountId, decodeFleetProof(Buffer.from(proofEncoded, 'base64')))) {
+      throw new Error("Account is not covered by this fleet license.");
+    }
+  }
+
   const algo: AesCbcParams = {
     name: 'AES-CBC',
     iv
@@ -0,0 +1,110 @@
+import { createHash } from 'crypto';
+
+// フリートライセンス用の Merkle ツリー
+//   leaf = SHA-256(0x00 || accountId)
+//   node = SHA-256(0x01 || left || right)
+// アカウントはバイト順でソート・重複除去してから葉にする（入力順に依らずルートが一意）。
+// 奇数個のレベルでは末尾のノードをそのまま上のレベルへ繰り上げる。
+// 検証側 (native/sankey-decode) と同じ規則なので変更する場合は両方を合わせること。
+
+export interface FleetProof {
+  index: number;
+  siblings: Buffer[];
+}
+
+export interface FleetTree {
+  root: Buffer;
+  leafCount: number;
+  accountIds: string[];
+  proofFor(accountId: string): FleetProof | undefined;
+}
+
+function hashLeaf(accountId: string): Buffer {
+  return createHash('sha256').update(Buffer.from([0x00])).update(accountId, 'utf8').digest();
+}
+
+function hashNode(left: Buffer, right: Buffer): Buffer {
+  return createHash('sha256').update(Buffer.from([0x01])).update(left).update(right).digest();
+}
+
+export function buildFleetTree(accountIds: string[]): FleetTree {
+  const sorted = Array.from(new Set(accountIds)).sort((a, b) => Buffer.compare(Buffer.from(a, 'utf8'), Buffer.from(b, 'utf8')));
+  if (sorted.length === 0) {
+    throw new Error("Fleet license requires at least one accountId");
+  }
+
+  // levels[0] が葉、最後がルート
+  const levels: Buffer[][] = [sorted.map(hashLeaf)];
+  while (levels[levels.length - 1].length > 1) {
+    const level = levels[levels.length - 1];
+    const next: Buffer[] = [];
+    for (let i = 0; i < level.length; i += 2) {
+      next.push(i + 1 < level.length ? hashNode(level[i], level[i + 1]) : level[i]);
+    }
+    levels.push(next);
+  }
+
+  const positions = new Map(sorted.map((accountId, index) => [accountId, index]));
+
+  return {
+    root: levels[levels.length - 1][0],
+    leafCount: sorted.length,
+    accountIds: sorted,
+    proofFor(accountId: string): FleetProof | undefined {
+      const index = positions.get(accountId);
+      if (index === undefined) {
+        return undefined;
+      }
+      const siblings: Buffer[] = [];
+      let i = index;
+      for (let depth = 0; depth < levels.length - 1; depth++) {
+        const sibling = i ^ 1;
+        if (sibling < levels[depth].length) {
+          siblings.push(levels[depth][sibling]);
+        }
+        i >>= 1;
+      }
+      return { index, siblings };
+    }
+  };
+}
+
+export function verifyFleetProof(root: Buffer, leafCount: number, accountId: string, proof: FleetProof): boolean {
+  if (proof.index < 0 || proof.index >= leafCount) {
+    return false;
+  }
+  let node = hashLeaf(accountId);
+  let index = proof.index;
+  let count = leafCount;
+  let used = 0;
+  while (count > 1) {
+    if ((index ^ 1) < count) {
+      if (used >= proof.siblings.length) {
+        return false;
+      }
+      const sibling = proof.siblings[used++];
+      node = (index & 1) ? hashNode(sibling, node) : hashNode(node, sibling);
+    }
+    index >>= 1;
+    count = (count + 1) >> 1;
+  }
+  return used === proof.siblings.length && node.equals(root);
+}
+
+// index(u32 LE) || siblings(32 バイトずつ)
+export function encodeFleetProof(proof: FleetProof): Buffer {
+  const index = Buffer.alloc(4);
+  index.writeUInt32LE(proof.index);
+  return Buffer.concat([index, ...proof.siblings]);
+}
+
+export function decodeFleetProof(encoded: Buffer): FleetProof {
+  if (encoded.length < 4 || (encoded.length - 4) % 32 !== 0) {
+    throw new Error("Invalid fleet proof");
+  }
+  const siblings: Buffer[] = [];
+  for (let offset = 4; offset < encoded.length; offset += 32) {
+    siblings.push(encoded.subarray(offset, offset + 32));
+  }
+  return { index: encoded.readUInt32LE(0), siblings };
+}
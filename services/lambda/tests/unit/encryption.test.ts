@@ -1,4 +1,4 @@
-import { encryptLicense, decryptLicense } from '../../src/services/encryption';
+import { encryptLicense, encryptLicenseV2, encryptFleetLicense, decryptLicense, computeKeyId } from '../../src/services/encryption';
 import { createLicensePayloadV1, LicensePayloadV1 } from '../../src/models/licensePayload';
 import { webcrypto } from 'crypto';
 
@@ -190,4 +190,76 @@ describe('License Encryption/Decryption', () => {
     expect(decrypted.version).toBe(2);
     expect((decrypted as any).newFeature).toBe('some-data'); // 型安全性のためにanyキャスト
   });
+
+  describe('v2 envelope (key id)', () => {
+    const payload = createLicensePayloadV1({
+      eaName: 'TestEA',
+      accountId: accountId,
+      expiry: '2037-12-31T23:59:59Z',
+      userId: 'test-user-123',
+      issuedAt: '2025-06-10T12:00:00Z'
+    });
+
+    it('should prefix v2 and carry the key id ahead of the IV', async () => {
+      const encrypted = await encryptLicenseV2(key, payload, accountId);
+      expect(encrypted.startsWith('v2:')).toBe(true);
+
+      const buf = Buffer.from(encrypted.slice(3), 'base64');
+      expect(buf.subarray(0, 8)).toEqual(Buffer.from(await computeKeyId(key)));
+      expect(buf.length).toBeGreaterThan(8 + 48);
+    });
+
+    it('should decrypt a v2 license', async () => {
+      const encrypted = await encryptLicenseV2(key, payload, accountId);
+      const decrypted = await decryptLicense(key, encrypted, accountId);
+      expect(decrypted).toEqual(payload);
+    });
+
+    it('should reject a v2 license for another key before checking the HMAC', async () => {
+      const encrypted = await encryptLicenseV2(key, payload, accountId);
+      const otherKey = await webcrypto.subtle.importKey('raw', Buffer.alloc(32, 2), 'AES-CBC', true, ['decrypt']);
+      await expect(decryptLicense(otherKey, encrypted, accountId)).rejects.toThrow('Key ID mismatch');
+    });
+
+    it('should bind the key id into the HMAC', async () => {
+      const encrypted = await encryptLicenseV2(key, payload, accountId);
+      const buf = Buffer.from(encrypted.slice(3), 'base64');
+      const stripped = buf.subarray(8).toString('base64'); // v1 として再解釈
+      await expect(decryptLicense(key, stripped, accountId)).rejects.toThrow('HMAC verification failed');
+    });
+  });
+
+  describe('fleet license (Merkle proof)', () => {
+    const fleetPayload = createLicensePayloadV1({
+      eaName: 'FleetEA',
+      accountId: 'fleet',
+      expiry: '2037-12-31T23:59:59Z',
+      userId: 'prop-firm',
+      issuedAt: '2025-06-10T12:00:00Z'
+    });
+    const accounts = ['5678', '1234', '9012', '3456', '7890', '1234'];
+
+    it('should issue one license per distinct account sharing one body', async () => {
+      const licenses = await encryptFleetLicense(key, fleetPayload, accounts);
+      expect(Object.keys(licenses).sort()).toEqual(['1234', '3456', '5678', '7890', '9012']);
+
+      const bodies = new Set(Object.values(licenses).map(license => license.split('.')[0]));
+      expect(bodies.size).toBe(1);
+      expect(licenses['1234'].startsWith('f1:')).toBe(true);
+    });
+
+    it('should decrypt for every member account', async () => {
+      const licenses = await encryptFleetLicense(key, fleetPayload, accounts);
+      for (const [account, license] of Object.entries(licenses)) {
+        const decrypted = await decryptLicense(key, license, account);
+        expect(decrypted).toEqual(fleetPayload);
+      }
+    });
+
+    it('should reject a proof used for another account', async () => {
+      const licenses = await encryptFleetLicense(key, fleetPayload, accounts);
+      await expect(decryptLicense(key, licenses['1234'], '5678')).rejects.toThrow('not covered by this fleet license');
+      await expect(decryptLicense(key, licenses['1234'], '0000')).rejects.toThrow('not covered by this fleet license');
+    });
+  });
 });
\ No newline at end of file
@@ -0,0 +1,44 @@
+import { buildFleetTree, verifyFleetProof, encodeFleetProof, decodeFleetProof } from '../../src/services/fleetMerkle';
+
+describe('Fleet Merkle tree', () => {
+  const accountsOf = (n: number) => Array.from({ length: n }, (_, i) => String(100000 + i));
+
+  it('should prove every member for odd and even fleet sizes', () => {
+    for (let n = 1; n <= 17; n++) {
+      const tree = buildFleetTree(accountsOf(n));
+      expect(tree.leafCount).toBe(n);
+      for (const accountId of tree.accountIds) {
+        const proof = tree.proofFor(accountId)!;
+        expect(proof.siblings.length).toBeLessThanOrEqual(Math.ceil(Math.log2(n)));
+        expect(verifyFleetProof(tree.root, tree.leafCount, accountId, proof)).toBe(true);
+      }
+    }
+  });
+
+  it('should not depend on input order or duplicates', () => {
+    const a = buildFleetTree(['3', '1', '2']);
+    const b = buildFleetTree(['2', '3', '1', '3']);
+    expect(a.root.equals(b.root)).toBe(true);
+    expect(b.leafCount).toBe(3);
+  });
+
+  it('should reject non-members and proofs for other accounts', () => {
+    const tree = buildFleetTree(accountsOf(9));
+    const proof = tree.proofFor('100003')!;
+    expect(tree.proofFor('999999')).toBeUndefined();
+    expect(verifyFleetProof(tree.root, tree.leafCount, '100004', proof)).toBe(false);
+  });
+
+  it('should round-trip the proof encoding', () => {
+    const tree = buildFleetTree(accountsOf(6));
+    const proof = tree.proofFor('100005')!;
+    const decoded = decodeFleetProof(encodeFleetProof(proof));
+    expect(decoded.index).toBe(proof.index);
+    expect(verifyFleetProof(tree.root, tree.leafCount, '100005', decoded)).toBe(true);
+    expect(() => decodeFleetProof(Buffer.alloc(5))).toThrow('Invalid fleet proof');
+  });
+
+  it('should refuse an empty fleet', () => {
+    expect(() => buildFleetTree([])).toThrow();
+  });
+});